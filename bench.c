@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+
+bool bench_json;
+
+static const char *bench_name;
+
+void bench_init(int argc, char **argv, const char *name) {
+  bench_name = name;
+  for (int i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "--json"))
+      bench_json = true;
+}
+
+double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench_report(const char *name, const char *unit, double value) {
+  if (bench_json) {
+    /* The names are made by the benchmarks and never need escaping */
+    printf("{\"bench\": \"%s\", \"case\": \"%s\", \"unit\": \"%s\", \"value\": %.3f}\n",
+           bench_name, name, unit, value);
+  } else {
+    printf("%-10s %-32s %12.1f %s\n", bench_name, name, value, unit);
+  }
+  fflush(stdout);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* What the benchmarks share. Each result is one value of a named case, printed as a table row or,
+ * when the benchmark was run with --json, as a JSON object on a line of its own so results can be
+ * kept and compared between releases. */
+
+/* Read the arguments of the benchmark, which is named for its results */
+void bench_init(int argc, char **argv, const char *name);
+
+/* Whether the results go out as JSON */
+extern bool bench_json;
+
+/* Monotonic time in seconds */
+double bench_now(void);
+
+/* Report the value of a case, measured in the given unit */
+void bench_report(const char *name, const char *unit, double value);
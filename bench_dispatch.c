@@ -0,0 +1,77 @@
+/* Measures the cost of looking up builtin and program names, with the dispatch index against a
+ * linear strcmp over the same table. Run with `make bench`, or `make bench-json`. */
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "dispatch.h"
+
+#define ROUNDS 2000000
+
+/* The builtins of the shell and the ones planned next, so the table has a realistic size */
+static const char *builtins[] = {
+  "?", "exit", "cd", "pwd", "hash", "launch", "jobs", "fg", "bg", "wait", "parallel", "time",
+  "stats", "echo", "test", "[", "true", "false", "printf", "read", "cat", "tee", "export",
+  "unset", "set", "shift", "source", ".", "alias", "unalias", "type", "command", "kill",
+  "umask", "ulimit", "trap", "return", "break", "continue", "eval", "exec", "limit", "snapshot",
+};
+
+/* Builtins hit the table, the programs miss it with names of every length */
+static const char *hits[] = {"pwd", "cd", "parallel", "echo", "[", "snapshot", "wait", "export"};
+static const char *misses[] = {"ls", "grep", "make", "sed", "awk", "python3", "/usr/bin/env",
+                               "x86_64-linux-gnu-gcc"};
+
+#define LENGTH(a) (sizeof(a) / sizeof(a[0]))
+
+static int linear_find(const char *name) {
+  for (size_t i = 0; i < LENGTH(builtins); i++)
+    if (strcmp(builtins[i], name) == 0)
+      return (int) i;
+  return -1;
+}
+
+/* Keeps the compiler from dropping the lookups */
+static volatile int sink;
+
+static double measure(int (*find)(const char *), const char **names, size_t n) {
+  double start = bench_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (size_t i = 0; i < n; i++)
+      sink += find(names[i]);
+  return (bench_now() - start) * 1e9 / ((double) ROUNDS * n);
+}
+
+static struct dispatch builtin_index;
+
+static int index_find(const char *name) {
+  return dispatch_find(&builtin_index, name);
+}
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv, "lookup");
+  for (size_t i = 0; i < LENGTH(builtins); i++) {
+    if (dispatch_add(&builtin_index, builtins[i], i) == -1) {
+      fprintf(stderr, "%s: cannot be added to the index\n", builtins[i]);
+      return 1;
+    }
+  }
+
+  /* Both have to agree on every name before they are compared */
+  for (size_t i = 0; i < LENGTH(builtins); i++) {
+    if (index_find(builtins[i]) != linear_find(builtins[i])) {
+      fprintf(stderr, "%s: index and table disagree\n", builtins[i]);
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < LENGTH(misses); i++) {
+    if (index_find(misses[i]) != -1) {
+      fprintf(stderr, "%s: found in the index\n", misses[i]);
+      return 1;
+    }
+  }
+
+  bench_report("linear hit", "ns", measure(linear_find, hits, LENGTH(hits)));
+  bench_report("linear miss", "ns", measure(linear_find, misses, LENGTH(misses)));
+  bench_report("index hit", "ns", measure(index_find, hits, LENGTH(hits)));
+  bench_report("index miss", "ns", measure(index_find, misses, LENGTH(misses)));
+  return 0;
+}
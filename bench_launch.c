@@ -0,0 +1,98 @@
+/* Measures launching commands through the shell itself: the latency of starting and waiting for
+ * one external command with each launch backend, and the throughput of pipelines of growing
+ * length. The shell under test is ./shell. Run with `make bench`, or `make bench-json`. */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define SHELL "./shell"
+
+/* Commands run per measurement of the launch latency */
+#define LAUNCHES 2000
+
+/* Bytes pushed through each pipeline */
+#define PIPELINE_BYTES (512L << 20)
+
+static const char *backends[] = {"fork", "vfork", "spawn"};
+static int stages[] = {1, 2, 4, 8};
+
+#define LENGTH(a) (sizeof(a) / sizeof(a[0]))
+
+/* Seconds the shell takes to run the script, with its output thrown away. Returns -1 if it did
+ * not exit with status 0. */
+static double run_script(const char *script) {
+  char path[] = "/tmp/bench_launch.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1 || write(fd, script, strlen(script)) != (ssize_t) strlen(script)) {
+    perror(path);
+    return -1;
+  }
+  close(fd);
+
+  double start = bench_now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    execl(SHELL, SHELL, path, (char *) NULL);
+    perror(SHELL);
+    _exit(127);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  double elapsed = bench_now() - start;
+  unlink(path);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed : -1;
+}
+
+/* A for loop running the command LAUNCHES times */
+static char *loop_script(const char *backend, const char *command) {
+  size_t size = LAUNCHES * 8 + 256;
+  char *script = (char *) malloc(size);
+  size_t n = snprintf(script, size, "launch %s\nfor i in", backend);
+  for (int i = 0; i < LAUNCHES; i++)
+    n += snprintf(script + n, size - n, " %d", i);
+  snprintf(script + n, size - n, "; do %s; done\n", command);
+  return script;
+}
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv, "launch");
+  char name[64];
+
+  for (size_t b = 0; b < LENGTH(backends); b++) {
+    /* The same loop around the builtin true costs all but the launch itself */
+    char *external = loop_script(backends[b], "/bin/true");
+    char *builtin = loop_script(backends[b], "true");
+    double launched = run_script(external), baseline = run_script(builtin);
+    free(external);
+    free(builtin);
+    if (launched < 0 || baseline < 0) {
+      fprintf(stderr, "%s: the shell failed\n", backends[b]);
+      return 1;
+    }
+    snprintf(name, sizeof(name), "exec %s", backends[b]);
+    bench_report(name, "us", (launched - baseline) * 1e6 / LAUNCHES);
+  }
+
+  for (size_t s = 0; s < LENGTH(stages); s++) {
+    char script[512];
+    size_t n = snprintf(script, sizeof(script), "head -c %ld /dev/zero", PIPELINE_BYTES);
+    for (int k = 1; k < stages[s]; k++)
+      n += snprintf(script + n, sizeof(script) - n, " | cat");
+    snprintf(script + n, sizeof(script) - n, " > /dev/null\n");
+    double elapsed = run_script(script);
+    if (elapsed < 0) {
+      fprintf(stderr, "%d stages: the shell failed\n", stages[s]);
+      return 1;
+    }
+    snprintf(name, sizeof(name), "pipeline stages=%d", stages[s]);
+    bench_report(name, "MB/s", PIPELINE_BYTES / elapsed / 1e6);
+  }
+  return 0;
+}
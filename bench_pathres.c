@@ -0,0 +1,117 @@
+/* Measures how long pathres_lookup takes to resolve a program against PATHs of growing length:
+ * found in the last directory with nothing cached, found again from the cache, and not found at
+ * all. Run with `make bench`, or `make bench-json`. */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bench.h"
+#include "pathres.h"
+
+/* Programs in every directory, so that each one looks like a real bin directory */
+#define PROGRAMS 50
+
+#define ROUNDS 20000
+
+static size_t path_lengths[] = {1, 8, 32, 128};
+
+#define LENGTH(a) (sizeof(a) / sizeof(a[0]))
+
+static char root[] = "/tmp/bench_pathres.XXXXXX";
+
+static void program_path(char *path, size_t size, size_t dir, int program, size_t count) {
+  if (dir == count - 1 && program == 0)
+    snprintf(path, size, "%s/bin%zu/target", root, dir);
+  else
+    snprintf(path, size, "%s/bin%zu/program%d", root, dir, program);
+}
+
+/* Make the directories of the longest PATH, with the program looked for only in the last */
+static int make_dirs(size_t count) {
+  char path[256];
+  for (size_t d = 0; d < count; d++) {
+    snprintf(path, sizeof(path), "%s/bin%zu", root, d);
+    if (mkdir(path, 0755) == -1)
+      return -1;
+    for (int p = 0; p < PROGRAMS; p++) {
+      program_path(path, sizeof(path), d, p, count);
+      int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+      if (fd == -1)
+        return -1;
+      close(fd);
+    }
+  }
+  return 0;
+}
+
+static void remove_dirs(size_t count) {
+  char path[256];
+  for (size_t d = 0; d < count; d++) {
+    for (int p = 0; p < PROGRAMS; p++) {
+      program_path(path, sizeof(path), d, p, count);
+      unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/bin%zu", root, d);
+    rmdir(path);
+  }
+  rmdir(root);
+}
+
+/* PATH of the first count directories, the last of them holding the target */
+static char *make_path(size_t count, size_t total) {
+  size_t size = count * (strlen(root) + 32) + 1;
+  char *path = (char *) malloc(size);
+  size_t n = 0;
+  for (size_t d = 0; d < count; d++) {
+    size_t dir = d == count - 1 ? total - 1 : d;
+    n += snprintf(path + n, size - n, "%s%s/bin%zu", d ? ":" : "", root, dir);
+  }
+  return path;
+}
+
+static double measure(const char *name, bool cold, int rounds) {
+  pathres_lookup(name);
+  double start = bench_now();
+  for (int r = 0; r < rounds; r++) {
+    if (cold)
+      pathres_reset();
+    pathres_lookup(name);
+  }
+  return (bench_now() - start) * 1e9 / rounds;
+}
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv, "pathres");
+  size_t total = path_lengths[LENGTH(path_lengths) - 1];
+  if (!mkdtemp(root) || make_dirs(total) == -1) {
+    perror(root);
+    return 1;
+  }
+
+  int status = 0;
+  for (size_t i = 0; i < LENGTH(path_lengths) && status == 0; i++) {
+    char *path = make_path(path_lengths[i], total);
+    char name[64];
+
+    pathres_set_path(path);
+    if (!pathres_lookup("target") || pathres_lookup("missing")) {
+      fprintf(stderr, "PATH of %zu directories: wrong resolution\n", path_lengths[i]);
+      status = 1;
+    } else {
+      snprintf(name, sizeof(name), "cold dirs=%zu", path_lengths[i]);
+      bench_report(name, "ns", measure("target", true, ROUNDS / path_lengths[i]));
+      pathres_set_path(path);
+      snprintf(name, sizeof(name), "cached dirs=%zu", path_lengths[i]);
+      bench_report(name, "ns", measure("target", false, ROUNDS * 10));
+      snprintf(name, sizeof(name), "miss dirs=%zu", path_lengths[i]);
+      bench_report(name, "ns", measure("missing", false, ROUNDS / path_lengths[i]));
+    }
+    free(path);
+  }
+
+  remove_dirs(total);
+  return status;
+}
@@ -0,0 +1,88 @@
+/* Measures tokenize throughput on long generated lines with every scanner the CPU supports.
+ * Run with `make bench`, or `make bench-json`. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "scan.h"
+#include "tokenizer.h"
+
+#define LINE_LENGTH (4 << 20)
+#define ROUNDS 20
+
+/* A line of words of random length, with some quoted and escaped ones mixed in */
+static char *make_line(size_t length, size_t word_max) {
+  char *line = (char *) malloc(length + 1);
+  size_t i = 0;
+  srand(162);
+  while (i < length) {
+    size_t word = 1 + rand() % word_max;
+    int kind = rand() % 8;
+    if (kind == 0 && i + word + 2 < length) {
+      line[i++] = '"';
+      for (size_t k = 0; k < word; k++)
+        line[i++] = 'a' + k % 26;
+      line[i++] = '"';
+    } else if (kind == 1 && i + 2 < length) {
+      line[i++] = '\\';
+      line[i++] = ' ';
+    } else {
+      for (size_t k = 0; k < word && i < length; k++)
+        line[i++] = 'a' + (k * 7) % 26;
+    }
+    if (i < length)
+      line[i++] = ' ';
+  }
+  line[length] = '\0';
+  return line;
+}
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv, "tokenize");
+  size_t word_sizes[] = {4, 32, 256};
+  struct tokens *tokens = tokens_create();
+  struct tokens *reference = tokens_create();
+
+  for (size_t w = 0; w < sizeof(word_sizes) / sizeof(size_t); w++) {
+    char *line = make_line(LINE_LENGTH, word_sizes[w]);
+
+    scanner_select("scalar");
+    tokenize_buffer(reference, line, LINE_LENGTH);
+
+    for (const char **name = scanner_names(); *name; name++) {
+      scanner_select(*name);
+
+      /* Every scanner has to split the line exactly like the scalar one */
+      tokenize_buffer(tokens, line, LINE_LENGTH);
+      size_t count = tokens_get_length(tokens);
+      if (count != tokens_get_length(reference)) {
+        fprintf(stderr, "%s: %zu words, expected %zu\n", *name, count,
+                tokens_get_length(reference));
+        return 1;
+      }
+      for (size_t i = 0; i < count; i++) {
+        if (strcmp(tokens_get_token(tokens, i), tokens_get_token(reference, i))) {
+          fprintf(stderr, "%s: word %zu differs\n", *name, i);
+          return 1;
+        }
+      }
+
+      /* One untimed round to warm up the caches and the branch predictor */
+      tokenize_buffer(tokens, line, LINE_LENGTH);
+
+      double start = bench_now();
+      for (int r = 0; r < ROUNDS; r++)
+        tokenize_buffer(tokens, line, LINE_LENGTH);
+      double elapsed = bench_now() - start;
+
+      char name_buffer[64];
+      snprintf(name_buffer, sizeof(name_buffer), "%s words<=%zu", *name, word_sizes[w]);
+      bench_report(name_buffer, "MB/s", (double) LINE_LENGTH * ROUNDS / elapsed / 1e6);
+    }
+    free(line);
+  }
+
+  tokens_destroy(tokens);
+  tokens_destroy(reference);
+  return 0;
+}
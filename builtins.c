@@ -0,0 +1,854 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "builtins.h"
+#include "copy.h"
+#include "reader.h"
+#include "shell.h"
+#include "vars.h"
+
+/* Convenience macro to silence compiler warnings about unused function parameters. */
+#define unused __attribute__((unused))
+
+/* Print the character named by the escape sequence that follows a backslash. In echo and %b octal
+ * escapes are written \0nnn, in a printf format \nnn. Returns the number of characters used after
+ * the backslash and sets *stop on \c, which ends the output. */
+static size_t print_escape(const char *s, bool zero_octal, bool *stop) {
+  static const char plain[] = "\\\\a\ab\be\033f\fn\nr\rt\tv\v\"\"''";
+  size_t n = 0;
+
+  for (const char *p = plain; *p; p += 2) {
+    if (s[0] == p[0]) {
+      putchar(p[1]);
+      return 1;
+    }
+  }
+
+  if (s[0] == 'c') {
+    *stop = true;
+    return 1;
+  }
+
+  if (s[0] >= '0' && s[0] <= '7' && (!zero_octal || s[0] == '0')) {
+    int c = 0;
+    if (zero_octal)
+      n++;
+    for (size_t digits = 0; digits < 3 && s[n] >= '0' && s[n] <= '7'; digits++)
+      c = c * 8 + (s[n++] - '0');
+    putchar(c & 0xff);
+    return n;
+  }
+
+  if (s[0] == 'x' && isxdigit((unsigned char) s[1])) {
+    int c = 0;
+    for (n = 1; n < 3 && isxdigit((unsigned char) s[n]); n++)
+      c = c * 16 + (isdigit((unsigned char) s[n]) ? s[n] - '0' : tolower(s[n]) - 'a' + 10);
+    putchar(c);
+    return n;
+  }
+
+  /* Not an escape, so the backslash stays */
+  putchar('\\');
+  if (s[0] == '\0')
+    return 0;
+  putchar(s[0]);
+  return 1;
+}
+
+/* Print s, expanding the echo escapes in it. Returns false if \c ended the output. */
+static bool print_escaped(const char *s) {
+  bool stop = false;
+  while (*s && !stop) {
+    if (*s == '\\')
+      s += 1 + print_escape(s + 1, true, &stop);
+    else
+      putchar(*s++);
+  }
+  return !stop;
+}
+
+int cmd_echo(int argc, char **argv) {
+  bool newline = true, escapes = false;
+  int i = 1;
+
+  /* Only words made entirely of the option letters are options, like in other shells */
+  for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    const char *opt = argv[i] + 1;
+    if (strspn(opt, "neE") != strlen(opt))
+      break;
+    for (; *opt; opt++) {
+      if (*opt == 'n')
+        newline = false;
+      else
+        escapes = *opt == 'e';
+    }
+  }
+
+  for (int first = i; i < argc; i++) {
+    if (i > first)
+      putchar(' ');
+    if (!escapes)
+      fputs(argv[i], stdout);
+    else if (!print_escaped(argv[i]))
+      return 1;
+  }
+
+  if (newline)
+    putchar('\n');
+  return 1;
+}
+
+/* The arguments left over for the conversions of a printf format */
+struct printf_args {
+  char **argv;
+  int argc;
+  int next;
+  bool failed;
+};
+
+static const char *take_string(struct printf_args *args) {
+  return args->next < args->argc ? args->argv[args->next++] : NULL;
+}
+
+/* A numeric argument may also be a quote followed by a character, which stands for its code */
+static bool take_number(struct printf_args *args, const char **arg, uintmax_t *code) {
+  *arg = take_string(args);
+  if (*arg && (**arg == '\'' || **arg == '"')) {
+    *code = (unsigned char) (*arg)[1];
+    return true;
+  }
+  return false;
+}
+
+static void check_number(struct printf_args *args, const char *arg, const char *end) {
+  if (end == arg || *end || errno == ERANGE) {
+    fprintf(stderr, "printf: %s: invalid number.\n", arg);
+    args->failed = true;
+  }
+}
+
+static intmax_t take_int(struct printf_args *args) {
+  const char *arg;
+  uintmax_t code;
+  if (take_number(args, &arg, &code))
+    return (intmax_t) code;
+  if (!arg)
+    return 0;
+
+  char *end;
+  errno = 0;
+  intmax_t value = strtoimax(arg, &end, 0);
+  check_number(args, arg, end);
+  return value;
+}
+
+static uintmax_t take_uint(struct printf_args *args) {
+  const char *arg;
+  uintmax_t code;
+  if (take_number(args, &arg, &code))
+    return code;
+  if (!arg)
+    return 0;
+
+  char *end;
+  errno = 0;
+  uintmax_t value = strtoumax(arg, &end, 0);
+  check_number(args, arg, end);
+  return value;
+}
+
+static long double take_float(struct printf_args *args) {
+  const char *arg;
+  uintmax_t code;
+  if (take_number(args, &arg, &code))
+    return (long double) code;
+  if (!arg)
+    return 0;
+
+  char *end;
+  errno = 0;
+  long double value = strtold(arg, &end);
+  check_number(args, arg, end);
+  return value;
+}
+
+/* Width and precision given as * come before the value */
+#define PRINT_SPEC(spec, stars, star, value)                                                       \
+  ((stars) == 0   ? printf(spec, value)                                                          \
+   : (stars) == 1 ? printf(spec, star[0], value)                                                 \
+                  : printf(spec, star[0], star[1], value))
+
+/* Print the format once, using up the arguments its conversions need. Returns false if the
+ * output has to end here, after \c or an invalid conversion. */
+static bool print_format(const char *format, struct printf_args *args) {
+  const char *f = format;
+
+  while (*f) {
+    if (*f == '\\') {
+      bool stop = false;
+      f += 1 + print_escape(f + 1, false, &stop);
+      if (stop)
+        return false;
+      continue;
+    }
+    if (*f != '%') {
+      putchar(*f++);
+      continue;
+    }
+    if (f[1] == '%') {
+      putchar('%');
+      f += 2;
+      continue;
+    }
+
+    /* Copy the flags, width and precision into a format for the C printf */
+    char spec[32];
+    size_t n = 0;
+    int star[2], stars = 0;
+    spec[n++] = *f++;
+    while (*f && strchr("-+ #0", *f) && n < 8)
+      spec[n++] = *f++;
+    if (*f == '*') {
+      star[stars++] = (int) take_int(args);
+      spec[n++] = *f++;
+    } else {
+      while (isdigit((unsigned char) *f) && n < 16)
+        spec[n++] = *f++;
+    }
+    if (*f == '.') {
+      spec[n++] = *f++;
+      if (*f == '*') {
+        star[stars++] = (int) take_int(args);
+        spec[n++] = *f++;
+      } else {
+        while (isdigit((unsigned char) *f) && n < 24)
+          spec[n++] = *f++;
+      }
+    }
+
+    char conv = *f;
+    if (conv == '\0') {
+      fprintf(stderr, "printf: %s: missing format character.\n", format);
+      args->failed = true;
+      return false;
+    }
+    f++;
+
+    switch (conv) {
+    case 'd':
+    case 'i':
+      spec[n++] = 'j';
+      spec[n++] = 'd';
+      spec[n] = '\0';
+      PRINT_SPEC(spec, stars, star, take_int(args));
+      break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      spec[n++] = 'j';
+      spec[n++] = conv;
+      spec[n] = '\0';
+      PRINT_SPEC(spec, stars, star, take_uint(args));
+      break;
+    case 'a':
+    case 'A':
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+      spec[n++] = 'L';
+      spec[n++] = conv;
+      spec[n] = '\0';
+      PRINT_SPEC(spec, stars, star, take_float(args));
+      break;
+    case 'c':
+    case 's': {
+      const char *arg = take_string(args);
+      char c[2] = {arg ? arg[0] : '\0', '\0'};
+      spec[n++] = 's';
+      spec[n] = '\0';
+      PRINT_SPEC(spec, stars, star, conv == 'c' ? c : arg ? arg : "");
+      break;
+    }
+    case 'b': {
+      /* Expand the escapes first, so width and precision apply to the result */
+      const char *arg = take_string(args);
+      char *expanded = NULL;
+      size_t length = 0;
+      FILE *saved = stdout;
+      stdout = open_memstream(&expanded, &length);
+      bool more = print_escaped(arg ? arg : "");
+      fclose(stdout);
+      stdout = saved;
+      spec[n++] = 's';
+      spec[n] = '\0';
+      PRINT_SPEC(spec, stars, star, expanded);
+      free(expanded);
+      if (!more)
+        return false;
+      break;
+    }
+    default:
+      fprintf(stderr, "printf: %c: invalid conversion.\n", conv);
+      args->failed = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+int cmd_printf(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "printf: usage: printf format [arguments]\n");
+    return 0;
+  }
+
+  /* The format is reused as long as it uses up some of the arguments left */
+  struct printf_args args = {argv, argc, 2, false};
+  for (;;) {
+    int before = args.next;
+    if (!print_format(argv[1], &args) || args.next == before || args.next >= argc)
+      break;
+  }
+  return !args.failed;
+}
+
+/* The words of a test expression being evaluated */
+struct test {
+  char **argv;
+  int argc;
+  int pos;
+  bool error;
+};
+
+static void test_error(struct test *t, const char *word, const char *message) {
+  if (!t->error)
+    fprintf(stderr, "test: %s: %s.\n", word, message);
+  t->error = true;
+}
+
+static bool is_unary(const char *op) {
+  return op[0] == '-' && op[1] && !op[2] && strchr("bcdefghkLnprsStuwxz", op[1]);
+}
+
+static bool is_binary(const char *op) {
+  static const char *ops[] = {"=",   "==",  "!=",  "-eq", "-ne", "-lt", "-le",
+                              "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+  for (const char **p = ops; *p; p++)
+    if (!strcmp(op, *p))
+      return true;
+  return false;
+}
+
+static bool test_unary(struct test *t, const char *op, const char *arg) {
+  struct stat st;
+
+  switch (op[1]) {
+  case 'n':
+    return arg[0] != '\0';
+  case 'z':
+    return arg[0] == '\0';
+  case 't':
+    return isatty(atoi(arg));
+  case 'r':
+    return access(arg, R_OK) == 0;
+  case 'w':
+    return access(arg, W_OK) == 0;
+  case 'x':
+    return access(arg, X_OK) == 0;
+  case 'h':
+  case 'L':
+    return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+  }
+
+  if (stat(arg, &st) == -1)
+    return false;
+
+  switch (op[1]) {
+  case 'e':
+    return true;
+  case 'f':
+    return S_ISREG(st.st_mode);
+  case 'd':
+    return S_ISDIR(st.st_mode);
+  case 'b':
+    return S_ISBLK(st.st_mode);
+  case 'c':
+    return S_ISCHR(st.st_mode);
+  case 'p':
+    return S_ISFIFO(st.st_mode);
+  case 'S':
+    return S_ISSOCK(st.st_mode);
+  case 's':
+    return st.st_size > 0;
+  case 'g':
+    return st.st_mode & S_ISGID;
+  case 'u':
+    return st.st_mode & S_ISUID;
+  case 'k':
+    return st.st_mode & S_ISVTX;
+  }
+  test_error(t, op, "unknown unary operator");
+  return false;
+}
+
+static long long test_integer(struct test *t, const char *arg) {
+  char *end;
+  errno = 0;
+  long long value = strtoll(arg, &end, 10);
+  while (isspace((unsigned char) *end))
+    end++;
+  if (end == arg || *end || errno == ERANGE)
+    test_error(t, arg, "integer expression expected");
+  return value;
+}
+
+static bool test_binary(struct test *t, const char *a, const char *op, const char *b) {
+  if (!strcmp(op, "=") || !strcmp(op, "=="))
+    return strcmp(a, b) == 0;
+  if (!strcmp(op, "!="))
+    return strcmp(a, b) != 0;
+
+  if (op[1] == 'n' && op[2] == 't') {
+    struct stat sa, sb;
+    if (stat(a, &sa) == -1)
+      return false;
+    return stat(b, &sb) == -1 || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+           (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec);
+  }
+  if (op[1] == 'o' && op[2] == 't')
+    return test_binary(t, b, "-nt", a);
+  if (op[1] == 'e' && op[2] == 'f') {
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev &&
+           sa.st_ino == sb.st_ino;
+  }
+
+  long long x = test_integer(t, a), y = test_integer(t, b);
+  if (!strcmp(op, "-eq"))
+    return x == y;
+  if (!strcmp(op, "-ne"))
+    return x != y;
+  if (!strcmp(op, "-lt"))
+    return x < y;
+  if (!strcmp(op, "-le"))
+    return x <= y;
+  if (!strcmp(op, "-gt"))
+    return x > y;
+  return x >= y;
+}
+
+static bool test_or(struct test *t);
+
+/* primary: ( expression ) | unary-op word | word binary-op word | word */
+static bool test_primary(struct test *t) {
+  if (t->pos >= t->argc) {
+    test_error(t, t->argv[t->argc - 1], "argument expected");
+    return false;
+  }
+
+  char *word = t->argv[t->pos];
+  if (t->pos + 2 < t->argc && is_binary(t->argv[t->pos + 1])) {
+    t->pos += 3;
+    return test_binary(t, word, t->argv[t->pos - 2], t->argv[t->pos - 1]);
+  }
+  if (!strcmp(word, "(")) {
+    t->pos++;
+    bool result = test_or(t);
+    if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")"))
+      test_error(t, word, "missing `)'");
+    t->pos++;
+    return result;
+  }
+  if (is_unary(word) && t->pos + 1 < t->argc) {
+    t->pos += 2;
+    return test_unary(t, word, t->argv[t->pos - 1]);
+  }
+  t->pos++;
+  return word[0] != '\0';
+}
+
+static bool test_not(struct test *t) {
+  if (t->pos < t->argc && !strcmp(t->argv[t->pos], "!")) {
+    t->pos++;
+    return !test_not(t);
+  }
+  return test_primary(t);
+}
+
+static bool test_and(struct test *t) {
+  bool result = test_not(t);
+  while (t->pos < t->argc && !strcmp(t->argv[t->pos], "-a")) {
+    t->pos++;
+    result = test_not(t) && result;
+  }
+  return result;
+}
+
+static bool test_or(struct test *t) {
+  bool result = test_and(t);
+  while (t->pos < t->argc && !strcmp(t->argv[t->pos], "-o")) {
+    t->pos++;
+    result = test_and(t) || result;
+  }
+  return result;
+}
+
+/* Expressions of up to four words are decided by their number of words, as POSIX requires, so
+ * that words like ! or = are taken as strings where an operator cannot be meant. Longer ones are
+ * parsed with the usual precedence of ! over -a over -o. */
+static bool test_words(struct test *t, char **argv, int argc) {
+  switch (argc) {
+  case 0:
+    return false;
+  case 1:
+    return argv[0][0] != '\0';
+  case 2:
+    if (!strcmp(argv[0], "!"))
+      return argv[1][0] == '\0';
+    if (is_unary(argv[0]))
+      return test_unary(t, argv[0], argv[1]);
+    test_error(t, argv[0], "unary operator expected");
+    return false;
+  case 3:
+    if (is_binary(argv[1]))
+      return test_binary(t, argv[0], argv[1], argv[2]);
+    if (!strcmp(argv[1], "-a"))
+      return argv[0][0] && argv[2][0];
+    if (!strcmp(argv[1], "-o"))
+      return argv[0][0] || argv[2][0];
+    if (!strcmp(argv[0], "!"))
+      return !test_words(t, argv + 1, 2);
+    if (!strcmp(argv[0], "(") && !strcmp(argv[2], ")"))
+      return argv[1][0] != '\0';
+    test_error(t, argv[1], "binary operator expected");
+    return false;
+  case 4:
+    if (!strcmp(argv[0], "!"))
+      return !test_words(t, argv + 1, 3);
+    if (!strcmp(argv[0], "(") && !strcmp(argv[3], ")"))
+      return test_words(t, argv + 1, 2);
+  }
+
+  t->pos = 0;
+  bool result = test_or(t);
+  if (t->pos < t->argc)
+    test_error(t, t->argv[t->pos], "too many arguments");
+  return result;
+}
+
+int cmd_test(int argc, char **argv) {
+  if (!strcmp(argv[0], "[")) {
+    if (strcmp(argv[argc - 1], "]")) {
+      fprintf(stderr, "[: missing `]'.\n");
+      return 0;
+    }
+    argc--;
+  }
+
+  struct test t = {argv + 1, argc - 1, 0, false};
+  bool result = test_words(&t, t.argv, t.argc);
+  return result && !t.error;
+}
+
+int cmd_true(unused int argc, unused char **argv) {
+  return 1;
+}
+
+int cmd_false(unused int argc, unused char **argv) {
+  return 0;
+}
+
+/* Read one line of fd into *line, without its newline. Bytes are read one at a time from pipes
+ * and terminals so that nothing after the line is taken away from whoever reads next; seekable
+ * input is read in blocks and rewound to just past the line. Returns the length, or -1 at end of
+ * input with nothing read. */
+static ssize_t read_line(int fd, char **line, size_t *capacity, bool *newline) {
+  bool seekable = lseek(fd, 0, SEEK_CUR) != -1;
+  size_t length = 0;
+  char block[512];
+
+  *newline = false;
+  for (;;) {
+    ssize_t n;
+    do {
+      n = read(fd, block, seekable ? sizeof(block) : 1);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0)
+      break;
+
+    char *end = memchr(block, '\n', n);
+    size_t used = end ? (size_t) (end - block) : (size_t) n;
+    if (length + used + 1 > *capacity) {
+      *capacity = (length + used + 1) * 2;
+      *line = (char *) realloc(*line, *capacity);
+    }
+    memcpy(*line + length, block, used);
+    length += used;
+
+    if (end) {
+      *newline = true;
+      if (seekable)
+        lseek(fd, (off_t) (used + 1) - n, SEEK_CUR);
+      break;
+    }
+  }
+
+  if (length == 0 && !*newline)
+    return -1;
+  (*line)[length] = '\0';
+  return (ssize_t) length;
+}
+
+/* Like read_line, from the reader of the shell when there is one, which may have read ahead of
+ * what the commands before took */
+static ssize_t next_line(struct reader *input, char **line, size_t *capacity, bool *newline) {
+  if (!input)
+    return read_line(STDIN_FILENO, line, capacity, newline);
+
+  const char *text;
+  ssize_t n = reader_getline(input, &text);
+  if (n == -1)
+    return -1;
+  *newline = n > 0 && text[n - 1] == '\n';
+  size_t length = (size_t) n - *newline;
+  if (length + 1 > *capacity) {
+    *capacity = (length + 1) * 2;
+    *line = (char *) realloc(*line, *capacity);
+  }
+  memcpy(*line, text, length);
+  (*line)[length] = '\0';
+  return (ssize_t) length;
+}
+
+static bool valid_name(const char *name) {
+  size_t n = vars_name_length(name);
+  return n > 0 && name[n] == '\0';
+}
+
+int cmd_read(int argc, char **argv) {
+  bool raw = false;
+  int first = 1;
+
+  if (first < argc && !strcmp(argv[first], "-r")) {
+    raw = true;
+    first++;
+  }
+  for (int i = first; i < argc; i++) {
+    if (!valid_name(argv[i])) {
+      fprintf(stderr, "read: `%s': not a valid identifier.\n", argv[i]);
+      return 0;
+    }
+  }
+
+  /* Read the line, joining it with the next one after a backslash unless -r is given */
+  char *line = NULL, *part = NULL;
+  size_t length = 0, part_capacity = 0;
+  bool newline = false, any = false;
+  ssize_t n;
+  /* Nothing is read ahead on a terminal, and the line editor is for commands */
+  struct reader *input = shell_is_interactive ? NULL : shell_stdin_reader();
+  while ((n = next_line(input, &part, &part_capacity, &newline)) != -1) {
+    any = true;
+    bool joined = !raw && newline && n > 0 && part[n - 1] == '\\';
+    if (joined) {
+      /* An even run of backslashes escapes the last one, not the newline */
+      ssize_t run = 0;
+      while (run < n && part[n - 1 - run] == '\\')
+        run++;
+      joined = run % 2 == 1;
+    }
+    line = (char *) realloc(line, length + n + 1);
+    memcpy(line + length, part, joined ? n - 1 : n);
+    length += joined ? n - 1 : n;
+    line[length] = '\0';
+    if (!joined)
+      break;
+  }
+  free(part);
+
+  if (!any) {
+    free(line);
+    return 0;
+  }
+
+  /* Backslashes quote the next character, which is then never a field separator */
+  char *text = (char *) malloc(length + 1);
+  bool *quoted = (bool *) calloc(length + 1, sizeof(bool));
+  size_t text_length = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (!raw && line[i] == '\\' && i + 1 < length) {
+      quoted[text_length] = true;
+      text[text_length++] = line[++i];
+    } else {
+      text[text_length++] = line[i];
+    }
+  }
+  text[text_length] = '\0';
+
+  if (first == argc) {
+    vars_set("REPLY", text);
+  } else {
+    const char *ifs = vars_get("IFS");
+    if (!ifs)
+      ifs = " \t\n";
+#define IS_IFS(i) (!quoted[i] && text[i] && strchr(ifs, text[i]))
+#define IS_IFS_SPACE(i) (IS_IFS(i) && isspace((unsigned char) text[i]))
+
+    size_t i = 0;
+    while (IS_IFS_SPACE(i))
+      i++;
+    for (int name = first; name < argc; name++) {
+      size_t start = i, end;
+      if (name == argc - 1) {
+        /* The last name takes the rest of the line, less the separating space at its end */
+        end = text_length;
+        while (end > start && IS_IFS_SPACE(end - 1))
+          end--;
+      } else {
+        while (i < text_length && !IS_IFS(i))
+          i++;
+        end = i;
+        /* A separator is any space around at most one other IFS character */
+        while (IS_IFS_SPACE(i))
+          i++;
+        if (IS_IFS(i))
+          i++;
+        while (IS_IFS_SPACE(i))
+          i++;
+      }
+      char saved = text[end];
+      text[end] = '\0';
+      vars_set(argv[name], text + start);
+      text[end] = saved;
+    }
+#undef IS_IFS
+#undef IS_IFS_SPACE
+  }
+
+  free(quoted);
+  free(text);
+  free(line);
+
+  /* Like the utility, input that ends before the newline counts as a failure */
+  return newline;
+}
+
+/* Skip the options in front of the operands, up to a --. Returns NULL if one of them is not in
+ * known, after reporting it for the command unless cmd is NULL. */
+static char **skip_options(char **argv, const char *known, const char *cmd) {
+  char **arg = argv + 1;
+  for (; *arg && (*arg)[0] == '-' && (*arg)[1]; arg++) {
+    if (!strcmp(*arg, "--"))
+      return arg + 1;
+    for (const char *c = *arg + 1; *c; c++) {
+      if (!strchr(known, *c)) {
+        if (cmd)
+          fprintf(stderr, "%s: %s: unknown option.\n", cmd, *arg);
+        return NULL;
+      }
+    }
+  }
+  return arg;
+}
+
+/* Output is never buffered anyway, so -u changes nothing */
+#define CAT_OPTIONS "u"
+#define TEE_OPTIONS "a"
+
+bool cmd_cat_handles(char **argv) {
+  return skip_options(argv, CAT_OPTIONS, NULL) != NULL;
+}
+
+bool cmd_tee_handles(char **argv) {
+  return skip_options(argv, TEE_OPTIONS, NULL) != NULL;
+}
+
+int cmd_cat(unused int argc, char **argv) {
+  static char *standard_input[] = {"-", NULL};
+  char **files = skip_options(argv, CAT_OPTIONS, "cat");
+  int ret = 1;
+
+  if (!files)
+    return 0;
+  if (!*files)
+    files = standard_input;
+
+  fflush(stdout);
+  /* A regular file copied onto its own end would grow until the disk is full */
+  struct stat out, in;
+  bool out_regular = fstat(STDOUT_FILENO, &out) == 0 && S_ISREG(out.st_mode);
+  for (; *files; files++) {
+    int fd = strcmp(*files, "-") ? open(*files, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+    if (fd == -1) {
+      fprintf(stderr, "cat: %s: %s.\n", *files, strerror(errno));
+      ret = 0;
+      continue;
+    }
+    if (out_regular && fstat(fd, &in) == 0 && S_ISREG(in.st_mode) && in.st_dev == out.st_dev &&
+        in.st_ino == out.st_ino) {
+      fprintf(stderr, "cat: %s: input file is output file.\n", *files);
+      ret = 0;
+    } else if (copy_fd(fd, STDOUT_FILENO) == -1) {
+      /* Nobody reading any more ends the copy, the way SIGPIPE ends the program */
+      if (errno == EPIPE) {
+        if (fd != STDIN_FILENO)
+          close(fd);
+        return 0;
+      }
+      fprintf(stderr, "cat: %s: %s.\n", *files, strerror(errno));
+      ret = 0;
+    }
+    if (fd != STDIN_FILENO)
+      close(fd);
+  }
+  return ret;
+}
+
+int cmd_tee(int argc, char **argv) {
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  int ret = 1;
+
+  char **files = skip_options(argv, TEE_OPTIONS, "tee");
+  if (!files)
+    return 0;
+  /* -a is the only option, so any word before the files but -- is one */
+  for (char **arg = argv + 1; arg < files; arg++)
+    if (strcmp(*arg, "--"))
+      flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+  int first = (int) (files - argv);
+
+  int *outs = (int *) malloc(sizeof(int) * (argc - first + 1));
+  size_t n = 0;
+  outs[n++] = STDOUT_FILENO;
+  for (int i = first; i < argc; i++) {
+    int fd = open(argv[i], flags, 0666);
+    if (fd == -1) {
+      fprintf(stderr, "tee: %s: %s.\n", argv[i], strerror(errno));
+      ret = 0;
+      continue;
+    }
+    outs[n++] = fd;
+  }
+
+  fflush(stdout);
+  if (copy_fd_many(STDIN_FILENO, outs, n) == -1 && errno != EPIPE) {
+    fprintf(stderr, "tee: %s.\n", strerror(errno));
+    ret = 0;
+  }
+
+  for (size_t i = 1; i < n; i++)
+    close(outs[i]);
+  free(outs);
+  return ret;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* Builtins standing in for the small utilities scripts call the most, so running them never
+ * forks. They take the words of the command like main and return 1 on success, 0 on failure,
+ * like the rest of the builtins of the shell. */
+
+/* echo [-neE] [arg ...] */
+int cmd_echo(int argc, char **argv);
+
+/* printf format [arg ...] */
+int cmd_printf(int argc, char **argv);
+
+/* test expression, and [ expression ] */
+int cmd_test(int argc, char **argv);
+
+/* true and false */
+int cmd_true(int argc, char **argv);
+int cmd_false(int argc, char **argv);
+
+/* cat [-u] [file ...] and tee [-a] [file ...], copying inside the kernel where they can */
+int cmd_cat(int argc, char **argv);
+int cmd_tee(int argc, char **argv);
+
+/* Whether cat and tee implement every option in front of the operands. For any other, such as
+ * cat -n, the shell runs the program instead. */
+bool cmd_cat_handles(char **argv);
+bool cmd_tee_handles(char **argv);
+
+/* read [-r] [name ...] sets the variables to the fields of one line of standard input, taken
+ * through the reader of the shell when the commands come from standard input too */
+int cmd_read(int argc, char **argv);
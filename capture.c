@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "capture.h"
+
+size_t capture_size;
+
+/* What capture_finish kept */
+static struct capture *last;
+
+static void close_fd(int *fd) {
+  if (*fd != -1) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+struct capture *capture_open(int job) {
+  struct capture *capture = (struct capture *) calloc(1, sizeof(struct capture));
+  capture->job = job;
+  capture->size = capture_size;
+  capture->ring = (char *) malloc(capture->size);
+
+  for (int i = 0; i < 2; i++) {
+    struct capture_stream *stream = &capture->streams[i];
+    int fds[2];
+    stream->target = i == 0 ? STDOUT_FILENO : STDERR_FILENO;
+    stream->fd = stream->write_fd = stream->tee[0] = stream->tee[1] = -1;
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+      capture_launched(capture);
+      capture_finish(capture);
+      return NULL;
+    }
+    stream->fd = fds[0];
+    stream->write_fd = fds[1];
+    fcntl(stream->fd, F_SETFL, O_NONBLOCK);
+    if (pipe2(stream->tee, O_CLOEXEC) == -1)
+      stream->tee[0] = stream->tee[1] = -1;
+  }
+  return capture;
+}
+
+void capture_launched(struct capture *capture) {
+  for (int i = 0; i < 2; i++)
+    close_fd(&capture->streams[i].write_fd);
+}
+
+/* Read n bytes that are in the pipe into the ring, after whatever it holds. Only the last size
+ * bytes survive, so a chunk larger than the ring is read over itself. */
+static ssize_t read_ring(struct capture *capture, int fd, size_t n) {
+  size_t total = 0;
+  while (total < n) {
+    size_t at = (size_t) (capture->written % capture->size);
+    size_t want = n - total < capture->size ? n - total : capture->size;
+    struct iovec iov[2] = {{capture->ring + at, capture->size - at}, {capture->ring, 0}};
+    if (want < iov[0].iov_len)
+      iov[0].iov_len = want;
+    else
+      iov[1].iov_len = want - iov[0].iov_len;
+    ssize_t got = readv(fd, iov, 2);
+    if (got == -1 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return total ? (ssize_t) total : got;
+    capture->written += (uint64_t) got;
+    total += (size_t) got;
+  }
+  return (ssize_t) total;
+}
+
+static bool write_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(fd, data, length);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= (size_t) n;
+  }
+  return true;
+}
+
+/* Send the n bytes teed into the second pipe on to the target. A target that cannot be spliced
+ * to gets them through a buffer instead. */
+static void forward(struct capture_stream *stream, size_t n) {
+  while (n > 0) {
+    ssize_t moved = splice(stream->tee[0], NULL, stream->target, NULL, n, SPLICE_F_MOVE);
+    if (moved == -1 && errno == EINTR)
+      continue;
+    if (moved <= 0)
+      break;
+    n -= (size_t) moved;
+  }
+  while (n > 0) {
+    char buffer[65536];
+    ssize_t got = read(stream->tee[0], buffer, n < sizeof(buffer) ? n : sizeof(buffer));
+    if (got <= 0)
+      break;
+    /* Output nobody takes any more is dropped, like the pipe of a reader that went away */
+    write_all(stream->target, buffer, (size_t) got);
+    n -= (size_t) got;
+  }
+}
+
+bool capture_pump(struct capture *capture, int which) {
+  struct capture_stream *stream = &capture->streams[which];
+  if (stream->fd == -1)
+    return false;
+  /* What the shell printed itself comes first */
+  fflush(stdout);
+
+  for (;;) {
+    ssize_t n = -1;
+    if (stream->tee[0] != -1) {
+      n = tee(stream->fd, stream->tee[1], SIZE_MAX, SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        forward(stream, (size_t) n);
+        read_ring(capture, stream->fd, (size_t) n);
+        continue;
+      }
+      if (n == -1 && errno == EINVAL) {
+        close_fd(&stream->tee[0]);
+        close_fd(&stream->tee[1]);
+      }
+    }
+    if (n == -1 && stream->tee[0] == -1) {
+      /* Without tee, through the ring: read, then write out what was just kept */
+      size_t at = (size_t) (capture->written % capture->size);
+      n = read_ring(capture, stream->fd, capture->size - at);
+      if (n > 0) {
+        write_all(stream->target, capture->ring + at, (size_t) n);
+        continue;
+      }
+    }
+    if (n == 0)
+      return false;
+    /* Only an empty pipe stops it, any other error ends the stream */
+    return errno == EAGAIN || errno == EINTR;
+  }
+}
+
+void capture_close(struct capture *capture, int which) {
+  struct capture_stream *stream = &capture->streams[which];
+  close_fd(&stream->fd);
+  close_fd(&stream->tee[0]);
+  close_fd(&stream->tee[1]);
+}
+
+void capture_finish(struct capture *capture) {
+  for (int i = 0; i < 2; i++) {
+    /* Take what is left. Children that outlive the job lose their output from here on. */
+    capture_pump(capture, i);
+    close_fd(&capture->streams[i].write_fd);
+    capture_close(capture, i);
+  }
+  if (last) {
+    free(last->ring);
+    free(last);
+  }
+  last = capture;
+}
+
+const struct capture *capture_last(void) {
+  return last;
+}
+
+void capture_print(const struct capture *capture, int fd, size_t lines) {
+  size_t kept = capture->written < capture->size ? (size_t) capture->written : capture->size;
+  size_t start = (size_t) ((capture->written - kept) % capture->size);
+
+  /* Walk back from the end over lines newlines, not counting one that ends the output */
+  size_t skip = 0;
+  if (lines > 0) {
+    size_t found = 0;
+    for (size_t i = kept; i-- > 0;) {
+      if (capture->ring[(start + i) % capture->size] != '\n' || i == kept - 1)
+        continue;
+      if (++found == lines) {
+        skip = i + 1;
+        break;
+      }
+    }
+  }
+
+  size_t from = (start + skip) % capture->size, length = kept - skip;
+  size_t first = capture->size - from < length ? capture->size - from : length;
+  write_all(fd, capture->ring + from, first);
+  write_all(fd, capture->ring, length - first);
+}
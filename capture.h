@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Output capture of jobs, for scripts and server mode. The standard output and error of a
+ * captured job go to pipes the shell drains while it waits: tee(2) duplicates what arrived into a
+ * second pipe that is spliced on to where the output would have gone, so that copy never leaves
+ * the kernel, and the original is read into a ring buffer that keeps only the last bytes. The ring
+ * has one writer, the shell, and needs no lock. */
+
+/* Bytes of output kept per job, or 0 when capture is off. Set with the output builtin. */
+extern size_t capture_size;
+
+/* One of the two streams of a captured job */
+struct capture_stream {
+  /* The end the shell reads, or -1 once it reached its end and was closed */
+  int fd;
+  /* The end the children write to, until they are launched */
+  int write_fd;
+  /* The pipe what arrives is teed into on its way to target, or -1 where tee cannot be used */
+  int tee[2];
+  /* Where the output would have gone, STDOUT_FILENO or STDERR_FILENO */
+  int target;
+  /* Whether the read end is in the epoll set of the job waits */
+  bool watched;
+};
+
+struct capture {
+  struct capture_stream streams[2];
+  /* The number of the job, for the output builtin */
+  int job;
+  /* The ring and how many bytes were ever written to it */
+  char *ring;
+  size_t size;
+  uint64_t written;
+};
+
+/* Set up the pipes of a captured job. Returns NULL if they cannot be made, and the job then runs
+ * with its output as usual. */
+struct capture *capture_open(int job);
+
+/* Close the ends the children of the job got, once they are all launched */
+void capture_launched(struct capture *capture);
+
+/* Move what is in the pipe of the stream through and into the ring, without blocking. Returns
+ * false once the stream ended, for the caller to stop watching it and call capture_close. */
+bool capture_pump(struct capture *capture, int stream);
+
+/* Close the read end of the stream */
+void capture_close(struct capture *capture, int stream);
+
+/* Drain and close what is left of the capture of a job that is done, and keep its ring as the
+ * output of the last job for capture_print. The capture is freed. */
+void capture_finish(struct capture *capture);
+
+/* The capture kept from the captured job that finished last, or NULL */
+const struct capture *capture_last(void);
+
+/* Write what the ring keeps to fd: all of it, or only its last lines when lines is not 0 */
+void capture_print(const struct capture *capture, int fd, size_t lines);
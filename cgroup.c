@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cgroup.h"
+
+/* The period cpu.max quotas are given in, in microseconds */
+#define CPU_PERIOD_US 100000
+
+struct cgroup {
+  char name[64];
+  int dir_fd;
+  int procs_fd;
+};
+
+/* The cgroup of the shell that leaves are created in, -1 without a cgroup v2 hierarchy, or -2
+ * before it was looked up */
+static int base_fd = -2;
+
+/* Leaves created so far, to name the next one */
+static unsigned leaves;
+
+/* Whether the shell moved itself into a leaf of its own */
+static bool shell_moved;
+
+/* Read a small file of the cgroup in dir into buffer as a string. Returns -1 on errors. */
+static int read_file(int dir, const char *name, char *buffer, size_t size) {
+  int fd = openat(dir, name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  ssize_t n = read(fd, buffer, size - 1);
+  close(fd);
+  if (n < 0)
+    return -1;
+  buffer[n] = '\0';
+  return 0;
+}
+
+static int write_file(int dir, const char *name, const char *text) {
+  int fd = openat(dir, name, O_WRONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  ssize_t n = write(fd, text, strlen(text));
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return n < 0 ? -1 : 0;
+}
+
+/* Whether the space separated list holds the word */
+static bool has_word(const char *list, const char *word) {
+  size_t length = strlen(word);
+  for (const char *p = list; (p = strstr(p, word)); p += length)
+    if ((p == list || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\n' || !p[length]))
+      return true;
+  return false;
+}
+
+/* Open the cgroup of the shell: the mount point of cgroup2 from mountinfo, and the path of the
+ * 0:: line of /proc/self/cgroup below it */
+static int open_base(void) {
+  char line[4096], mount[PATH_MAX] = "", path[PATH_MAX] = "";
+  FILE *file;
+
+  if ((file = fopen("/proc/self/mountinfo", "re"))) {
+    while (fgets(line, sizeof(line), file)) {
+      char point[PATH_MAX];
+      const char *type = strstr(line, " - ");
+      if (type && !strncmp(type, " - cgroup2 ", 11) &&
+          sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1) {
+        strcpy(mount, point);
+        break;
+      }
+    }
+    fclose(file);
+  }
+  if ((file = fopen("/proc/self/cgroup", "re"))) {
+    while (fgets(line, sizeof(line), file)) {
+      if (!strncmp(line, "0::", 3)) {
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(path, sizeof(path), "%s", line + 3);
+        break;
+      }
+    }
+    fclose(file);
+  }
+  if (!*mount || !*path) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  char base[2 * PATH_MAX];
+  snprintf(base, sizeof(base), "%s%s", mount, path);
+  return open(base, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* Enable the controller for the leaves. A cgroup with processes in it cannot hand controllers
+ * down, so the shell moves itself out of the way into a leaf the first time that is refused. */
+static int enable(const char *controller, const char *who) {
+  char list[512], text[64];
+
+  if (read_file(base_fd, "cgroup.controllers", list, sizeof(list)) == -1 ||
+      !has_word(list, controller)) {
+    if (who)
+      printf("%s: the %s controller is not available here.\n", who, controller);
+    return -1;
+  }
+  if (read_file(base_fd, "cgroup.subtree_control", list, sizeof(list)) == 0 &&
+      has_word(list, controller))
+    return 0;
+
+  snprintf(text, sizeof(text), "+%s", controller);
+  int ret = write_file(base_fd, "cgroup.subtree_control", text);
+  if (ret == -1 && errno == EBUSY && !shell_moved) {
+    char name[64];
+    snprintf(name, sizeof(name), "shell-%d", (int) getpid());
+    if ((mkdirat(base_fd, name, 0755) == 0 || errno == EEXIST)) {
+      char procs[96];
+      snprintf(procs, sizeof(procs), "%s/cgroup.procs", name);
+      shell_moved = write_file(base_fd, procs, "0") == 0;
+    }
+    ret = write_file(base_fd, "cgroup.subtree_control", text);
+  }
+  if (ret == -1 && who)
+    printf("%s: cannot enable the %s controller: %s.\n", who, controller, strerror(errno));
+  return ret;
+}
+
+struct cgroup *cgroup_create(bool memory, bool cpus, const char *who) {
+  if (base_fd == -2)
+    base_fd = open_base();
+  if (base_fd == -1) {
+    if (who)
+      printf("%s: no cgroup v2 hierarchy: %s.\n", who, strerror(errno));
+    return NULL;
+  }
+  if ((memory && enable("memory", who) == -1) || (cpus && enable("cpu", who) == -1))
+    return NULL;
+
+  struct cgroup *cgroup = (struct cgroup *) calloc(1, sizeof(struct cgroup));
+  snprintf(cgroup->name, sizeof(cgroup->name), "shell-%d-job%u", (int) getpid(), ++leaves);
+  cgroup->dir_fd = cgroup->procs_fd = -1;
+  if (mkdirat(base_fd, cgroup->name, 0755) == -1) {
+    if (who)
+      printf("%s: %s: %s.\n", who, cgroup->name, strerror(errno));
+    free(cgroup);
+    return NULL;
+  }
+  if ((cgroup->dir_fd = openat(base_fd, cgroup->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+      (cgroup->procs_fd = openat(cgroup->dir_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC)) == -1) {
+    if (who)
+      printf("%s: %s: %s.\n", who, cgroup->name, strerror(errno));
+    cgroup_destroy(cgroup);
+    return NULL;
+  }
+  return cgroup;
+}
+
+int cgroup_limit_memory(struct cgroup *cgroup, int64_t bytes, const char *who) {
+  char text[32];
+  snprintf(text, sizeof(text), "%" PRId64, bytes);
+  if (write_file(cgroup->dir_fd, "memory.max", text) == -1) {
+    printf("%s: memory.max: %s.\n", who, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+int cgroup_limit_cpus(struct cgroup *cgroup, double cpus, const char *who) {
+  char text[64];
+  snprintf(text, sizeof(text), "%lld %d", (long long) (cpus * CPU_PERIOD_US), CPU_PERIOD_US);
+  if (write_file(cgroup->dir_fd, "cpu.max", text) == -1) {
+    printf("%s: cpu.max: %s.\n", who, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+int cgroup_procs_fd(const struct cgroup *cgroup) {
+  return cgroup->procs_fd;
+}
+
+/* The number after key= or key in the text, or -1 */
+static int64_t field(const char *text, const char *key) {
+  size_t length = strlen(key);
+  for (const char *p = text; (p = strstr(p, key)); p += length) {
+    if ((p == text || p[-1] == '\n' || p[-1] == ' ') && (p[length] == ' ' || p[length] == '='))
+      return strtoll(p + length + 1, NULL, 10);
+  }
+  return -1;
+}
+
+/* Sum of key=N over every device line of io.stat */
+static int64_t io_total(const char *text, const char *key) {
+  char pattern[32];
+  int64_t total = 0;
+  snprintf(pattern, sizeof(pattern), " %s=", key);
+  for (const char *p = text; (p = strstr(p, pattern)); p += strlen(pattern))
+    total += strtoll(p + strlen(pattern), NULL, 10);
+  return total;
+}
+
+void cgroup_usage(const struct cgroup *cgroup, struct cgroup_usage *usage) {
+  char text[8192];
+
+  usage->user_us = usage->sys_us = usage->memory_peak = usage->io_read = usage->io_write = -1;
+  if (read_file(cgroup->dir_fd, "cpu.stat", text, sizeof(text)) == 0) {
+    usage->user_us = field(text, "user_usec");
+    usage->sys_us = field(text, "system_usec");
+  }
+  if (read_file(cgroup->dir_fd, "memory.peak", text, sizeof(text)) == 0)
+    usage->memory_peak = strtoll(text, NULL, 10);
+  if (read_file(cgroup->dir_fd, "io.stat", text, sizeof(text)) == 0) {
+    usage->io_read = io_total(text, "rbytes");
+    usage->io_write = io_total(text, "wbytes");
+  }
+}
+
+void cgroup_destroy(struct cgroup *cgroup) {
+  if (!cgroup)
+    return;
+  if (cgroup->procs_fd != -1)
+    close(cgroup->procs_fd);
+  if (cgroup->dir_fd != -1)
+    close(cgroup->dir_fd);
+  unlinkat(base_fd, cgroup->name, AT_REMOVEDIR);
+  free(cgroup);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Leaf cgroups of the cgroup v2 hierarchy that jobs run in, created below the cgroup of the
+ * shell. The kernel accounts for every process of a leaf, whatever process group or parent it
+ * has, and enforces its limits on all of them together. */
+struct cgroup;
+
+/* What the processes of a leaf used. Fields the kernel does not account, because the controller
+ * is not enabled, are -1. */
+struct cgroup_usage {
+  int64_t user_us;
+  int64_t sys_us;
+  int64_t memory_peak;
+  int64_t io_read;
+  int64_t io_write;
+};
+
+/* Create an empty leaf. With memory or cpus set the memory and cpu controllers are enabled for it,
+ * moving the shell into a leaf of its own first if its cgroup has to be free of processes for
+ * that. Returns NULL after printing the error, prefixed with who, or silently for NULL. */
+struct cgroup *cgroup_create(bool memory, bool cpus, const char *who);
+
+/* Limit the memory of the leaf to the bytes, or its CPU time to that many CPUs. Return -1 after
+ * printing the error prefixed with who. */
+int cgroup_limit_memory(struct cgroup *cgroup, int64_t bytes, const char *who);
+int cgroup_limit_cpus(struct cgroup *cgroup, double cpus, const char *who);
+
+/* The cgroup.procs file of the leaf, opened for writing, that a child moves itself into the leaf
+ * through before it execs */
+int cgroup_procs_fd(const struct cgroup *cgroup);
+
+/* Read what the processes of the leaf used so far */
+void cgroup_usage(const struct cgroup *cgroup, struct cgroup_usage *usage);
+
+/* Remove the leaf, which is left behind if processes still run in it, and free it */
+void cgroup_destroy(struct cgroup *cgroup);
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Checks of how the shell parses command lines, run by make check against the shell just built.
+# Each case runs one line in a scratch directory and compares what it prints, less the status
+# lines of its jobs, and the files it leaves there.
+
+shell=$(cd "$(dirname "$0")" && pwd)/shell
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+failed=0
+
+# check NAME LINE EXPECTED-OUTPUT EXPECTED-FILES
+check() {
+  rm -rf "$scratch"/*
+  output=$(cd "$scratch" && "$shell" -c "$2" 2>&1 | sed '/^status: /d')
+  files=$(cd "$scratch" && ls | tr '\n' ' ')
+  if [ "$output" != "$3" ] || [ "$files" != "$4" ]; then
+    printf 'FAIL %s\n  output: %s\n  expected: %s\n  files: %s\n  expected: %s\n' \
+      "$1" "$output" "$3" "$files" "$4"
+    failed=1
+  fi
+}
+
+check 'quoted >' 'echo a ">" b' 'a > b' ''
+check 'quoted <' 'echo "<" x' '< x' ''
+check 'quoted 2>&1' 'echo "2>&1"' '2>&1' ''
+check 'escaped >' 'echo a \> b' 'a > b' ''
+check 'quoted > in an argument' 'echo ">x"' '>x' ''
+check 'quoted target' 'echo a >"b c"; cat "b c"' 'a' 'b c '
+check 'plain >' 'echo a > b; cat b' 'a' 'b '
+check 'name before a closing quote' 'x=1; xy=OOPS; echo "$x"y' '1y' ''
+check 'name before a double quote' 'x=1; xy=OOPS; echo $x"y"' '1y' ''
+check 'name before a single quote' "x=1; xy=OOPS; echo \$x'y'" '1y' ''
+check 'redirected loop' 'printf "a\nb\n" > in; while read l; do echo "<$l>"; done < in' '<a>
+<b>' 'in '
+check 'redirected if' 'if true; then echo yes; fi > out; cat out' 'yes' 'out '
+check 'pipe into a loop' 'echo x | while read l; do echo "got $l"; done' 'got x' ''
+check 'loop into a pipe' 'for i in 1 2 3; do echo $i; done | wc -l' '3' ''
+check 'quoted case pattern' 'case abc in "*") echo star;; *) echo other;; esac' 'other' ''
+check 'expanded case pattern' 'p="a*"; case abc in $p) echo match;; esac' 'match' ''
+check 'quoted expanded case pattern' 'p="a*"; case abc in "$p") echo match;; *) echo literal;; esac' 'literal' ''
+check 'name before an escape' 'x=1; xy=OOPS; echo $x\y' '1y' ''
+check 'quoted assignment' '"x=1"; echo "${x}."' 'x=1: command not found.
+.' ''
+check 'escaped assignment' 'x\=1; echo "${x}."' 'x=1: command not found.
+.' ''
+check 'quoted value' 'x="a b"; echo "$x"' 'a b' ''
+check 'prefix assignment after expansion' 'x=a; x=b echo $x' 'a' ''
+check 'assignments in order' 'x=1 y=$x; echo $y' '1' ''
+check 'expanded here-document' 'x=1; cat <<EOF
+$x $(echo sub) \$x
+EOF' '1 sub $x' ''
+check 'quoted here-document' 'x=1; cat <<"EOF"
+$x $(echo sub) \$x
+EOF' '$x $(echo sub) \$x' ''
+
+[ $failed = 0 ] && echo "parse checks passed"
+exit $failed
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "completion.h"
+#include "pathres.h"
+
+/* Words after which the next one is a command again */
+static const char *command_words[] = {"if", "then", "elif", "else", "while", "until", "do",
+                                      "!", "time", "{", NULL};
+
+static bool is_separator(char c) {
+  return c == ' ' || c == '\t' || c == ';' || c == '&' || c == '|' || c == '(' || c == ')' ||
+         c == '<' || c == '>';
+}
+
+/* Whether line[i] has a backslash before it that escapes it */
+static bool is_escaped(const char *line, size_t i) {
+  size_t backslashes = 0;
+  while (i > backslashes && line[i - backslashes - 1] == '\\')
+    backslashes++;
+  return backslashes % 2 == 1;
+}
+
+/* A copy of the word with a backslash before every character the shell would take for something
+ * else than part of the name */
+static char *escape(const char *word) {
+  char *escaped = (char *) malloc(2 * strlen(word) + 1), *p = escaped;
+  for (; *word; word++) {
+    if (strchr(" \t\n'\"\\$`*?[]|&;<>()", *word))
+      *p++ = '\\';
+    *p++ = *word;
+  }
+  *p = '\0';
+  return escaped;
+}
+
+/* A copy of the n bytes of the word as the shell reads it, without its backslashes */
+static char *unescape(const char *word, size_t n, size_t *length) {
+  char *plain = (char *) malloc(n + 1);
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (word[i] == '\\' && i + 1 < n)
+      i++;
+    plain[k++] = word[i];
+  }
+  plain[k] = '\0';
+  *length = k;
+  return plain;
+}
+
+static void push(struct completions *completions, char *word) {
+  if (completions->length == completions->capacity) {
+    completions->capacity = completions->capacity ? completions->capacity * 2 : 16;
+    completions->list =
+        (char **) realloc(completions->list, sizeof(char *) * completions->capacity);
+  }
+  completions->list[completions->length++] = word;
+}
+
+static void push_program(const char *name, void *data) {
+  push((struct completions *) data, strdup(name));
+}
+
+/* Whether the word starting at start is the name of a command */
+static bool in_command_position(const char *line, size_t start) {
+  size_t i = start;
+  while (i > 0 && (line[i - 1] == ' ' || line[i - 1] == '\t'))
+    i--;
+  if (i == 0 || line[i - 1] == ';' || line[i - 1] == '&' || line[i - 1] == '|' ||
+      line[i - 1] == '(')
+    return true;
+
+  /* A keyword before it, itself in command position, starts a command too */
+  size_t end = i;
+  while (i > 0 && !is_separator(line[i - 1]))
+    i--;
+  for (const char **word = command_words; *word; word++)
+    if (strlen(*word) == end - i && !memcmp(line + i, *word, end - i))
+      return in_command_position(line, i);
+  return false;
+}
+
+static int compare_words(const void *a, const void *b) {
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Files in the directory of the word whose names continue its last part */
+static void find_files(struct completions *completions, const char *word, size_t length) {
+  const char *slash = memrchr(word, '/', length);
+  size_t dir_length = slash ? (size_t) (slash - word) + 1 : 0;
+  const char *base = word + dir_length;
+  size_t base_length = length - dir_length;
+
+  char *dir = dir_length ? strndup(word, dir_length) : strdup(".");
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  DIR *stream = fd == -1 ? NULL : fdopendir(fd);
+  free(dir);
+  if (!stream) {
+    if (fd != -1)
+      close(fd);
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(stream))) {
+    const char *name = entry->d_name;
+    if (!strcmp(name, ".") || !strcmp(name, ".."))
+      continue;
+    /* Hidden files only when the word asks for them */
+    if ((name[0] == '.' && base[0] != '.') || strncmp(name, base, base_length))
+      continue;
+
+    bool is_dir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      is_dir = fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+    }
+    size_t name_length = strlen(name);
+    char *completion = (char *) malloc(dir_length + name_length + 2);
+    memcpy(completion, word, dir_length);
+    memcpy(completion + dir_length, name, name_length);
+    completion[dir_length + name_length] = '/';
+    completion[dir_length + name_length + is_dir] = '\0';
+    push(completions, completion);
+  }
+  closedir(stream);
+  qsort(completions->list, completions->length, sizeof(char *), compare_words);
+}
+
+size_t completions_find(struct completions *completions, const char *line, size_t cursor) {
+  size_t start = cursor;
+  while (start > 0 && (!is_separator(line[start - 1]) || is_escaped(line, start - 1)))
+    start--;
+
+  completions_clear(completions);
+  size_t length;
+  char *word = unescape(line + start, cursor - start, &length);
+  if (in_command_position(line, start) && !memchr(word, '/', length))
+    pathres_complete(word, length, push_program, completions);
+  else
+    find_files(completions, word, length);
+  free(word);
+
+  /* Inserted as they are typed, so that a name with a blank or a quote stays one word */
+  for (size_t i = 0; i < completions->length; i++) {
+    char *escaped = escape(completions->list[i]);
+    free(completions->list[i]);
+    completions->list[i] = escaped;
+  }
+  return start;
+}
+
+size_t completions_common(const struct completions *completions) {
+  if (completions->length == 0)
+    return 0;
+  const char *first = completions->list[0];
+  size_t common = strlen(first);
+  for (size_t i = 1; i < completions->length; i++) {
+    size_t k = 0;
+    while (k < common && completions->list[i][k] == first[k])
+      k++;
+    common = k;
+  }
+  return common;
+}
+
+void completions_clear(struct completions *completions) {
+  for (size_t i = 0; i < completions->length; i++)
+    free(completions->list[i]);
+  completions->length = 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Completion of the word before the cursor of a line being edited. A word in command position
+ * completes to the programs in PATH, anything else to file names. */
+
+struct completions {
+  /* Words that could replace the one being completed, sorted. Directories end in a slash, and
+   * blanks, quotes and the characters special to the shell have a backslash before them. */
+  char **list;
+  size_t length;
+  size_t capacity;
+};
+
+/* Fill the completions for the word that ends at the cursor and return where it starts */
+size_t completions_find(struct completions *completions, const char *line, size_t cursor);
+
+/* Length of the prefix all the completions share */
+size_t completions_common(const struct completions *completions);
+
+void completions_clear(struct completions *completions);
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "copy.h"
+
+/* Bytes asked for by one call. The pipe capacity caps splice and tee anyway. */
+#define COPY_CHUNK (1 << 24)
+
+/* Bytes duplicated by one round of tee, no more than what an empty pipe holds */
+#define TEE_CHUNK (1 << 16)
+
+#define BUFFER_SIZE (1 << 16)
+
+/* One way of moving up to len bytes from in to out, with the contract of read */
+typedef ssize_t copy_step_t(int in, int out, size_t len);
+
+static ssize_t step_copy_file_range(int in, int out, size_t len) {
+  return copy_file_range(in, NULL, out, NULL, len, 0);
+}
+
+static ssize_t step_splice(int in, int out, size_t len) {
+  return splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+}
+
+static ssize_t step_sendfile(int in, int out, size_t len) {
+  return sendfile(out, in, NULL, len);
+}
+
+/* Whether a failure of the very first call means the descriptors do not support the method */
+static bool unsupported(int err) {
+  return err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP || err == EBADF;
+}
+
+/* Run step until the end of in. Returns the bytes moved, or -1. A method the descriptors do not
+ * support sets *fallback instead, which only happens before anything was moved. */
+static ssize_t copy_with(copy_step_t *step, int in, int out, bool *fallback) {
+  ssize_t total = 0;
+
+  *fallback = false;
+  for (;;) {
+    ssize_t n = step(in, out, COPY_CHUNK);
+    if (n > 0) {
+      total += n;
+    } else if (n == 0) {
+      return total;
+    } else if (errno != EINTR) {
+      if (total == 0 && unsupported(errno)) {
+        *fallback = true;
+        return 0;
+      }
+      return -1;
+    }
+  }
+}
+
+static ssize_t write_all(int fd, const char *data, size_t length) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = write(fd, data + done, length - done);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return -1;
+    done += (size_t) n;
+  }
+  return (ssize_t) done;
+}
+
+/* The copy that works on any descriptors, through a buffer of the shell */
+static ssize_t copy_buffered(int in, const int *outs, size_t n) {
+  char *buffer = (char *) malloc(BUFFER_SIZE);
+  ssize_t total = 0;
+
+  for (;;) {
+    ssize_t got = read(in, buffer, BUFFER_SIZE);
+    if (got == -1 && errno == EINTR)
+      continue;
+    if (got <= 0) {
+      if (got == -1)
+        total = -1;
+      break;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (write_all(outs[i], buffer, (size_t) got) == -1) {
+        free(buffer);
+        return -1;
+      }
+    }
+    total += got;
+  }
+
+  free(buffer);
+  return total;
+}
+
+ssize_t copy_fd(int in, int out) {
+  struct stat si, so;
+  bool fallback = true;
+  ssize_t n;
+
+  if (fstat(in, &si) == -1 || fstat(out, &so) == -1)
+    return -1;
+
+  if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode)) {
+    n = copy_with(step_copy_file_range, in, out, &fallback);
+    if (!fallback)
+      return n;
+  }
+  if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode)) {
+    n = copy_with(step_splice, in, out, &fallback);
+    if (!fallback)
+      return n;
+  }
+  if (S_ISREG(si.st_mode)) {
+    n = copy_with(step_sendfile, in, out, &fallback);
+    if (!fallback)
+      return n;
+  }
+  return copy_buffered(in, &out, 1);
+}
+
+/* Move exactly len bytes out of the pipe to out */
+static ssize_t drain(int pipe, int out, size_t len) {
+  char buffer[4096];
+  size_t done = 0;
+  bool spliced = true;
+
+  while (done < len) {
+    ssize_t n;
+    if (spliced) {
+      n = splice(pipe, NULL, out, NULL, len - done, SPLICE_F_MOVE);
+      if (n == -1 && done == 0 && unsupported(errno)) {
+        /* Terminals and the like cannot be spliced to */
+        spliced = false;
+        continue;
+      }
+    } else {
+      size_t want = len - done < sizeof(buffer) ? len - done : sizeof(buffer);
+      n = read(pipe, buffer, want);
+      if (n > 0 && write_all(out, buffer, (size_t) n) == -1)
+        return -1;
+    }
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    done += (size_t) n;
+  }
+  return (ssize_t) done;
+}
+
+/* Every output gets a private pipe. Each round tees the data at the head of in into all of them
+ * but the last, moves it into the last one, which consumes it from in, and drains every private
+ * pipe into its output. */
+static ssize_t copy_tee(int in, const int *outs, size_t n, bool *fallback) {
+  int (*pipes)[2] = calloc(n, sizeof(*pipes));
+  ssize_t total = 0;
+  size_t made = 0;
+
+  *fallback = false;
+  for (; made < n; made++) {
+    if (pipe2(pipes[made], O_CLOEXEC) == -1) {
+      total = -1;
+      goto out;
+    }
+  }
+
+  for (;;) {
+    ssize_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+      size_t want = i == 0 ? TEE_CHUNK : (size_t) len;
+      ssize_t k;
+      do {
+        if (i + 1 < n)
+          k = tee(in, pipes[i][1], want, 0);
+        else
+          k = splice(in, NULL, pipes[i][1], NULL, want, SPLICE_F_MOVE);
+      } while (k == -1 && errno == EINTR);
+
+      if (k == -1) {
+        if (total == 0 && i == 0 && unsupported(errno))
+          *fallback = true;
+        else
+          total = -1;
+        goto out;
+      }
+      if (i == 0 && k == 0)
+        goto out;
+      if (i > 0 && k != len) {
+        /* The private pipes are empty and all alike, so they always take the same amount */
+        errno = EIO;
+        total = -1;
+        goto out;
+      }
+      len = k;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      if (drain(pipes[i][0], outs[i], (size_t) len) == -1) {
+        total = -1;
+        goto out;
+      }
+    }
+    total += len;
+  }
+
+out:
+  for (size_t i = 0; i < made; i++) {
+    close(pipes[i][0]);
+    close(pipes[i][1]);
+  }
+  free(pipes);
+  return total;
+}
+
+ssize_t copy_fd_many(int in, const int *outs, size_t n) {
+  struct stat si;
+
+  if (n == 0)
+    return copy_buffered(in, outs, 0);
+  if (n == 1)
+    return copy_fd(in, outs[0]);
+
+  if (fstat(in, &si) == 0 && S_ISFIFO(si.st_mode)) {
+    bool fallback;
+    ssize_t total = copy_tee(in, outs, n, &fallback);
+    if (!fallback)
+      return total;
+  }
+  return copy_buffered(in, outs, n);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Copy everything from in to out until the end of in, keeping the data inside the kernel where
+ * the two descriptors allow it: copy_file_range between regular files, splice when either end is
+ * a pipe, sendfile from a regular file, and read/write otherwise. Returns the number of bytes
+ * copied, or -1 with errno set. */
+ssize_t copy_fd(int in, int out);
+
+/* Copy everything from in to each of the n descriptors in outs. When in is a pipe its data is
+ * duplicated with tee and moved with splice, with read/write as the fallback. */
+ssize_t copy_fd_many(int in, const int *outs, size_t n);
@@ -0,0 +1,49 @@
+#include <string.h>
+#include "dispatch.h"
+
+static unsigned int slot_of(const char *name, size_t length) {
+  unsigned int h = (unsigned int) length * 0x9e37u;
+  h ^= (unsigned char) name[0] * 31u;
+  h ^= (unsigned char) name[length - 1] * 131u;
+  return (h ^ (h >> 7)) & (DISPATCH_SLOTS - 1);
+}
+
+int dispatch_add(struct dispatch *index, const char *name, size_t position) {
+  size_t length = strlen(name);
+  if (length == 0 || length > DISPATCH_MAX_NAME || position >= DISPATCH_SLOTS / 2)
+    return -1;
+  if (index->length >= DISPATCH_SLOTS / 2)
+    return -1;
+
+  unsigned int slot = slot_of(name, length);
+  while (index->slots[slot])
+    slot = (slot + 1) & (DISPATCH_SLOTS - 1);
+
+  index->slots[slot] = (unsigned char) (position + 1);
+  index->names[position] = name;
+  index->lengths[position] = (unsigned char) length;
+  index->length++;
+  return 0;
+}
+
+int dispatch_find(const struct dispatch *index, const char *name) {
+  if (name == NULL)
+    return -1;
+
+  /* Bounded strlen: a name longer than every builtin is a miss already */
+  size_t length = 0;
+  while (name[length]) {
+    if (++length > DISPATCH_MAX_NAME)
+      return -1;
+  }
+  if (length == 0)
+    return -1;
+
+  for (unsigned int slot = slot_of(name, length); index->slots[slot];
+       slot = (slot + 1) & (DISPATCH_SLOTS - 1)) {
+    size_t position = index->slots[slot] - 1;
+    if (index->lengths[position] == length && !memcmp(index->names[position], name, length))
+      return (int) position;
+  }
+  return -1;
+}
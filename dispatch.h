@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Longest name the index can hold. Longer names are rejected without looking at the table, which
+ * keeps the miss for most program names down to one bounded length check. */
+#define DISPATCH_MAX_NAME 15
+
+/* Slots of the open addressed table, a power of two kept at least twice the number of names */
+#define DISPATCH_SLOTS 128
+
+/* A fixed index from command names to their position in a table. The slot is picked from the
+ * length and the first and last characters of the name, so a lookup is one hash of three bytes
+ * and, almost always, one memcmp against a name of the same length. */
+struct dispatch {
+  /* Position of the name plus one, 0 for an empty slot */
+  unsigned char slots[DISPATCH_SLOTS];
+  const char *names[DISPATCH_SLOTS / 2];
+  unsigned char lengths[DISPATCH_SLOTS / 2];
+  size_t length;
+};
+
+/* Add a name under the given position. Returns -1 if the name is too long or the index is full. */
+int dispatch_add(struct dispatch *index, const char *name, size_t position);
+
+/* The position of the name, or -1 if it was never added */
+int dispatch_find(const struct dispatch *index, const char *name);
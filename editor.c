@@ -0,0 +1,477 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "completion.h"
+#include "editor.h"
+#include "history.h"
+#include "reader.h"
+#include "shell.h"
+#include "vars.h"
+
+#define CONTROL(c) ((c) & 0x1f)
+#define KEY_ESCAPE 27
+#define KEY_BACKSPACE 127
+/* Keys that only come as escape sequences, numbered past the bytes */
+#define KEY_DELETE 256
+
+struct text {
+  char *data;
+  size_t length;
+  size_t capacity;
+};
+
+/* The line being edited and the cursor, a byte offset into it */
+struct line {
+  struct text text;
+  size_t cursor;
+};
+
+/* The reader for terminals the editor cannot drive */
+static struct reader *plain_input;
+
+static void reserve(struct text *text, size_t length) {
+  if (length + 1 > text->capacity) {
+    text->capacity = (length + 1) * 2;
+    text->data = (char *) realloc(text->data, text->capacity);
+  }
+}
+
+static void append(struct text *text, const char *data, size_t n) {
+  reserve(text, text->length + n);
+  memcpy(text->data + text->length, data, n);
+  text->length += n;
+  text->data[text->length] = '\0';
+}
+
+static void assign(struct text *text, const char *data, size_t n) {
+  text->length = 0;
+  append(text, data, n);
+}
+
+static void write_all(const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(STDOUT_FILENO, data, length);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    data += n;
+    length -= (size_t) n;
+  }
+}
+
+/* Columns taken by the bytes, counting only the first byte of every UTF-8 sequence */
+static size_t width(const char *data, size_t length) {
+  size_t columns = 0;
+  for (size_t i = 0; i < length; i++)
+    columns += ((unsigned char) data[i] & 0xc0) != 0x80;
+  return columns;
+}
+
+/* Offsets of the characters before and after the one at i */
+static size_t previous_char(const struct text *text, size_t i) {
+  while (i > 0 && ((unsigned char) text->data[--i] & 0xc0) == 0x80)
+    ;
+  return i;
+}
+
+static size_t next_char(const struct text *text, size_t i) {
+  while (i < text->length && ((unsigned char) text->data[++i] & 0xc0) == 0x80)
+    ;
+  return i;
+}
+
+static size_t terminal_columns(void) {
+  struct winsize ws;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+    return 80;
+  return ws.ws_col;
+}
+
+/* Redraw the prompt and the line in one write. A line wider than the terminal scrolls sideways
+ * to keep the cursor in view. */
+static void refresh(const char *prompt, size_t prompt_length, const struct line *line) {
+  const struct text *text = &line->text;
+  size_t columns = terminal_columns();
+  size_t prompt_width = width(prompt, prompt_length);
+  size_t start = 0, end;
+
+  while (start < line->cursor &&
+         prompt_width + width(text->data + start, line->cursor - start) >= columns)
+    start = next_char(text, start);
+  for (end = start; end < text->length;) {
+    size_t next = next_char(text, end);
+    if (prompt_width + width(text->data + start, next - start) >= columns)
+      break;
+    end = next;
+  }
+
+  static struct text out;
+  char move[32];
+  out.length = 0;
+  append(&out, "\r", 1);
+  append(&out, prompt, prompt_length);
+  append(&out, text->data + start, end - start);
+  append(&out, "\x1b[0K\r", 5);
+  size_t column = prompt_width + width(text->data + start, line->cursor - start);
+  if (column > 0) {
+    int n = snprintf(move, sizeof(move), "\x1b[%zuC", column);
+    append(&out, move, (size_t) n);
+  }
+  write_all(out.data, out.length);
+}
+
+static bool raw_mode(bool on) {
+  if (!on)
+    return tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes) == 0;
+
+  struct termios raw = shell_tmodes;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_cflag |= CS8;
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  /* TCSADRAIN rather than TCSAFLUSH, so that nothing typed ahead is lost */
+  return tcsetattr(shell_terminal, TCSADRAIN, &raw) == 0;
+}
+
+/* The next byte typed, or -1 when the terminal is gone. Signals such as SIGCHLD do not count. */
+static int read_key(void) {
+  unsigned char c;
+  ssize_t n;
+  do {
+    n = read(STDIN_FILENO, &c, 1);
+  } while (n == -1 && errno == EINTR);
+  return n == 1 ? c : -1;
+}
+
+static void insert(struct line *line, const char *data, size_t n) {
+  struct text *text = &line->text;
+  reserve(text, text->length + n);
+  memmove(text->data + line->cursor + n, text->data + line->cursor, text->length - line->cursor);
+  memcpy(text->data + line->cursor, data, n);
+  text->length += n;
+  text->data[text->length] = '\0';
+  line->cursor += n;
+}
+
+/* Remove the bytes between from and to */
+static void erase(struct line *line, size_t from, size_t to) {
+  struct text *text = &line->text;
+  memmove(text->data + from, text->data + to, text->length - to);
+  text->length -= to - from;
+  text->data[text->length] = '\0';
+  if (line->cursor > to)
+    line->cursor -= to - from;
+  else if (line->cursor > from)
+    line->cursor = from;
+}
+
+/* Start of the word before the cursor, for ^W */
+static size_t word_start(const struct line *line) {
+  size_t i = line->cursor;
+  while (i > 0 && line->text.data[i - 1] == ' ')
+    i--;
+  while (i > 0 && line->text.data[i - 1] != ' ')
+    i--;
+  return i;
+}
+
+/* Ctrl-R: search the history backwards for what is typed, showing the newest match. ^R again goes
+ * to an older match and ^G gives up. Any other key leaves the match on the line and is returned,
+ * to be handled as if it was typed there; 0 means there is nothing left to handle. */
+static int search(struct line *line) {
+  struct text query = {NULL, 0, 0}, prompt = {NULL, 0, 0};
+  struct text original = {NULL, 0, 0};
+  size_t original_cursor = line->cursor;
+  ssize_t found = -1;
+  bool failed = false;
+  int key;
+
+  assign(&query, "", 0);
+  assign(&original, line->text.data, line->text.length);
+
+  for (;;) {
+    assign(&prompt, failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`",
+           failed ? 26 : 19);
+    append(&prompt, query.data, query.length);
+    append(&prompt, "': ", 3);
+    refresh(prompt.data, prompt.length, line);
+
+    key = read_key();
+    size_t from = found < 0 ? 0 : (size_t) found;
+    if (key == CONTROL('R')) {
+      if (found < 0 || query.length == 0)
+        continue;
+      from = (size_t) found + 1;
+    } else if (key == KEY_BACKSPACE || key == CONTROL('H')) {
+      if (query.length == 0)
+        continue;
+      query.data[--query.length] = '\0';
+      from = 0;
+    } else if (key == CONTROL('G')) {
+      assign(&line->text, original.data, original.length);
+      line->cursor = original_cursor;
+      key = 0;
+      break;
+    } else if (key >= ' ' && key != KEY_BACKSPACE && key < KEY_DELETE) {
+      char c = (char) key;
+      append(&query, &c, 1);
+    } else {
+      break;
+    }
+
+    /* What matched so far is kept when the longer query finds nothing */
+    ssize_t match = query.length ? history_search(query.data, query.length, from) : -1;
+    failed = query.length > 0 && match < 0;
+    if (match >= 0) {
+      const char *text;
+      size_t length;
+      history_get((size_t) match, &text, &length);
+      assign(&line->text, text, length);
+      line->cursor = (char *) memmem(text, length, query.data, query.length) - text;
+      found = match;
+    }
+  }
+
+  free(query.data);
+  free(prompt.data);
+  free(original.data);
+  return key;
+}
+
+/* Completions listed under the line are cut off after this many */
+#define LIST_MAX 200
+
+/* Tab: extend the word before the cursor as far as its completions agree, closing it when there
+ * is only one. A Tab that cannot extend it lists the completions below the line. */
+static void complete(struct line *line) {
+  static struct completions completions;
+  size_t start = completions_find(&completions, line->text.data, line->cursor);
+  size_t typed = line->cursor - start;
+  size_t common = completions_common(&completions);
+
+  if (completions.length == 0) {
+    write_all("\a", 1);
+    return;
+  }
+  if (strncmp(completions.list[0], line->text.data + start, typed)) {
+    /* The word was escaped some other way than the completions, so it is written again theirs */
+    erase(line, start, line->cursor);
+    insert(line, completions.list[0], common);
+  } else if (common > typed) {
+    insert(line, completions.list[0] + typed, common - typed);
+  } else if (completions.length > 1) {
+    static struct text out;
+    out.length = 0;
+    append(&out, "\r\n", 2);
+    for (size_t i = 0; i < completions.length && i < LIST_MAX; i++) {
+      /* Files are listed by their own name, without the directory */
+      const char *name = completions.list[i], *slash = strrchr(name, '/');
+      if (slash && slash[1] == '\0')
+        slash = memrchr(name, '/', (size_t) (slash - name));
+      name = slash ? slash + 1 : name;
+      append(&out, name, strlen(name));
+      append(&out, "  ", 2);
+    }
+    if (completions.length > LIST_MAX) {
+      char more[64];
+      int n = snprintf(more, sizeof(more), "(%zu more)", completions.length - LIST_MAX);
+      append(&out, more, (size_t) n);
+    }
+    append(&out, "\r\n", 2);
+    write_all(out.data, out.length);
+    return;
+  }
+
+  const char *only = completions.list[0];
+  if (completions.length == 1 && only[strlen(only) - 1] != '/' &&
+      (line->cursor == line->text.length || line->text.data[line->cursor] != ' '))
+    insert(line, " ", 1);
+}
+
+/* Put the nth history entry on the line, keeping what was being typed aside as entry -1 */
+static void recall(struct line *line, struct text *typed, ssize_t *current, ssize_t n) {
+  const char *text;
+  size_t length;
+
+  if (n < -1 || (n >= 0 && !history_get((size_t) n, &text, &length)))
+    return;
+  if (*current == -1)
+    assign(typed, line->text.data, line->text.length);
+  if (n == -1)
+    assign(&line->text, typed->data, typed->length);
+  else
+    assign(&line->text, text, length);
+  line->cursor = line->text.length;
+  *current = n;
+}
+
+/* Read the rest of an escape sequence and turn it into the control key it stands for, or 0 */
+static int escape_key(void) {
+  int c = read_key();
+  if (c != '[' && c != 'O')
+    return 0;
+
+  int key = read_key();
+  if (key >= '0' && key <= '9') {
+    int number = key - '0';
+    while ((key = read_key()) >= '0' && key <= '9')
+      number = number * 10 + key - '0';
+    if (key != '~')
+      return 0;
+    switch (number) {
+    case 1:
+    case 7:
+      return CONTROL('A');
+    case 3:
+      return KEY_DELETE;
+    case 4:
+    case 8:
+      return CONTROL('E');
+    }
+    return 0;
+  }
+  switch (key) {
+  case 'A':
+    return CONTROL('P');
+  case 'B':
+    return CONTROL('N');
+  case 'C':
+    return CONTROL('F');
+  case 'D':
+    return CONTROL('B');
+  case 'H':
+    return CONTROL('A');
+  case 'F':
+    return CONTROL('E');
+  }
+  return 0;
+}
+
+/* A terminal that cannot be put in raw mode gets the prompt and a plain line */
+static ssize_t plain_getline(const char *prompt, const char **line) {
+  write_all(prompt, strlen(prompt));
+  if (!plain_input)
+    plain_input = reader_open(STDIN_FILENO);
+  return reader_getline(plain_input, line);
+}
+
+ssize_t editor_getline(const char *prompt, const char **result) {
+  static struct line line;
+  static struct text typed;
+  size_t prompt_length = strlen(prompt);
+  ssize_t current = -1;
+  bool done = false, eof = false, dropped = false;
+
+  const char *term = vars_get("TERM");
+  fflush(stdout);
+  if ((term && !strcmp(term, "dumb")) || !raw_mode(true))
+    return plain_getline(prompt, result);
+
+  assign(&line.text, "", 0);
+  line.cursor = 0;
+  refresh(prompt, prompt_length, &line);
+
+  while (!done) {
+    int key = read_key();
+    if (key == CONTROL('R'))
+      key = search(&line);
+    if (key == KEY_ESCAPE)
+      key = escape_key();
+
+    switch (key) {
+    case -1:
+      eof = line.text.length == 0;
+      done = true;
+      break;
+    case '\r':
+    case '\n':
+      done = true;
+      break;
+    case CONTROL('C'):
+      /* Drop the line and start over on a new one */
+      write_all("^C", 2);
+      line.text.length = 0;
+      dropped = done = true;
+      break;
+    case CONTROL('D'):
+      if (line.text.length == 0) {
+        eof = done = true;
+        break;
+      }
+      /* fall through */
+    case KEY_DELETE:
+      if (line.cursor < line.text.length)
+        erase(&line, line.cursor, next_char(&line.text, line.cursor));
+      break;
+    case KEY_BACKSPACE:
+    case CONTROL('H'):
+      if (line.cursor > 0)
+        erase(&line, previous_char(&line.text, line.cursor), line.cursor);
+      break;
+    case CONTROL('A'):
+      line.cursor = 0;
+      break;
+    case CONTROL('E'):
+      line.cursor = line.text.length;
+      break;
+    case CONTROL('B'):
+      line.cursor = previous_char(&line.text, line.cursor);
+      break;
+    case CONTROL('F'):
+      if (line.cursor < line.text.length)
+        line.cursor = next_char(&line.text, line.cursor);
+      break;
+    case CONTROL('K'):
+      erase(&line, line.cursor, line.text.length);
+      break;
+    case CONTROL('U'):
+      erase(&line, 0, line.cursor);
+      break;
+    case CONTROL('W'):
+      erase(&line, word_start(&line), line.cursor);
+      break;
+    case '\t':
+      complete(&line);
+      break;
+    case CONTROL('L'):
+      write_all("\x1b[H\x1b[2J", 7);
+      break;
+    case CONTROL('P'):
+      recall(&line, &typed, &current, current + 1);
+      break;
+    case CONTROL('N'):
+      recall(&line, &typed, &current, current - 1);
+      break;
+    default:
+      if (key >= ' ' && key < KEY_DELETE && key != KEY_BACKSPACE) {
+        char c = (char) key;
+        insert(&line, &c, 1);
+      }
+      break;
+    }
+    if (!done)
+      refresh(prompt, prompt_length, &line);
+  }
+
+  /* Leave the line as it was typed, cursor at the end, and move on to the next one */
+  line.cursor = line.text.length;
+  if (!dropped)
+    refresh(prompt, prompt_length, &line);
+  write_all("\r\n", 2);
+  raw_mode(false);
+
+  if (eof)
+    return -1;
+  history_add(line.text.data, line.text.length);
+  append(&line.text, "\n", 1);
+  *result = line.text.data;
+  return (ssize_t) line.text.length;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <sys/types.h>
+
+/* A line editor for the terminal of an interactive shell. Lines are edited in raw mode, set up
+ * from the terminal modes the shell saved, with the usual Emacs keys, history on the arrows and
+ * Ctrl-R incremental search, Tab to complete commands and files. Every line entered goes to the
+ * history. */
+
+/* Show the prompt and edit one line. Returns its length with the newline, storing the line in
+ * *line until the next call, or -1 when ^D is typed on an empty line. Fits reader_open_source. */
+ssize_t editor_getline(const char *prompt, const char **line);
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "expand.h"
+#include "jobs.h"
+#include "pathglob.h"
+#include "shell.h"
+#include "tokenizer.h"
+#include "uring.h"
+#include "vars.h"
+
+/* Read size of a substitution, and what its buffer has free at least before each read */
+#define CAPTURE_CHUNK 16384
+
+struct buffer {
+  char *data;
+  size_t length;
+  size_t capacity;
+};
+
+/* The words a word expands into */
+struct fields {
+  char **list;
+  size_t length;
+  size_t capacity;
+};
+
+/* Output of the last command substitution. One buffer serves them all and only ever grows. */
+static struct buffer capture;
+
+/* Declared in expand.h */
+unsigned long expand_substitutions;
+
+static void append(struct buffer *buffer, const char *text, size_t n) {
+  if (buffer->length + n + 1 > buffer->capacity) {
+    buffer->capacity = (buffer->length + n + 1) * 2;
+    buffer->data = (char *) realloc(buffer->data, buffer->capacity);
+  }
+  memcpy(buffer->data + buffer->length, text, n);
+  buffer->length += n;
+  buffer->data[buffer->length] = '\0';
+}
+
+static void append_value(struct buffer *buffer, const char *name, size_t n) {
+  char *key = strndup(name, n);
+  const char *value = vars_get(key);
+  if (value)
+    append(buffer, value, strlen(value));
+  free(key);
+}
+
+/* Expand the parameter after the $ at p, returning where the word goes on */
+static const char *parameter(struct buffer *buffer, const char *p) {
+  char number[16];
+  size_t n;
+
+  if (*p == '?' || *p == '$') {
+    snprintf(number, sizeof(number), "%d", *p == '?' ? shell_status : (int) getpid());
+    append(buffer, number, strlen(number));
+    return p + 1;
+  }
+  if (*p == '!') {
+    if (shell_background_pid) {
+      snprintf(number, sizeof(number), "%d", (int) shell_background_pid);
+      append(buffer, number, strlen(number));
+    }
+    return p + 1;
+  }
+  if (*p >= '0' && *p <= '9')
+    return p + 1;
+  if (*p == '{') {
+    const char *close = strchr(p + 1, '}');
+    n = vars_name_length(p + 1);
+    if (close && n > 0 && p + 1 + n == close) {
+      append_value(buffer, p + 1, n);
+      return close + 1;
+    }
+    /* Not something ${} can take, so it stays as it is */
+    append(buffer, "$", 1);
+    return p;
+  }
+  if ((n = vars_name_length(p)) > 0) {
+    append_value(buffer, p, n);
+    return p + n;
+  }
+  append(buffer, "$", 1);
+  return p;
+}
+
+static void push_field(struct fields *fields, char *word) {
+  if (fields->length + 1 >= fields->capacity) {
+    fields->capacity = fields->capacity ? fields->capacity * 2 : 8;
+    fields->list = (char **) realloc(fields->list, sizeof(char *) * fields->capacity);
+  }
+  fields->list[fields->length++] = word;
+}
+
+/* Make room for the next read into the capture buffer */
+static void capture_grow(void) {
+  if (capture.capacity - capture.length < CAPTURE_CHUNK + 1) {
+    capture.capacity = capture.capacity ? capture.capacity * 2 : 4 * CAPTURE_CHUNK;
+    capture.data = (char *) realloc(capture.data, capture.capacity);
+  }
+}
+
+static void capture_read(int fd) {
+  for (;;) {
+    capture_grow();
+    ssize_t n = read(fd, capture.data + capture.length, capture.capacity - capture.length - 1);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    capture.length += (size_t) n;
+  }
+}
+
+struct capture_state {
+  bool read_done;
+  int read;
+  bool exited;
+};
+
+static void capture_done(uint64_t tag, int result, void *data) {
+  struct capture_state *state = (struct capture_state *) data;
+  (void) tag;
+  state->read_done = true;
+  state->read = result;
+}
+
+static void capture_exited(uint64_t tag, int result, void *data) {
+  (void) tag;
+  (void) result;
+  ((struct capture_state *) data)->exited = true;
+}
+
+/* Drain the pipe through the ring, with the pidfd of the child polled in the same submission as
+ * the first read, so that its exit comes back with its output and the wait after it never
+ * blocks */
+static void capture_uring(int fd, pid_t pid) {
+  int pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+  struct capture_state state = {false, 0, pidfd == -1};
+
+  if (pidfd != -1)
+    uring_poll(pidfd, POLLIN, capture_exited, &state, 0);
+  for (;;) {
+    capture_grow();
+    state.read_done = false;
+    uring_read(fd, capture.data + capture.length, capture.capacity - capture.length - 1,
+               capture_done, &state, 0);
+    if (uring_wait(&state.read_done) == -1 || state.read == 0)
+      break;
+    if (state.read > 0)
+      capture.length += (size_t) state.read;
+    else if (state.read != -EINTR && state.read != -EAGAIN)
+      break;
+  }
+  /* The output ends before the child does, and the poll has to be done with the state */
+  uring_wait(&state.exited);
+  if (pidfd != -1)
+    close(pidfd);
+}
+
+/* Run the commands in a child of the shell and drain its output into the capture buffer, read
+ * straight into the free end of the buffer. Trailing newlines are dropped. */
+static void substitute(const char *commands, size_t length) {
+  int fds[2];
+  capture.length = 0;
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    perror("pipe");
+    return;
+  }
+
+  /* Nothing buffered may be written twice */
+  fflush(stdout);
+  jobs_block();
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    if (dup2(fds[1], STDOUT_FILENO) == -1)
+      _exit(EXIT_FAILURE);
+    close(fds[1]);
+    shell_subshell(commands, length);
+  }
+  close(fds[1]);
+  if (pid == -1) {
+    printf("Failed to create new process: %s.\n", strerror(errno));
+    close(fds[0]);
+    jobs_unblock();
+    return;
+  }
+
+  if (uring_enabled)
+    capture_uring(fds[0], pid);
+  else
+    capture_read(fds[0]);
+  close(fds[0]);
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  jobs_unblock();
+  expand_substitutions++;
+  shell_status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+
+  while (capture.length > 0 && capture.data[capture.length - 1] == '\n')
+    capture.length--;
+}
+
+/* Add the captured output to the word. With fields, runs of IFS characters in it end the field
+ * being built and start the next one, which is how an unquoted substitution is split. */
+static void add_capture(struct buffer *buffer, struct fields *fields) {
+  if (!fields) {
+    append(buffer, capture.data ? capture.data : "", capture.length);
+    return;
+  }
+
+  const char *ifs = vars_get("IFS");
+  bool separator[256] = {false};
+  for (const unsigned char *c = (const unsigned char *) (ifs ? ifs : " \t\n"); *c; c++)
+    separator[*c] = true;
+
+  size_t i = 0;
+  while (i < capture.length) {
+    size_t start = i;
+    while (i < capture.length && !separator[(unsigned char) capture.data[i]])
+      i++;
+    append(buffer, capture.data + start, i - start);
+    if (i == capture.length)
+      break;
+    while (i < capture.length && separator[(unsigned char) capture.data[i]])
+      i++;
+    if (buffer->length > 0) {
+      push_field(fields, buffer->data);
+      memset(buffer, 0, sizeof(*buffer));
+      append(buffer, "", 0);
+    }
+  }
+}
+
+/* Expand the word into the buffer. Fields the word splits into before the last one go to fields;
+ * without them the word is never split. */
+static void expand(const char *word, struct buffer *buffer, struct fields *fields) {
+  const char *p = word;
+
+  append(buffer, "", 0);
+  while (*p) {
+    size_t run = strcspn(p, "$" TOKEN_LITERAL_DOLLAR_STRING TOKEN_NAME_END_STRING "\002\003");
+    append(buffer, p, run);
+    p += run;
+    if (*p == '$') {
+      p = parameter(buffer, p + 1);
+    } else if (*p == TOKEN_SUBST || *p == TOKEN_SUBST_QUOTED) {
+      const char *end = strchr(p + 1, TOKEN_SUBST_END);
+      size_t length = end ? (size_t) (end - p - 1) : strlen(p + 1);
+      substitute(p + 1, length);
+      add_capture(buffer, *p == TOKEN_SUBST ? fields : NULL);
+      p += length + 1 + (end != NULL);
+    } else if (*p == TOKEN_NAME_END) {
+      p++;
+    } else if (*p) {
+      append(buffer, "$", 1);
+      p++;
+    }
+  }
+}
+
+char *expand_word(const char *word) {
+  struct buffer buffer = {NULL, 0, 0};
+  expand(word, &buffer, NULL);
+  return buffer.data;
+}
+
+/* Replace the fields from first on by the paths they match, or by themselves without the
+ * backslashes of the pattern when nothing does */
+static void glob_fields(struct fields *fields, size_t first) {
+  size_t length = fields->length;
+  char **patterns = (char **) malloc(sizeof(char *) * (length - first + 1));
+  memcpy(patterns, fields->list + first, sizeof(char *) * (length - first));
+  fields->length = first;
+
+  for (size_t i = 0; i < length - first; i++) {
+    char **paths = pathglob_expand(patterns[i]);
+    if (!paths) {
+      pathglob_unescape(patterns[i]);
+      push_field(fields, patterns[i]);
+      continue;
+    }
+    for (char **path = paths; *path; path++)
+      push_field(fields, *path);
+    free(paths);
+    free(patterns[i]);
+  }
+  free(patterns);
+}
+
+char **expand_words(char **words, const unsigned char *flags, bool split) {
+  struct fields fields = {NULL, 0, 0};
+
+  for (size_t i = 0; words[i]; i++) {
+    size_t before = fields.length;
+    if (!(flags[i] & TOKEN_EXPAND)) {
+      push_field(&fields, strdup(words[i]));
+    } else {
+      struct buffer buffer = {NULL, 0, 0};
+      expand(words[i], &buffer, split ? &fields : NULL);
+      /* An unquoted word that came to nothing is left out, so is what a split left at its end */
+      if (split && buffer.length == 0 && (fields.length > before || !(flags[i] & TOKEN_QUOTED)))
+        free(buffer.data);
+      else
+        push_field(&fields, buffer.data);
+    }
+    if (flags[i] & TOKEN_GLOB) {
+      if (split)
+        glob_fields(&fields, before);
+      else
+        for (size_t k = before; k < fields.length; k++)
+          pathglob_unescape(fields.list[k]);
+    }
+  }
+  if (!fields.list)
+    fields.list = (char **) malloc(sizeof(char *));
+  fields.list[fields.length] = NULL;
+  return fields.list;
+}
+
+void free_words(char **words) {
+  for (char **word = words; *word; word++)
+    free(*word);
+  free(words);
+}
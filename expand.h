@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* Expansions done on the words of a command each time it runs, so a parsed tree can be run again
+ * with other values. Only words the tokenizer marked TOKEN_EXPAND need them. */
+
+/* The word with $name, ${name}, $? and $$ replaced by their values and command substitutions by
+ * the output of their commands, in a new string the caller frees. Unset variables and the
+ * positional parameters, which the shell has none of, are empty. */
+char *expand_word(const char *word);
+
+/* Copies of the NULL terminated words, with the expansions done that their TOKEN_ flags ask for.
+ * With split, the output of unquoted command substitutions is split into words at IFS characters
+ * and an unquoted word that expands to nothing is left out, as in sh. Like zsh, variables are
+ * never split. Words marked TOKEN_GLOB are then replaced by the paths they match, with split. */
+char **expand_words(char **words, const unsigned char *flags, bool split);
+
+/* How many command substitutions have run. Each one leaves its status in shell_status. */
+extern unsigned long expand_substitutions;
+
+/* Free what expand_words returned */
+void free_words(char **words);
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "history.h"
+
+struct entry {
+  const char *text;
+  size_t length;
+};
+
+struct entries {
+  struct entry *list;
+  size_t length;
+  size_t capacity;
+};
+
+/* The file as it was at startup. Everything before scanned is not indexed yet. */
+static const char *map;
+static size_t map_length;
+static size_t scanned;
+
+/* Entries of the file, newest first, and of this session, oldest first */
+static struct entries file_entries;
+static struct entries session;
+
+static int history_fd = -1;
+
+static void push(struct entries *entries, const char *text, size_t length) {
+  if (entries->length == entries->capacity) {
+    entries->capacity = entries->capacity ? entries->capacity * 2 : 256;
+    entries->list =
+        (struct entry *) realloc(entries->list, sizeof(struct entry) * entries->capacity);
+  }
+  entries->list[entries->length].text = text;
+  entries->list[entries->length++].length = length;
+}
+
+void history_open(const char *path) {
+  struct stat st;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd != -1) {
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        map = (const char *) data;
+        map_length = scanned = st.st_size;
+      }
+    }
+    close(fd);
+  }
+  history_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+}
+
+/* Index the entry that ends where the scan stopped. Returns false once the file is used up. */
+static bool index_one(void) {
+  size_t end = scanned;
+  while (end > 0 && map[end - 1] == '\n')
+    end--;
+  if (end == 0) {
+    scanned = 0;
+    return false;
+  }
+
+  const char *newline = memrchr(map, '\n', end);
+  size_t start = newline ? (size_t) (newline - map) + 1 : 0;
+  push(&file_entries, map + start, end - start);
+  scanned = start;
+  return true;
+}
+
+bool history_get(size_t n, const char **text, size_t *length) {
+  if (n < session.length) {
+    struct entry *entry = &session.list[session.length - 1 - n];
+    *text = entry->text;
+    *length = entry->length;
+    return true;
+  }
+
+  n -= session.length;
+  while (file_entries.length <= n && index_one())
+    ;
+  if (n >= file_entries.length)
+    return false;
+  *text = file_entries.list[n].text;
+  *length = file_entries.list[n].length;
+  return true;
+}
+
+void history_add(const char *line, size_t length) {
+  const char *newest;
+  size_t newest_length;
+
+  if (length > 0 && line[length - 1] == '\n')
+    length--;
+  if (strspn(line, " \t") >= length)
+    return;
+  if (history_get(0, &newest, &newest_length) && newest_length == length &&
+      !memcmp(newest, line, length))
+    return;
+
+  push(&session, strndup(line, length), length);
+
+  /* One write per entry, which O_APPEND keeps whole next to the ones of other shells */
+  if (history_fd != -1) {
+    struct iovec iov[2] = {{(void *) line, length}, {"\n", 1}};
+    if (writev(history_fd, iov, 2) == -1) {
+      close(history_fd);
+      history_fd = -1;
+    }
+  }
+}
+
+ssize_t history_search(const char *needle, size_t needle_length, size_t n) {
+  const char *text;
+  size_t length;
+
+  for (; history_get(n, &text, &length); n++)
+    if (memmem(text, length, needle, needle_length))
+      return (ssize_t) n;
+  return -1;
+}
+
+void history_close(void) {
+  for (size_t i = 0; i < session.length; i++)
+    free((char *) session.list[i].text);
+  free(session.list);
+  free(file_entries.list);
+  memset(&session, 0, sizeof(session));
+  memset(&file_entries, 0, sizeof(file_entries));
+  if (map)
+    munmap((void *) map, map_length);
+  map = NULL;
+  map_length = scanned = 0;
+  if (history_fd != -1)
+    close(history_fd);
+  history_fd = -1;
+}
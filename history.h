@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* The command history. The file is only ever appended to, one line per entry, and is mapped
+ * rather than read at startup. Entries are indexed from the newest backwards as far as navigation
+ * and searches reach, so a history of any length costs nothing until it is used. */
+
+/* Map the history file at path and append the entries of this session to it */
+void history_open(const char *path);
+
+/* Add a line, without its newline, unless it is blank or repeats the newest entry */
+void history_add(const char *line, size_t length);
+
+/* The nth entry, 0 being the newest. Returns false past the oldest one. The text is not
+ * terminated and stays valid until history_close. */
+bool history_get(size_t n, const char **text, size_t *length);
+
+/* Index of the newest entry from the nth one on that contains the needle, or -1 */
+ssize_t history_search(const char *needle, size_t needle_length, size_t n);
+
+void history_close(void);
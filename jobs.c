@@ -0,0 +1,595 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "capture.h"
+#include "cgroup.h"
+#include "jobs.h"
+#include "shell.h"
+#include "stats.h"
+#include "uring.h"
+
+/* P_PIDFD of waitid, for C libraries that predate it */
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+/* Every job that has not been reported as done yet, most recent first */
+static struct job *job_list;
+
+/* Declared in jobs.h */
+bool jobs_print_status = true;
+pid_t jobs_group;
+long jobs_maxrss;
+struct cgroup *jobs_cgroup;
+
+/* The epoll set of the pidfds being waited on, and of signal_fd while it is needed */
+static int watch_fd = -1;
+
+/* SIGCHLD as a descriptor, for the stops that pidfds do not report and the processes that have no
+ * pidfd, and whether it is in the epoll set and polled on the ring */
+static int signal_fd = -1;
+static bool signal_watched;
+static bool signal_polled;
+
+/* Set in the epoll data of the stream of a capture, which holds the capture and the number of the
+ * stream in its lowest bit. Pids and 0, for signal_fd, never have it. */
+#define CAPTURE_EVENT (1ULL << 63)
+
+/* The process of some job with the pid, or NULL, and the job it belongs to */
+static struct process *find_process(pid_t pid, struct job **owner) {
+  for (struct job *job = job_list; job; job = job->next) {
+    for (size_t i = 0; i < job->procs_length; i++) {
+      if (job->procs[i].pid == pid) {
+        *owner = job;
+        return &job->procs[i];
+      }
+    }
+  }
+  return NULL;
+}
+
+/* The wait status that waitpid would have returned for what waitid reported */
+static int wait_status(const siginfo_t *info) {
+  switch (info->si_code) {
+  case CLD_EXITED:
+    return (info->si_status & 0xff) << 8;
+  case CLD_KILLED:
+    return info->si_status;
+  case CLD_DUMPED:
+    return info->si_status | 0x80;
+  case CLD_CONTINUED:
+    return 0xffff;
+  default:
+    return (info->si_status << 8) | 0x7f;
+  }
+}
+
+/* Collect a change of state of the process without blocking. Only this very process can be
+ * reaped: through its pidfd, which cannot name a recycled pid, or by its pid if it has none. */
+static void reap_process(struct job *job, struct process *p) {
+  siginfo_t info;
+  struct rusage rusage;
+  int status;
+
+  if (p->completed)
+    return;
+  if (p->pidfd != -1) {
+    info.si_pid = 0;
+    if (syscall(SYS_waitid, P_PIDFD, p->pidfd, &info, WNOHANG | WEXITED | WSTOPPED | WCONTINUED,
+                &rusage) == -1 ||
+        info.si_pid == 0)
+      return;
+    status = wait_status(&info);
+  } else if (wait4(p->pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &rusage) <= 0) {
+    return;
+  }
+
+  p->status = status;
+  if (WIFSTOPPED(status)) {
+    p->stopped = true;
+  } else if (WIFCONTINUED(status)) {
+    p->stopped = false;
+  } else {
+    p->completed = true;
+    p->stopped = false;
+    p->ended = stats_clock();
+    p->rusage = rusage;
+    if (rusage.ru_maxrss > jobs_maxrss)
+      jobs_maxrss = rusage.ru_maxrss;
+    if (p->watched) {
+      epoll_ctl(watch_fd, EPOLL_CTL_DEL, p->pidfd, NULL);
+      p->watched = false;
+    }
+  }
+  job->notified = false;
+}
+
+/* Collect what changed in the processes of the jobs */
+static void reap_jobs(struct job **jobs, size_t length) {
+  for (size_t i = 0; i < length; i++)
+    for (size_t k = 0; k < jobs[i]->procs_length; k++)
+      reap_process(jobs[i], &jobs[i]->procs[k]);
+}
+
+/* Collect what changed in every process of the table */
+static void reap_all(void) {
+  for (struct job *job = job_list; job; job = job->next)
+    for (size_t k = 0; k < job->procs_length; k++)
+      reap_process(job, &job->procs[k]);
+}
+
+void jobs_init(void) {
+  /* Children are reaped when the shell waits for them or is about to report them, so SIGCHLD
+   * keeps its default action and has no handler that could reap a child someone else waits for */
+  signal(SIGCHLD, SIG_DFL);
+}
+
+void jobs_forked(void) {
+  for (struct job *job = job_list; job; job = job->next) {
+    for (size_t i = 0; i < job->procs_length; i++) {
+      struct process *p = &job->procs[i];
+      if (p->pidfd != -1)
+        close(p->pidfd);
+      p->pidfd = -1;
+      p->watched = p->polled = false;
+    }
+  }
+  if (watch_fd != -1)
+    close(watch_fd);
+  if (signal_fd != -1)
+    close(signal_fd);
+  watch_fd = signal_fd = -1;
+  signal_watched = signal_polled = false;
+}
+
+/* Blocking nests, so SIGCHLD is only unblocked again by the outermost jobs_unblock */
+static int block_depth;
+
+void jobs_block(void) {
+  if (block_depth++ == 0) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+  }
+}
+
+void jobs_unblock(void) {
+  if (--block_depth == 0) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+  }
+}
+
+struct job *job_create(const char *command) {
+  struct job *job = (struct job *) calloc(1, sizeof(struct job));
+  job->command = strdup(command);
+  job->tmodes = shell_tmodes;
+  job->notified = true;
+  job->pgid = jobs_group;
+  job->cgroup = jobs_cgroup;
+  jobs_cgroup = NULL;
+
+  job->id = job_list ? job_list->id + 1 : 1;
+  job->next = job_list;
+  job_list = job;
+  return job;
+}
+
+void job_add_process(struct job *job, pid_t pid, const char *name, uint64_t started) {
+  job->procs =
+      (struct process *) realloc(job->procs, sizeof(struct process) * (job->procs_length + 1));
+  struct process *p = &job->procs[job->procs_length++];
+  memset(p, 0, sizeof(struct process));
+  p->pid = pid;
+  /* The child is not reaped before the shell waits for it, so the pid still names it */
+  p->pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+  p->name = strdup(name);
+  p->started = started;
+  if (!job->pgid)
+    job->pgid = pid;
+}
+
+/* Take the stream of a capture out of the epoll set. A forked child of a pipeline may hold a copy
+ * of the pipe, which would keep it in the set after it is closed. */
+static void unwatch_stream(struct capture *capture, int stream) {
+  if (capture->streams[stream].watched)
+    epoll_ctl(watch_fd, EPOLL_CTL_DEL, capture->streams[stream].fd, NULL);
+  capture->streams[stream].watched = false;
+}
+
+/* Take the rest of the output of the job and keep its ring */
+static void finish_capture(struct job *job) {
+  if (!job->capture)
+    return;
+  unwatch_stream(job->capture, 0);
+  unwatch_stream(job->capture, 1);
+  capture_finish(job->capture);
+  job->capture = NULL;
+}
+
+void job_remove(struct job *job) {
+  finish_capture(job);
+  if (job->procs_length > 0 && job_is_completed(job) && (job->timed || stats_fd != -1))
+    stats_job(job);
+
+  for (struct job **link = &job_list; *link; link = &(*link)->next) {
+    if (*link == job) {
+      *link = job->next;
+      break;
+    }
+  }
+  for (size_t i = 0; i < job->procs_length; i++) {
+    /* A forked child may hold a copy of the pidfd, which would keep it in the set */
+    if (job->procs[i].watched)
+      epoll_ctl(watch_fd, EPOLL_CTL_DEL, job->procs[i].pidfd, NULL);
+    if (job->procs[i].pidfd != -1)
+      close(job->procs[i].pidfd);
+    free(job->procs[i].name);
+  }
+  free(job->procs);
+  free(job->command);
+  cgroup_destroy(job->cgroup);
+  free(job);
+}
+
+struct job *job_find(int id) {
+  for (struct job *job = job_list; job; job = job->next)
+    if (id == 0 ? !job_is_completed(job) : job->id == id)
+      return job;
+  return NULL;
+}
+
+struct job *job_find_pid(pid_t pid) {
+  for (struct job *job = job_list; job; job = job->next)
+    for (size_t i = 0; i < job->procs_length; i++)
+      if (job->procs[i].pid == pid)
+        return job;
+  return NULL;
+}
+
+bool job_is_stopped(struct job *job) {
+  bool any_stopped = false;
+  for (size_t i = 0; i < job->procs_length; i++) {
+    if (!job->procs[i].completed && !job->procs[i].stopped)
+      return false;
+    any_stopped |= job->procs[i].stopped;
+  }
+  return any_stopped;
+}
+
+bool job_is_completed(struct job *job) {
+  for (size_t i = 0; i < job->procs_length; i++)
+    if (!job->procs[i].completed)
+      return false;
+  return true;
+}
+
+/* Send the signal to every process of the job. The process group is signalled as a whole, which
+ * reaches what the processes started themselves, as long as its leader is one of them and not
+ * reaped, so that the group id cannot have been reused. Otherwise the processes still running are
+ * signalled one by one through their pidfds. Returns -1 if none could be signalled. */
+static int signal_job(struct job *job, int signo) {
+  for (size_t i = 0; i < job->procs_length; i++)
+    if (job->procs[i].pid == job->pgid && !job->procs[i].completed)
+      return kill(-job->pgid, signo);
+
+  int ret = -1;
+  for (size_t i = 0; i < job->procs_length; i++) {
+    struct process *p = &job->procs[i];
+    if (p->completed)
+      continue;
+    if ((p->pidfd != -1 ? (int) syscall(SYS_pidfd_send_signal, p->pidfd, signo, NULL, 0)
+                        : kill(p->pid, signo)) == 0)
+      ret = 0;
+  }
+  return ret;
+}
+
+/* Open signal_fd if needed. SIGCHLD has to stay blocked while it is waited on. */
+static bool open_signal_fd(void) {
+  if (signal_fd == -1) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+  }
+  return signal_fd != -1;
+}
+
+static void drain_signal_fd(void) {
+  struct signalfd_siginfo info;
+  while (read(signal_fd, &info, sizeof(info)) > 0)
+    continue;
+}
+
+/* Wait on the epoll set for a process to change state, with SIGCHLD blocked. Each running process
+ * of the jobs has its pidfd added once and kept until it exits, so a wakeup costs the same among
+ * thousands of children as among two, and only the processes whose pidfd fired are reaped. The
+ * SIGCHLD descriptor is in the set only where a stop has to be noticed, on a terminal, or for a
+ * process without a pidfd, and then every process is looked at. */
+static void watch_sleep(struct job **jobs, size_t length) {
+  struct epoll_event events[64];
+  bool need_signal = shell_is_interactive;
+
+  if (watch_fd == -1)
+    watch_fd = epoll_create1(EPOLL_CLOEXEC);
+  for (size_t i = 0; i < length; i++) {
+    for (size_t k = 0; k < jobs[i]->procs_length; k++) {
+      struct process *p = &jobs[i]->procs[k];
+      if (p->completed || p->watched)
+        continue;
+      struct epoll_event event = {.events = EPOLLIN, .data.u64 = (uint64_t) p->pid};
+      if (p->pidfd != -1 && watch_fd != -1 &&
+          epoll_ctl(watch_fd, EPOLL_CTL_ADD, p->pidfd, &event) == 0)
+        p->watched = true;
+      else
+        need_signal = true;
+    }
+    /* The output of a captured job is drained as it arrives, or the job would block on it */
+    for (int k = 0; jobs[i]->capture && k < 2; k++) {
+      struct capture_stream *stream = &jobs[i]->capture->streams[k];
+      struct epoll_event event = {
+          .events = EPOLLIN, .data.u64 = CAPTURE_EVENT | (uintptr_t) jobs[i]->capture | k};
+      if (stream->fd != -1 && !stream->watched && watch_fd != -1 &&
+          epoll_ctl(watch_fd, EPOLL_CTL_ADD, stream->fd, &event) == 0)
+        stream->watched = true;
+    }
+  }
+
+  if (watch_fd == -1 || (need_signal && !open_signal_fd())) {
+    /* Without descriptors to wait on, wait for the signal itself */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigwaitinfo(&set, NULL);
+    reap_all();
+    return;
+  }
+  if (need_signal != signal_watched) {
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = 0};
+    epoll_ctl(watch_fd, need_signal ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, signal_fd, &event);
+    signal_watched = need_signal;
+  }
+
+  int ready = epoll_wait(watch_fd, events, sizeof(events) / sizeof(events[0]), -1);
+  bool signalled = false;
+  for (int i = 0; i < ready; i++) {
+    struct job *job;
+    struct process *p;
+    if (events[i].data.u64 & CAPTURE_EVENT) {
+      uint64_t data = events[i].data.u64 & ~CAPTURE_EVENT;
+      struct capture *capture = (struct capture *) (uintptr_t) (data & ~1ULL);
+      int stream = (int) (data & 1);
+      if (!capture_pump(capture, stream)) {
+        unwatch_stream(capture, stream);
+        capture_close(capture, stream);
+      }
+    } else if (events[i].data.u64 == 0)
+      signalled = true;
+    else if ((p = find_process((pid_t) events[i].data.u64, &job)))
+      reap_process(job, p);
+  }
+  if (signalled) {
+    drain_signal_fd();
+    reap_all();
+  }
+}
+
+/* Whether something was reaped since the ring was last waited on */
+static bool woken;
+
+/* The pidfd of a process became readable, which it does once the process has exited */
+static void pidfd_ready(uint64_t tag, int result, void *data) {
+  struct job *job;
+  (void) result;
+  (void) data;
+  struct process *p = find_process((pid_t) tag, &job);
+  if (p) {
+    p->polled = false;
+    reap_process(job, p);
+  }
+  woken = true;
+}
+
+static void signal_ready(uint64_t tag, int result, void *data) {
+  (void) tag;
+  (void) result;
+  (void) data;
+  signal_polled = false;
+  drain_signal_fd();
+  reap_all();
+  woken = true;
+}
+
+/* Wait on the ring for a process to change state, with SIGCHLD left blocked. Every running
+ * process of the jobs has its pidfd polled once and the poll stays in flight until the process
+ * exits, so a wait among hundreds of children costs the same as among two, and only the process
+ * whose pidfd fired is reaped. On a terminal, where jobs can be stopped, a signalfd for SIGCHLD
+ * is polled as well. Returns false if there was nothing to poll, a process has no pidfd or the
+ * output of a job is captured, which the epoll set drains. */
+static bool uring_sleep(struct job **jobs, size_t length) {
+  bool polling = false;
+  for (size_t i = 0; i < length; i++) {
+    if (jobs[i]->capture)
+      return false;
+    for (size_t k = 0; k < jobs[i]->procs_length; k++) {
+      struct process *p = &jobs[i]->procs[k];
+      if (p->completed)
+        continue;
+      /* Left to the epoll set, which takes SIGCHLD for it */
+      if (p->pidfd == -1)
+        return false;
+      if (!p->polled) {
+        uring_poll(p->pidfd, POLLIN, pidfd_ready, NULL, (uint64_t) p->pid);
+        p->polled = true;
+      }
+      polling = true;
+    }
+  }
+  if (!polling)
+    return false;
+
+  if (shell_is_interactive && open_signal_fd() && !signal_polled) {
+    uring_poll(signal_fd, POLLIN, signal_ready, NULL, 0);
+    signal_polled = true;
+  }
+
+  woken = false;
+  return uring_wait(&woken) == 0;
+}
+
+/* Sleep until a process of the jobs may have changed state and collect what changed. SIGCHLD has
+ * to be blocked by the caller, so that it stays pending for signal_fd. */
+static void sleep_blocked(struct job **jobs, size_t length) {
+  if (!uring_enabled || !uring_sleep(jobs, length))
+    watch_sleep(jobs, length);
+}
+
+/* Sleep until the job stops or completes. A stop from before SIGCHLD was blocked would not wake
+ * the shell, so the job is looked at first. */
+static void wait_blocked(struct job *job) {
+  reap_jobs(&job, 1);
+  while (!job_is_completed(job) && !job_is_stopped(job))
+    sleep_blocked(&job, 1);
+}
+
+int job_foreground(struct job *job, bool cont) {
+  job->background = false;
+
+  /* Put the job to foreground */
+  if (shell_is_interactive && tcsetpgrp(shell_terminal, job->pgid) < 0)
+    perror("tcsetpgrp failed");
+
+  jobs_block();
+  if (cont) {
+    if (shell_is_interactive)
+      tcsetattr(shell_terminal, TCSADRAIN, &job->tmodes);
+    if (signal_job(job, SIGCONT) < 0)
+      perror("kill (SIGCONT)");
+    for (size_t i = 0; i < job->procs_length; i++)
+      job->procs[i].stopped = false;
+  }
+  wait_blocked(job);
+  jobs_unblock();
+
+  /* Put the shell back to foreground, keeping the terminal modes of the job for later */
+  if (shell_is_interactive) {
+    if (tcsetpgrp(shell_terminal, shell_pgid) < 0)
+      perror("tcsetpgrp failed");
+    tcgetattr(shell_terminal, &job->tmodes);
+    tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
+  }
+
+  if (!job_is_completed(job)) {
+    printf("\n[%d]+ Stopped\t%s\n", job->id, job->command);
+    job->notified = true;
+    return job->procs[job->procs_length - 1].status;
+  }
+
+  /* The output of the job comes before its status */
+  finish_capture(job);
+  for (size_t i = 0; jobs_print_status && i < job->procs_length; i++)
+    printf("status: %d\n", job->procs[i].status);
+  int status = job->procs[job->procs_length - 1].status;
+  job_remove(job);
+  return status;
+}
+
+void job_background(struct job *job, bool cont) {
+  job->background = true;
+  if (cont) {
+    if (signal_job(job, SIGCONT) < 0)
+      perror("kill (SIGCONT)");
+    for (size_t i = 0; i < job->procs_length; i++)
+      job->procs[i].stopped = false;
+  }
+}
+
+int job_wait(struct job *job) {
+  jobs_block();
+  wait_blocked(job);
+  jobs_unblock();
+  return job->procs[job->procs_length - 1].status;
+}
+
+struct job *jobs_wait_any(struct job **jobs, size_t length) {
+  struct job *done = NULL;
+
+  jobs_block();
+  while (!done) {
+    for (size_t i = 0; i < length && !done; i++)
+      if (job_is_completed(jobs[i]) || job_is_stopped(jobs[i]))
+        done = jobs[i];
+    if (!done)
+      sleep_blocked(jobs, length);
+  }
+  jobs_unblock();
+  return done;
+}
+
+void jobs_wait_all(void) {
+  jobs_block();
+  for (struct job *job = job_list; job; job = job->next)
+    wait_blocked(job);
+  jobs_unblock();
+
+  for (struct job *job = job_list, *next; job; job = next) {
+    next = job->next;
+    if (job_is_completed(job))
+      job_remove(job);
+  }
+}
+
+void jobs_notify(void) {
+  reap_all();
+  struct job *job = job_list;
+  while (job) {
+    struct job *next = job->next;
+    if (job_is_completed(job) && job->background) {
+      /* Unless jobs already reported it. It stays for wait to collect its status. */
+      if (shell_is_interactive && !job->notified)
+        printf("[%d]  Done\t%s\n", job->id, job->command);
+      job->notified = true;
+    } else if (job_is_completed(job)) {
+      job_remove(job);
+    } else if (job_is_stopped(job) && !job->notified) {
+      printf("[%d]+ Stopped\t%s\n", job->id, job->command);
+      job->notified = true;
+    }
+    job = next;
+  }
+}
+
+/* The list is most recent first, so print the rest of it before the job itself */
+static void print_from(struct job *job) {
+  if (!job)
+    return;
+  print_from(job->next);
+  const char *state = job_is_completed(job) ? "Done" : job_is_stopped(job) ? "Stopped" : "Running";
+  printf("[%d]  %-8s\t%s\n", job->id, state, job->command);
+  job->notified = true;
+}
+
+void jobs_print(void) {
+  reap_all();
+  print_from(job_list);
+
+  /* What was reported as done is gone */
+  for (struct job *job = job_list, *next; job; job = next) {
+    next = job->next;
+    if (job_is_completed(job))
+      job_remove(job);
+  }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <termios.h>
+
+struct capture;
+struct cgroup;
+
+/* A process of a pipeline. Its state is filled in when the shell waits for it. */
+struct process {
+  pid_t pid;
+  /* The pidfd the process is reaped and signalled through, or -1 if the kernel has none, whether
+   * it is in the epoll set and whether a poll of it is in flight on the ring */
+  int pidfd;
+  bool watched;
+  bool polled;
+  char *name;
+  int status;
+  bool completed;
+  bool stopped;
+  /* stats_clock times of the launch and of the reap, and the usage reported at the reap */
+  uint64_t started;
+  uint64_t ended;
+  struct rusage rusage;
+};
+
+/* A pipeline running in its own process group */
+struct job {
+  int id;
+  pid_t pgid;
+  char *command;
+  struct process *procs;
+  size_t procs_length;
+  bool background;
+  bool notified;
+  /* Run by the time builtin */
+  bool timed;
+  /* The cgroup leaf every process of the job runs in, or NULL */
+  struct cgroup *cgroup;
+  /* The output of the job while it is captured, or NULL */
+  struct capture *capture;
+  struct termios tmodes;
+  struct job *next;
+};
+
+/* Whether job_foreground prints the status of every process of a completed job. It is turned off
+ * where the output of the shell is captured, in the child of a command substitution. */
+extern bool jobs_print_status;
+
+/* The process group new jobs join, or 0 for each to get its own. The child of a command
+ * substitution keeps its jobs in its own group, so that what reaches it from the terminal reaches
+ * them too. */
+extern pid_t jobs_group;
+
+/* The cgroup leaf the next job created runs in, handed over to it by job_create, or NULL */
+extern struct cgroup *jobs_cgroup;
+
+/* The largest maxrss, in kilobytes, of the processes reaped since it was last set to 0 */
+extern long jobs_maxrss;
+
+/* Give SIGCHLD its default action. Children are only reaped one by one, by whoever waits for
+ * them. */
+void jobs_init(void);
+
+/* Let go of the descriptors shared with the shell in a forked child that runs commands of its own:
+ * the pidfds of the jobs it inherited, the epoll set and the SIGCHLD descriptor */
+void jobs_forked(void);
+
+/* Block or unblock SIGCHLD. It is blocked while a job is launched and while the shell waits, so
+ * that a stop is kept pending for the descriptor that reports it. Calls nest. */
+void jobs_block(void);
+void jobs_unblock(void);
+
+/* Add a job for the given command line to the table */
+struct job *job_create(const char *command);
+
+/* Record a launched process of the job, running the named program since the stats_clock time
+ * started. The first one names the process group. */
+void job_add_process(struct job *job, pid_t pid, const char *name, uint64_t started);
+
+/* Remove the job from the table and free it, with its cgroup. A completed job is reported by
+ * stats_job first. */
+void job_remove(struct job *job);
+
+/* Find a job by its number, or the most recent one that has not completed for 0 */
+struct job *job_find(int id);
+
+/* Find the job one of whose processes has the pid, or NULL */
+struct job *job_find_pid(pid_t pid);
+
+bool job_is_stopped(struct job *job);
+bool job_is_completed(struct job *job);
+
+/* Give the terminal to the job, continuing it first if cont is set, and wait until it stops or
+ * completes. A completed job has the status of each process printed and is removed. Returns the
+ * status of the last process. */
+int job_foreground(struct job *job, bool cont);
+
+/* Let the job run without waiting for it, continuing it first if cont is set */
+void job_background(struct job *job, bool cont);
+
+/* Wait until the job completes or stops, without giving it the terminal. Returns the status of
+ * the last process. */
+int job_wait(struct job *job);
+
+/* Wait until one of the given jobs has completed or stopped, and return it */
+struct job *jobs_wait_any(struct job **jobs, size_t length);
+
+/* Wait until every running job has completed or stopped, and drop the completed ones */
+void jobs_wait_all(void);
+
+/* Report background jobs that stopped or completed since the last call. Completed background jobs
+ * stay in the table with their status until wait collects them or jobs reports them, others are
+ * dropped. */
+void jobs_notify(void);
+
+/* Print every job and its state, and drop the completed ones */
+void jobs_print(void);
@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "optimize.h"
+#include "parse.h"
+#include "stats.h"
+#include "tokenizer.h"
+
+/* Where the kernel keeps the largest pipe an unprivileged process may ask for */
+#define PIPE_MAX_SIZE_PATH "/proc/sys/fs/pipe-max-size"
+
+/* The default of pipe-max-size, for kernels that do not say */
+#define PIPE_MAX_SIZE_DEFAULT (1 << 20)
+
+int optimize_pipe_size = PIPE_MAX_SIZE_DEFAULT;
+
+/* The cap read from the kernel, or 0 before it was read */
+static long pipe_max_size;
+
+static long max_size(void) {
+  if (pipe_max_size == 0) {
+    FILE *file = fopen(PIPE_MAX_SIZE_PATH, "re");
+    if (!file || fscanf(file, "%ld", &pipe_max_size) != 1 || pipe_max_size <= 0)
+      pipe_max_size = PIPE_MAX_SIZE_DEFAULT;
+    if (file)
+      fclose(file);
+  }
+  return pipe_max_size;
+}
+
+int optimize_set_pipe_size(long size) {
+  if (size < 0)
+    size = 0;
+  if (size > max_size())
+    size = max_size();
+  optimize_pipe_size = (int) size;
+  return optimize_pipe_size;
+}
+
+int optimize_pipe(int fd, int job, size_t index) {
+  if (optimize_pipe_size == 0)
+    return 0;
+  if (optimize_pipe_size > max_size())
+    optimize_pipe_size = (int) max_size();
+  /* Past the per-user limit of pipe memory the kernel refuses, and the pipe stays as it is */
+  int size = fcntl(fd, F_SETPIPE_SZ, optimize_pipe_size);
+  if (size == -1)
+    return 0;
+  stats_rewrite("pipe-size", "job=%d pipe=%zu bytes=%d", job, index, size);
+  return size;
+}
+
+/* Whether the command is cat with a single file named literally, and nothing else */
+static bool copies_one_file(const struct command *command) {
+  if (command->assignments_length > 0 || command->redirects.length > 0 || !command->parsed[0] ||
+      !command->parsed[1] || command->parsed[2])
+    return false;
+  if (strcmp(command->parsed[0], "cat") || (command->flags[0] & (TOKEN_EXPAND | TOKEN_GLOB)))
+    return false;
+  const char *file = command->parsed[1];
+  return !(command->flags[1] & (TOKEN_EXPAND | TOKEN_GLOB)) && *file && *file != '-';
+}
+
+void optimize_pipeline(struct pipeline *pipeline) {
+  if (pipeline->length < 2 || !copies_one_file(&pipeline->commands[0]) ||
+      redirects_touch(&pipeline->commands[1].redirects, STDIN_FILENO))
+    return;
+
+  const char *file = pipeline->commands[0].parsed[1];
+  stats_rewrite("cat-redirect", "file=%s line=%s", file, pipeline->text);
+  /* The redirection comes first, where the pipe was set up, so the command's own ones still win */
+  redirects_prepend_file(&pipeline->commands[1].redirects, REDIRECT_INPUT, STDIN_FILENO, file);
+  redirects_clear(&pipeline->commands[0].redirects);
+  pipeline->length--;
+  memmove(pipeline->commands, pipeline->commands + 1, sizeof(struct command) * pipeline->length);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+struct pipeline;
+
+/* Rewrites of parsed pipelines that save the shell or its children work without changing what
+ * the line does, and the sizing of the pipes between stages. Every rewrite is reported in stats
+ * mode. */
+
+/* Capacity in bytes given to the pipes between the stages of a pipeline, or 0 for the kernel
+ * default. It is set with the pipesize builtin and never exceeds /proc/sys/fs/pipe-max-size. */
+extern int optimize_pipe_size;
+
+/* Set optimize_pipe_size, capped at what an unprivileged process may ask for. Returns the size
+ * that is used. */
+int optimize_set_pipe_size(long size);
+
+/* Give the pipe of the job the configured capacity. Returns what it got, or 0 if it kept the
+ * default. */
+int optimize_pipe(int fd, int job, size_t index);
+
+/* Rewrite the pipeline once after it is parsed: a first stage that only copies a file, cat file,
+ * becomes an input redirection of the second, cmd < file, so data goes from the file to the
+ * command with no process or pipe in between */
+void optimize_pipeline(struct pipeline *pipeline);
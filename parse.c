@@ -0,0 +1,803 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+#include "pathglob.h"
+#include "reader.h"
+#include "tokenizer.h"
+#include "vars.h"
+
+/* Slots of the line cache. A line goes to the slot of its hash and replaces whatever was there, so
+ * the cache stays bounded without keeping any order. */
+#define PARSE_CACHE_SLOTS 256
+
+struct cache_entry {
+  uint64_t hash;
+  char *line;
+  size_t length;
+  struct node *list;
+};
+
+static struct cache_entry cache[PARSE_CACHE_SLOTS];
+
+/* Reads a list of commands out of the tokens of a line and of the lines after it */
+struct parser {
+  struct tokens *tokens;
+  size_t next;
+  struct reader *input;
+  parse_whole_line_t *whole_line;
+
+  /* Compound commands left open, inside which a newline only separates two commands */
+  int depth;
+
+  bool cacheable;
+  bool failed;
+
+  /* The words of the pipeline being gathered and their TOKEN_ flags */
+  char **words;
+  unsigned char *flags;
+  size_t words_capacity;
+};
+
+/* Words that start or end a compound command where a command starts */
+static const char *const reserved[] = {"if", "then", "elif", "else", "fi", "while", "until",
+                                       "do", "done", "for", "case", "esac", "!", NULL};
+
+/* What ends each part of a compound command */
+static const char *const no_stops[] = {NULL};
+static const char *const then_stops[] = {"then", NULL};
+static const char *const if_stops[] = {"elif", "else", "fi", NULL};
+static const char *const fi_stops[] = {"fi", NULL};
+static const char *const do_stops[] = {"do", NULL};
+static const char *const done_stops[] = {"done", NULL};
+static const char *const arm_stops[] = {";;", "esac", NULL};
+
+/* Copy the words into one block owned by the tree */
+static void copy_words(struct pipeline *pipeline, char **words, size_t length) {
+  size_t size = 1;
+  for (size_t i = 0; i < length; i++)
+    size += strlen(words[i]) + 1;
+
+  pipeline->storage = (char *) malloc(size);
+  pipeline->text = (char *) malloc(size);
+  pipeline->words = (char **) malloc(sizeof(char *) * (length + 1));
+  pipeline->words_length = length;
+
+  char *p = pipeline->storage, *t = pipeline->text;
+  for (size_t i = 0; i < length; i++) {
+    size_t n = strlen(words[i]);
+    memcpy(p, words[i], n + 1);
+    pipeline->words[i] = p;
+    p += n + 1;
+
+    if (i > 0)
+      *t++ = ' ';
+    memcpy(t, words[i], n);
+    t += n;
+  }
+  *t = '\0';
+  pipeline->words[length] = NULL;
+}
+
+/* Whether words[i] is the operator op, and not a quoted word that reads the same */
+static bool is_operator(char **words, const unsigned char *flags, size_t i, const char *op) {
+  return (!flags || (flags[i] & TOKEN_OPERATOR)) && !strcmp(words[i], op);
+}
+
+/* If words[i] is a redirection, add it to the list with what its target needs before each run.
+ * Returns the words it takes, 0 if it is none, and -1 after reporting a syntax error. */
+static int parse_redirect(struct redirects *redirects, char **words, const unsigned char *flags,
+                          size_t i, size_t length, struct reader *input) {
+  /* Only a < or > outside of quotes makes a redirection, the one in "a > b" is text */
+  if (flags && (flags[i] & TOKEN_QUOTED) && !(flags[i] & TOKEN_REDIRECT))
+    return 0;
+  int used = redirect_parse(redirects, words, i, length, input);
+  if (used <= 0)
+    return used;
+
+  size_t last = i + (size_t) used - 1;
+  struct redirect *redirect = &redirects->list[redirects->length - 1];
+  redirect->expand = flags && (flags[last] & TOKEN_EXPAND) && !redirect->heredoc &&
+                     redirect->op != REDIRECT_DUP && redirect->op != REDIRECT_CLOSE;
+  /* The text of a here-document with an unquoted delimiter is expanded, like a quoted word */
+  if (redirect->heredoc && flags && !(flags[last] & TOKEN_QUOTED))
+    redirect_expand_heredoc(redirect);
+  /* A target is never a pattern, as in bash when the shell is not interactive */
+  if (flags && (flags[last] & TOKEN_GLOB) && !redirect->heredoc) {
+    pathglob_unescape(redirect->target);
+    redirect->target_length = strlen(redirect->target);
+  }
+  return used;
+}
+
+struct pipeline *parse_words(char **words, const unsigned char *flags, size_t length,
+                             struct reader *input, bool whole_line) {
+  struct pipeline *pipeline = (struct pipeline *) calloc(1, sizeof(struct pipeline));
+  pipeline->cacheable = true;
+
+  if (!whole_line && length > 0 && is_operator(words, flags, length - 1, "&")) {
+    pipeline->background = true;
+    length--;
+    if (length == 0) {
+      printf("syntax error near unexpected token `&'.\n");
+      free(pipeline);
+      return NULL;
+    }
+  }
+  copy_words(pipeline, words, length);
+  words = pipeline->words;
+
+  size_t count = 1;
+  for (size_t i = 0; !whole_line && i < length; i++)
+    count += is_operator(words, flags, i, "|");
+
+  pipeline->commands = (struct command *) calloc(count, sizeof(struct command));
+
+  /* Every list of assignments and of arguments ends with a NULL, and a command made only of
+   * redirections may get a cat. The flags of the words sit at the same offsets. */
+  size_t slots = length + 3 * count;
+  pipeline->args = (char **) malloc(sizeof(char *) * slots);
+  pipeline->flags = (unsigned char *) calloc(slots, 1);
+  char **args = pipeline->args;
+  unsigned char *arg_flags = pipeline->flags;
+
+  for (size_t i = 0; i <= length; i++) {
+    struct command *command = &pipeline->commands[pipeline->length++];
+    size_t a = 0, j;
+    command->builtin = -1;
+
+    /* The names set for the command come first, up to the first word that is not one */
+    command->assignments = args;
+    command->assignment_flags = arg_flags;
+    for (; !whole_line && i < length && !is_operator(words, flags, i, "|") &&
+           (flags ? (flags[i] & TOKEN_ASSIGNMENT) : vars_is_assignment(words[i]));
+         i++) {
+      arg_flags[a] = flags ? flags[i] : 0;
+      /* Values are not patterns */
+      if (arg_flags[a] & TOKEN_GLOB) {
+        pathglob_unescape(words[i]);
+        arg_flags[a] &= ~TOKEN_GLOB;
+      }
+      args[a++] = words[i];
+    }
+    command->assignments_length = a;
+    args[a++] = NULL;
+    args += a;
+    arg_flags += a;
+
+    command->args = command->parsed = args;
+    command->flags = arg_flags;
+    for (j = 0; i < length && (whole_line || !is_operator(words, flags, i, "|")); i++) {
+      int used =
+          whole_line ? 0 : parse_redirect(&command->redirects, words, flags, i, length, input);
+      if (used == -1) {
+        pipeline_free(pipeline);
+        return NULL;
+      }
+      if (used > 0) {
+        i += used - 1;
+      } else {
+        arg_flags[j] = flags ? flags[i] : 0;
+        args[j++] = words[i];
+      }
+    }
+
+    if (j == 0 && command->assignments_length == 0 && command->redirects.length == 0) {
+      printf("syntax error near unexpected token `%s'.\n", i < length ? "|" : "newline");
+      pipeline_free(pipeline);
+      return NULL;
+    }
+
+    /* A command that only moves its input to its output copies it, the way zsh runs it through
+     * cat */
+    if (j == 0 && redirects_touch(&command->redirects, 0) &&
+        redirects_touch(&command->redirects, 1))
+      args[j++] = "cat";
+    args[j++] = NULL;
+    args += j;
+    arg_flags += j;
+
+    for (size_t k = 0; k < j; k++)
+      command->expand |= (command->flags[k] & (TOKEN_EXPAND | TOKEN_GLOB)) != 0;
+    for (size_t k = 0; k < command->assignments_length; k++)
+      command->expand |= (command->assignment_flags[k] & TOKEN_EXPAND) != 0;
+    for (size_t k = 0; k < command->redirects.length; k++)
+      command->expand |= command->redirects.list[k].expand;
+
+    for (size_t k = 0; k < command->redirects.length; k++)
+      if (command->redirects.list[k].op == REDIRECT_DATA &&
+          command->redirects.list[k].heredoc)
+        pipeline->cacheable = false;
+  }
+  return pipeline;
+}
+
+void pipeline_free(struct pipeline *pipeline) {
+  if (pipeline == NULL)
+    return;
+  for (size_t i = 0; i < pipeline->length; i++)
+    redirects_clear(&pipeline->commands[i].redirects);
+  free(pipeline->commands);
+  free(pipeline->args);
+  free(pipeline->flags);
+  free(pipeline->words);
+  free(pipeline->storage);
+  free(pipeline->text);
+  free(pipeline);
+}
+
+/* The next token of the line, or NULL at its end; flags may be NULL */
+static const char *peek(struct parser *p, int *flags) {
+  if (flags)
+    *flags = tokens_get_flags(p->tokens, p->next);
+  return tokens_get_token(p->tokens, p->next);
+}
+
+/* Whether the next token is one of the words, unquoted */
+static bool at_word(struct parser *p, const char *const *words) {
+  int flags;
+  const char *token = peek(p, &flags);
+  if (!token || (flags & TOKEN_QUOTED))
+    return false;
+  for (; *words; words++)
+    if (!strcmp(token, *words))
+      return true;
+  return false;
+}
+
+static bool at(struct parser *p, const char *word) {
+  const char *words[] = {word, NULL};
+  return at_word(p, words);
+}
+
+static void unexpected(struct parser *p) {
+  const char *token = peek(p, NULL);
+  printf("syntax error near unexpected token `%s'.\n", token ? token : "newline");
+  p->failed = true;
+}
+
+/* Move on to the next line of input, the continuation of an open compound command */
+static bool next_line(struct parser *p) {
+  const char *line;
+  ssize_t length;
+
+  if (!p->input)
+    return false;
+  reader_prompt(p->input, "> ");
+  if ((length = reader_getline(p->input, &line)) == -1)
+    return false;
+  tokenize_buffer(p->tokens, line, length);
+  p->next = 0;
+  p->cacheable = false;
+  return true;
+}
+
+/* Make sure there is a next token, reading as many lines as it takes. Returns false after
+ * reporting that the input ended first. */
+static bool need_token(struct parser *p) {
+  while (!peek(p, NULL)) {
+    if (!next_line(p)) {
+      printf("syntax error: unexpected end of file.\n");
+      p->failed = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Consume the reserved word or operator, or report what is there instead */
+static bool expect(struct parser *p, const char *word) {
+  if (!need_token(p))
+    return false;
+  if (!at(p, word)) {
+    unexpected(p);
+    return false;
+  }
+  p->next++;
+  return true;
+}
+
+static void push_word(struct parser *p, size_t *length, char *word, int flags) {
+  if (*length + 1 >= p->words_capacity) {
+    p->words_capacity = p->words_capacity ? p->words_capacity * 2 : 16;
+    p->words = (char **) realloc(p->words, sizeof(char *) * p->words_capacity);
+    p->flags = (unsigned char *) realloc(p->flags, p->words_capacity);
+  }
+  p->flags[*length] = (unsigned char) flags;
+  p->words[(*length)++] = word;
+}
+
+static struct node *new_node(enum node_type type) {
+  struct node *node = (struct node *) calloc(1, sizeof(struct node));
+  node->type = type;
+  return node;
+}
+
+static struct node *parse_list(struct parser *p, const char *const *stops);
+
+/* A list that has to hold at least one command */
+static struct node *parse_body(struct parser *p, const char *const *stops) {
+  struct node *list = parse_list(p, stops);
+  if (!list && !p->failed)
+    unexpected(p);
+  return list;
+}
+
+/* Whether the word after the | at the next token starts a compound command */
+static bool pipes_into_compound(struct parser *p) {
+  static const char *const compound[] = {"if", "while", "until", "for", "case", NULL};
+  int flags = tokens_get_flags(p->tokens, p->next + 1);
+  const char *token = tokens_get_token(p->tokens, p->next + 1);
+  if (!token || (flags & (TOKEN_QUOTED | TOKEN_OPERATOR)))
+    return false;
+  for (const char *const *word = compound; *word; word++)
+    if (!strcmp(token, *word))
+      return true;
+  return false;
+}
+
+/* The words up to the next operator other than |, or up to a | into a compound command. A builtin
+ * taking its whole line also gets the operators between its braces, such as the ; of
+ * parallel { a ; b }. */
+static struct node *parse_pipeline(struct parser *p) {
+  int flags, braces = 0;
+  const char *token = peek(p, &flags);
+  bool whole_line = p->whole_line(token);
+  size_t length = 0;
+
+  while ((token = peek(p, &flags))) {
+    if ((flags & TOKEN_OPERATOR) && strcmp(token, "|") && !(whole_line && braces > 0))
+      break;
+    if ((flags & TOKEN_OPERATOR) && !whole_line && !strcmp(token, "|") && length > 0 &&
+        pipes_into_compound(p))
+      break;
+    if (whole_line && !flags)
+      braces += !strcmp(token, "{") - !strcmp(token, "}");
+    push_word(p, &length, tokens_get_token(p->tokens, p->next), flags);
+    p->next++;
+  }
+
+  struct pipeline *pipeline = parse_words(p->words, p->flags, length, p->input, whole_line);
+  if (!pipeline) {
+    p->failed = true;
+    return NULL;
+  }
+  if (!pipeline->cacheable)
+    p->cacheable = false;
+
+  struct node *node = new_node(NODE_PIPELINE);
+  node->pipeline = pipeline;
+  return node;
+}
+
+/* if or elif up to the fi, which an elif shares with the if it belongs to */
+static struct node *parse_if(struct parser *p) {
+  struct node *node = new_node(NODE_IF);
+
+  p->next++;
+  p->depth++;
+  if ((node->condition = parse_body(p, then_stops)) && expect(p, "then") &&
+      (node->body = parse_body(p, if_stops))) {
+    if (at(p, "elif")) {
+      node->otherwise = parse_if(p);
+    } else if (at(p, "else")) {
+      p->next++;
+      if ((node->otherwise = parse_body(p, fi_stops)))
+        expect(p, "fi");
+    } else {
+      p->next++;
+    }
+  }
+  p->depth--;
+
+  if (p->failed) {
+    list_free(node);
+    return NULL;
+  }
+  return node;
+}
+
+static struct node *parse_loop(struct parser *p, enum node_type type) {
+  struct node *node = new_node(type);
+
+  p->next++;
+  p->depth++;
+  if ((node->condition = parse_body(p, do_stops)) && expect(p, "do") &&
+      (node->body = parse_body(p, done_stops)))
+    expect(p, "done");
+  p->depth--;
+
+  if (p->failed) {
+    list_free(node);
+    return NULL;
+  }
+  return node;
+}
+
+static struct node *parse_for(struct parser *p) {
+  struct node *node = new_node(NODE_FOR);
+  int flags;
+  const char *token;
+
+  p->next++;
+  token = peek(p, &flags);
+  if (!token || flags || vars_name_length(token) != strlen(token)) {
+    unexpected(p);
+    list_free(node);
+    return NULL;
+  }
+  node->name = strdup(token);
+  p->next++;
+
+  p->depth++;
+  if (at(p, "in")) {
+    size_t capacity = 0;
+    for (p->next++; (token = peek(p, &flags)) && !(flags & TOKEN_OPERATOR); p->next++) {
+      if (node->items_length == capacity) {
+        capacity = capacity ? capacity * 2 : 8;
+        node->items = (char **) realloc(node->items, sizeof(char *) * capacity);
+        node->item_flags = (unsigned char *) realloc(node->item_flags, capacity);
+      }
+      node->item_flags[node->items_length] = (unsigned char) flags;
+      node->items[node->items_length++] = strdup(token);
+    }
+  }
+  if (at(p, ";"))
+    p->next++;
+  else if (peek(p, NULL))
+    unexpected(p);
+
+  if (!p->failed && expect(p, "do") && (node->body = parse_body(p, done_stops)))
+    expect(p, "done");
+  p->depth--;
+
+  if (p->failed) {
+    list_free(node);
+    return NULL;
+  }
+  return node;
+}
+
+/* case word in, then arms of patterns split by | and closed by ), each with a list that ends in
+ * ;; or at the esac */
+static struct node *parse_case(struct parser *p) {
+  struct node *node = new_node(NODE_CASE);
+  int flags;
+  const char *token;
+  size_t capacity = 0;
+
+  p->next++;
+  token = peek(p, &flags);
+  if (!token || (flags & TOKEN_OPERATOR)) {
+    unexpected(p);
+    list_free(node);
+    return NULL;
+  }
+  node->name = strdup(token);
+  node->name_flags = flags;
+  if (flags & TOKEN_GLOB)
+    pathglob_unescape(node->name);
+  p->next++;
+
+  p->depth++;
+  if (!expect(p, "in"))
+    goto out;
+
+  while (need_token(p) && !at(p, "esac")) {
+    if (node->arms_length == capacity) {
+      capacity = capacity ? capacity * 2 : 4;
+      node->arms = (struct case_arm *) realloc(node->arms, sizeof(struct case_arm) * capacity);
+    }
+    struct case_arm *arm = &node->arms[node->arms_length++];
+    size_t patterns_capacity = 0;
+    memset(arm, 0, sizeof(struct case_arm));
+
+    if (at(p, "("))
+      p->next++;
+    for (;;) {
+      token = peek(p, &flags);
+      if (!token || (flags & TOKEN_OPERATOR)) {
+        unexpected(p);
+        goto out;
+      }
+      if (arm->patterns_length == patterns_capacity) {
+        patterns_capacity = patterns_capacity ? patterns_capacity * 2 : 2;
+        arm->patterns = (char **) realloc(arm->patterns, sizeof(char *) * patterns_capacity);
+        arm->pattern_flags = (unsigned char *) realloc(arm->pattern_flags, patterns_capacity);
+      }
+      /* A word with no pattern character outside of quotes only matches itself. In one with
+       * some, the tokenizer already escaped the quoted ones. */
+      bool literal = !(flags & (TOKEN_GLOB | TOKEN_EXPAND));
+      arm->pattern_flags[arm->patterns_length] = (unsigned char) flags;
+      arm->patterns[arm->patterns_length++] = literal ? pathglob_escape(token) : strdup(token);
+      p->next++;
+      if (!at(p, "|"))
+        break;
+      p->next++;
+    }
+    if (!expect(p, ")"))
+      goto out;
+
+    /* An arm may do nothing at all */
+    arm->body = parse_list(p, arm_stops);
+    if (p->failed)
+      goto out;
+    if (at(p, ";;"))
+      p->next++;
+  }
+  if (!p->failed)
+    p->next++;
+
+out:
+  p->depth--;
+  if (p->failed) {
+    list_free(node);
+    return NULL;
+  }
+  return node;
+}
+
+/* The redirections after the end of a compound command, up to the operator that follows it */
+static bool parse_redirects(struct parser *p, struct node *node) {
+  int flags;
+  size_t length = 0;
+
+  while (peek(p, &flags) && !(flags & TOKEN_OPERATOR)) {
+    push_word(p, &length, tokens_get_token(p->tokens, p->next), flags);
+    p->next++;
+  }
+  for (size_t i = 0; i < length;) {
+    int used = parse_redirect(&node->redirects, p->words, p->flags, i, length, p->input);
+    if (used == 0)
+      printf("syntax error near unexpected token `%s'.\n", p->words[i]);
+    if (used <= 0) {
+      p->failed = true;
+      return false;
+    }
+    if (node->redirects.list[node->redirects.length - 1].heredoc)
+      p->cacheable = false;
+    i += (size_t) used;
+  }
+  return true;
+}
+
+/* A simple command, or a compound command with its redirections */
+static struct node *parse_stage(struct parser *p) {
+  int flags;
+  const char *token = peek(p, &flags);
+  struct node *node;
+
+  if (flags & TOKEN_OPERATOR) {
+    unexpected(p);
+    return NULL;
+  }
+  if (!at_word(p, reserved))
+    return parse_pipeline(p);
+
+  if (!strcmp(token, "if")) {
+    node = parse_if(p);
+  } else if (!strcmp(token, "while")) {
+    node = parse_loop(p, NODE_WHILE);
+  } else if (!strcmp(token, "until")) {
+    node = parse_loop(p, NODE_UNTIL);
+  } else if (!strcmp(token, "for")) {
+    node = parse_for(p);
+  } else if (!strcmp(token, "case")) {
+    node = parse_case(p);
+  } else {
+    /* A word that closes something that is not open */
+    unexpected(p);
+    return NULL;
+  }
+  if (node && !parse_redirects(p, node)) {
+    list_free(node);
+    return NULL;
+  }
+  return node;
+}
+
+const char *node_text(const struct node *node) {
+  switch (node->type) {
+  case NODE_PIPELINE:
+    return node->pipeline->text;
+  case NODE_IF:
+    return "if ... fi";
+  case NODE_WHILE:
+    return "while ... done";
+  case NODE_UNTIL:
+    return "until ... done";
+  case NODE_FOR:
+    return "for ... done";
+  case NODE_CASE:
+    return "case ... esac";
+  case NODE_PIPE:
+    break;
+  }
+  return node->name;
+}
+
+/* Stages joined by |. A pipe with a compound command in it becomes a NODE_PIPE, any other
+ * pipeline was taken whole by parse_pipeline. */
+static struct node *parse_pipe(struct parser *p) {
+  struct node *stage = parse_stage(p);
+  if (!stage || !at(p, "|"))
+    return stage;
+
+  struct node *node = new_node(NODE_PIPE);
+  struct node **tail = &node->body;
+  size_t length = 0, capacity = 0;
+  for (;;) {
+    *tail = stage;
+    tail = &stage->next;
+    const char *text = node_text(stage);
+    size_t n = strlen(text);
+    if (length + n + 4 > capacity) {
+      capacity = (length + n + 4) * 2;
+      node->name = (char *) realloc(node->name, capacity);
+    }
+    if (length > 0) {
+      memcpy(node->name + length, " | ", 3);
+      length += 3;
+    }
+    memcpy(node->name + length, text, n + 1);
+    length += n;
+
+    if (!at(p, "|"))
+      return node;
+    p->next++;
+    if (!need_token(p) || !(stage = parse_stage(p))) {
+      list_free(node);
+      return NULL;
+    }
+  }
+}
+
+static struct node *parse_command(struct parser *p) {
+  if (at(p, "!")) {
+    p->next++;
+    if (!peek(p, NULL)) {
+      unexpected(p);
+      return NULL;
+    }
+    struct node *node = parse_command(p);
+    if (node)
+      node->negate = !node->negate;
+    return node;
+  }
+  return parse_pipe(p);
+}
+
+/* Commands joined by ; & && || and newlines, up to one of stops where a command would start. At
+ * the top level the list ends with the line, unless it ends in && or ||. */
+static struct node *parse_list(struct parser *p, const char *const *stops) {
+  struct node *head = NULL, **tail = &head;
+  enum connector connector = CONNECT_ALWAYS;
+
+  for (;;) {
+    if (p->depth > 0 || connector != CONNECT_ALWAYS) {
+      if (!need_token(p))
+        break;
+    } else if (!peek(p, NULL)) {
+      break;
+    }
+    if (connector == CONNECT_ALWAYS && at_word(p, stops))
+      break;
+
+    struct node *node = parse_command(p);
+    if (!node)
+      break;
+    node->connector = connector;
+    *tail = node;
+    tail = &node->next;
+
+    int flags;
+    const char *token = peek(p, &flags);
+    connector = CONNECT_ALWAYS;
+    if (!token)
+      continue;
+    if (!(flags & TOKEN_OPERATOR)) {
+      unexpected(p);
+      break;
+    }
+    if (!strcmp(token, "&&")) {
+      connector = CONNECT_AND;
+    } else if (!strcmp(token, "||")) {
+      connector = CONNECT_OR;
+    } else if (!strcmp(token, "&") && node->type == NODE_PIPELINE) {
+      node->pipeline->background = true;
+    } else if (strcmp(token, ";")) {
+      /* ;; ends an arm of case, anything else is out of place */
+      if (!at_word(p, stops))
+        unexpected(p);
+      break;
+    }
+    p->next++;
+  }
+
+  if (p->failed) {
+    list_free(head);
+    return NULL;
+  }
+  return head;
+}
+
+struct node *parse_line(struct tokens *tokens, struct reader *input,
+                        parse_whole_line_t *whole_line, bool *cacheable) {
+  struct parser p = {0};
+  p.tokens = tokens;
+  p.input = input;
+  p.whole_line = whole_line;
+  p.cacheable = true;
+
+  struct node *list = parse_list(&p, no_stops);
+  free(p.words);
+  free(p.flags);
+  *cacheable = p.cacheable;
+  return list;
+}
+
+void list_free(struct node *list) {
+  while (list) {
+    struct node *next = list->next;
+    pipeline_free(list->pipeline);
+    list_free(list->condition);
+    list_free(list->body);
+    list_free(list->otherwise);
+    free(list->name);
+    for (size_t i = 0; i < list->items_length; i++)
+      free(list->items[i]);
+    free(list->items);
+    free(list->item_flags);
+    for (size_t i = 0; i < list->arms_length; i++) {
+      for (size_t j = 0; j < list->arms[i].patterns_length; j++)
+        free(list->arms[i].patterns[j]);
+      free(list->arms[i].patterns);
+      free(list->arms[i].pattern_flags);
+      list_free(list->arms[i].body);
+    }
+    free(list->arms);
+    redirects_clear(&list->redirects);
+    free(list);
+    list = next;
+  }
+}
+
+/* FNV-1a, 64 bits */
+static uint64_t hash_line(const char *line, size_t length) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < length; i++)
+    h = (h ^ (unsigned char) line[i]) * 1099511628211ull;
+  return h;
+}
+
+struct node *parse_cache_find(const char *line, size_t length) {
+  uint64_t hash = hash_line(line, length);
+  struct cache_entry *entry = &cache[hash % PARSE_CACHE_SLOTS];
+  if (entry->list && entry->hash == hash && entry->length == length &&
+      !memcmp(entry->line, line, length))
+    return entry->list;
+  return NULL;
+}
+
+void parse_cache_add(const char *line, size_t length, struct node *list) {
+  uint64_t hash = hash_line(line, length);
+  struct cache_entry *entry = &cache[hash % PARSE_CACHE_SLOTS];
+
+  list_free(entry->list);
+  free(entry->line);
+  entry->hash = hash;
+  entry->line = (char *) malloc(length);
+  memcpy(entry->line, line, length);
+  entry->length = length;
+  entry->list = list;
+}
+
+void parse_cache_clear(void) {
+  for (size_t i = 0; i < PARSE_CACHE_SLOTS; i++) {
+    list_free(cache[i].list);
+    free(cache[i].line);
+    cache[i].list = NULL;
+    cache[i].line = NULL;
+  }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "redirect.h"
+
+struct reader;
+struct tokens;
+
+/* One command of a pipeline: its arguments and its redirections in the order they were written */
+struct command {
+  /* The words the command runs with, which are the parsed ones or, while it runs, their
+   * expansions */
+  char **args;
+
+  /* The parsed words and their TOKEN_ flags */
+  char **parsed;
+  unsigned char *flags;
+
+  /* The NAME=value words in front of the command, with their flags */
+  char **assignments;
+  unsigned char *assignment_flags;
+  size_t assignments_length;
+
+  /* Some word or redirection has to be expanded before each run */
+  bool expand;
+
+  struct redirects redirects;
+
+  /* Index of the builtin named by args[0], filled in by the shell, or -1 */
+  int builtin;
+};
+
+/* A command line parsed into the commands of its pipeline. The tree owns copies of its words, so
+ * it outlives the tokens it was built from. */
+struct pipeline {
+  struct command *commands;
+  size_t length;
+
+  /* Ends in &, so it runs in the background */
+  bool background;
+
+  /* Every word of the line, NULL terminated, for builtins that take the whole line */
+  char **words;
+  size_t words_length;
+
+  /* The words joined by spaces, for the job table */
+  char *text;
+
+  /* Whether running the line again means the same thing, which a here-document, read from the
+   * input that follows the line, does not */
+  bool cacheable;
+
+  /* Backing store of the words and of the argument lists, and of their flags */
+  char *storage;
+  char **args;
+  unsigned char *flags;
+};
+
+enum node_type {
+  NODE_PIPELINE,
+  NODE_IF,    /* if condition; then body; [elif ...;] [else otherwise;] fi */
+  NODE_WHILE, /* while condition; do body; done */
+  NODE_UNTIL, /* until condition; do body; done */
+  NODE_FOR,   /* for name in items; do body; done */
+  NODE_CASE,  /* case subject in pattern | pattern) body;; ... esac */
+  NODE_PIPE,  /* stage | stage ..., where some stage is a compound command */
+};
+
+/* How a command of a list depends on the status of the one before it */
+enum connector {
+  CONNECT_ALWAYS, /* after ;, & or a newline */
+  CONNECT_AND,    /* after && */
+  CONNECT_OR,     /* after || */
+};
+
+/* A pattern that is not expanded is kept as the pattern fnmatch gets, its quoted characters
+ * escaped, one that is is kept as written and made into a pattern each time it is matched */
+struct case_arm {
+  char **patterns;
+  unsigned char *pattern_flags;
+  size_t patterns_length;
+  struct node *body;
+};
+
+/* One command of a list, either a pipeline or a compound command whose parts are lists again.
+ * Bodies are parsed once, so every pass of a loop runs the same trees. */
+struct node {
+  enum node_type type;
+  enum connector connector;
+
+  /* Written after !, so its status is inverted */
+  bool negate;
+
+  /* NODE_PIPELINE */
+  struct pipeline *pipeline;
+
+  /* The condition and the body of if and of the loops, and the list of else. An elif is an if
+   * alone in the else list. */
+  struct node *condition;
+  struct node *body;
+  struct node *otherwise;
+
+  /* The variable and the words of for, or the subject of case in name, with their TOKEN_ flags */
+  char *name;
+  int name_flags;
+  char **items;
+  unsigned char *item_flags;
+  size_t items_length;
+
+  struct case_arm *arms;
+  size_t arms_length;
+
+  /* The redirections written after the end of a compound command, which apply to all of it */
+  struct redirects redirects;
+
+  /* The stages of NODE_PIPE are its body, linked by next, and name is its text for the job
+   * table */
+
+  /* The command that follows in the list */
+  struct node *next;
+};
+
+/* Tells whether the builtin of that name takes its whole line itself */
+typedef bool parse_whole_line_t(const char *name);
+
+/* Parse the words of a line into a pipeline. Words whose TOKEN_ flags say they are not operators
+ * never split it; flags may be NULL when every word is plain. The bodies of here-documents are read
+ * from input, which may be NULL. With whole_line the line is one command taking every word as an
+ * argument, for builtins that split it up themselves. Returns NULL after reporting a syntax
+ * error. */
+struct pipeline *parse_words(char **words, const unsigned char *flags, size_t length,
+                             struct reader *input, bool whole_line);
+
+void pipeline_free(struct pipeline *pipeline);
+
+/* Parse the tokenized line into a list of commands. A compound command left open at the end of the
+ * line goes on with the lines that follow in input, which also has the bodies of here-documents.
+ * A command named as whole_line takes the words up to the end of its list. *cacheable tells
+ * whether the list came from the line alone and can be run again for the same text. Returns NULL
+ * for an empty line, or after reporting a syntax error. */
+struct node *parse_line(struct tokens *tokens, struct reader *input,
+                        parse_whole_line_t *whole_line, bool *cacheable);
+
+void list_free(struct node *list);
+
+/* The text a node shows as in the job table: the words of a pipeline, or the first and last word
+ * of a compound command */
+const char *node_text(const struct node *node);
+
+/* The cached list of a line that was parsed before, or NULL. The tree belongs to the cache. */
+struct node *parse_cache_find(const char *line, size_t length);
+
+/* Keep the list for later runs of the same line, which must not be cached yet. The cache owns the
+ * tree afterwards, and may free it on any later call to parse_cache_add. */
+void parse_cache_add(const char *line, size_t length, struct node *list);
+
+/* Drop every cached list */
+void parse_cache_clear(void);
@@ -0,0 +1,396 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "pathglob.h"
+
+/* Size of the buffer getdents64 fills, enough for a few thousand entries per call */
+#define DENTS_BUFFER (256 * 1024)
+
+/* A record of getdents64 */
+struct dirent64_record {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/* The names of a directory, packed one after the other, and the identity and modification time
+ * it had when it was read */
+struct listing {
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  char *names;
+  size_t names_length;
+  size_t names_capacity;
+  size_t *offsets;
+  unsigned char *types;
+  size_t length;
+  size_t capacity;
+  struct listing *next;
+};
+
+/* Listings of the current command line, newest first. One that went stale stays behind the new
+ * one until the cache is cleared, since an expansion may still be walking it. */
+static struct listing *listings;
+
+static char *dents;
+
+struct path {
+  char *data;
+  size_t length;
+  size_t capacity;
+};
+
+struct matches {
+  char **list;
+  size_t length;
+  size_t capacity;
+};
+
+static void path_append(struct path *path, const char *text, size_t n) {
+  if (path->length + n + 1 > path->capacity) {
+    path->capacity = (path->length + n + 1) * 2;
+    path->data = (char *) realloc(path->data, path->capacity);
+  }
+  memcpy(path->data + path->length, text, n);
+  path->length += n;
+  path->data[path->length] = '\0';
+}
+
+static void path_truncate(struct path *path, size_t length) {
+  path->length = length;
+  path->data[length] = '\0';
+}
+
+static void push_match(struct matches *matches, const char *path) {
+  if (matches->length + 1 >= matches->capacity) {
+    matches->capacity = matches->capacity ? matches->capacity * 2 : 16;
+    matches->list = (char **) realloc(matches->list, sizeof(char *) * matches->capacity);
+  }
+  matches->list[matches->length++] = strdup(path);
+}
+
+static void add_name(struct listing *listing, const char *name, unsigned char type) {
+  size_t length = strlen(name) + 1;
+  if (listing->names_length + length > listing->names_capacity) {
+    listing->names_capacity = (listing->names_length + length) * 2;
+    listing->names = (char *) realloc(listing->names, listing->names_capacity);
+  }
+  if (listing->length == listing->capacity) {
+    listing->capacity = listing->capacity ? listing->capacity * 2 : 64;
+    listing->offsets = (size_t *) realloc(listing->offsets, sizeof(size_t) * listing->capacity);
+    listing->types = (unsigned char *) realloc(listing->types, listing->capacity);
+  }
+  memcpy(listing->names + listing->names_length, name, length);
+  listing->offsets[listing->length] = listing->names_length;
+  listing->types[listing->length++] = type;
+  listing->names_length += length;
+}
+
+static bool same_directory(const struct listing *listing, const struct stat *st) {
+  return listing->dev == st->st_dev && listing->ino == st->st_ino &&
+         listing->mtime.tv_sec == st->st_mtim.tv_sec &&
+         listing->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* The listing of the directory, read with getdents64 unless the cache has it as it is now */
+static struct listing *get_listing(const char *path) {
+  struct stat st;
+
+  for (struct listing *listing = listings; listing; listing = listing->next) {
+    if (strcmp(listing->path, path))
+      continue;
+    if (stat(path, &st) == 0 && same_directory(listing, &st))
+      return listing;
+    break;
+  }
+
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  struct listing *listing = (struct listing *) calloc(1, sizeof(struct listing));
+  listing->path = strdup(path);
+  listing->dev = st.st_dev;
+  listing->ino = st.st_ino;
+  listing->mtime = st.st_mtim;
+
+  if (!dents)
+    dents = (char *) malloc(DENTS_BUFFER);
+  long got;
+  while ((got = syscall(SYS_getdents64, fd, dents, DENTS_BUFFER)) > 0) {
+    for (long offset = 0; offset < got;) {
+      struct dirent64_record *record = (struct dirent64_record *) (dents + offset);
+      offset += record->d_reclen;
+      const char *name = record->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+      add_name(listing, name, record->d_type);
+    }
+  }
+  close(fd);
+
+  listing->next = listings;
+  listings = listing;
+  return listing;
+}
+
+void pathglob_cache_clear(void) {
+  while (listings) {
+    struct listing *next = listings->next;
+    free(listings->path);
+    free(listings->names);
+    free(listings->offsets);
+    free(listings->types);
+    free(listings);
+    listings = next;
+  }
+}
+
+/* Match the set at *p, which starts with [, against c and move *p past it. Returns -1 if there is
+ * no ] to close the set, in which case the [ is an ordinary character. */
+static int match_set(const char **p, const char *end, unsigned char c) {
+  const char *q = *p + 1;
+  bool negate = q < end && (*q == '!' || *q == '^');
+  bool matched = false;
+
+  if (negate)
+    q++;
+  /* A ] right at the start is part of the set */
+  for (bool first = true; q < end && (*q != ']' || first); first = false) {
+    if (*q == '\\' && q + 1 < end)
+      q++;
+    unsigned char low = (unsigned char) *q++, high = low;
+    if (q + 1 < end && *q == '-' && q[1] != ']') {
+      q++;
+      if (*q == '\\' && q + 1 < end)
+        q++;
+      high = (unsigned char) *q++;
+    }
+    matched |= low <= c && c <= high;
+  }
+  if (q >= end)
+    return -1;
+  *p = q + 1;
+  return matched != negate;
+}
+
+/* Bytes of the UTF-8 character starting at s, so that ? matches a character and not a byte */
+static size_t char_length(const char *s) {
+  size_t n = 1;
+  while (((unsigned char) s[n] & 0xc0) == 0x80)
+    n++;
+  return n;
+}
+
+/* Whether the name matches the pattern p[0..end). A * only ever backs up to the position after
+ * the last one seen, so a name is matched in O(name * pattern) and never exponentially. */
+static bool match(const char *p, const char *end, const char *name) {
+  const char *star = NULL, *resume = NULL;
+  const char *s = name;
+
+  while (*s) {
+    if (p < end && *p == '*') {
+      while (p < end && *p == '*')
+        p++;
+      if (p == end)
+        return true;
+      star = p;
+      resume = s;
+      continue;
+    }
+
+    const char *next = p + 1;
+    size_t width = 1;
+    bool matched = false;
+    if (p < end) {
+      if (*p == '?') {
+        matched = true;
+        width = char_length(s);
+      } else if (*p == '[') {
+        next = p;
+        int set = match_set(&next, end, (unsigned char) *s);
+        matched = set < 0 ? *s == '[' : set;
+      } else if (*p == '\\' && p + 1 < end) {
+        matched = p[1] == *s;
+        next = p + 2;
+      } else {
+        matched = *p == *s;
+      }
+    }
+    if (matched) {
+      p = next;
+      s += width;
+    } else if (star) {
+      p = star;
+      s = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (p < end && *p == '*')
+    p++;
+  return p == end;
+}
+
+static bool has_pattern(const char *p, const char *end) {
+  for (; p < end; p++) {
+    if (*p == '\\' && p + 1 < end)
+      p++;
+    else if (*p == '*' || *p == '?' || *p == '[')
+      return true;
+  }
+  return false;
+}
+
+/* Append the component p[0..end) to the path without its backslashes */
+static void append_literal(struct path *path, const char *p, const char *end) {
+  for (; p < end; p++) {
+    if (*p == '\\' && p + 1 < end)
+      p++;
+    path_append(path, p, 1);
+  }
+}
+
+/* Whether the entry is a directory. Symbolic links are followed unless nofollow is set. */
+static bool is_directory(const struct path *path, unsigned char type, bool nofollow) {
+  struct stat st;
+  if (type == DT_DIR)
+    return true;
+  if (type != DT_UNKNOWN && (type != DT_LNK || nofollow))
+    return false;
+  if ((nofollow ? lstat(path->data, &st) : stat(path->data, &st)) == -1)
+    return false;
+  return S_ISDIR(st.st_mode);
+}
+
+/* Add the paths below the path that match the components from p on */
+static void walk(struct path *path, const char *p, struct matches *matches) {
+  const char *slash = strchr(p, '/');
+  const char *end = slash ? slash : p + strlen(p);
+  /* NULL after the last component, empty after a trailing slash, which only directories match */
+  const char *rest = slash;
+  while (rest && *rest == '/')
+    rest++;
+  size_t mark = path->length;
+
+  if (!has_pattern(p, end)) {
+    struct stat st;
+    append_literal(path, p, end);
+    if (!rest) {
+      if (lstat(path->data, &st) == 0)
+        push_match(matches, path->data);
+    } else if (!*rest) {
+      if (stat(path->data, &st) == 0 && S_ISDIR(st.st_mode)) {
+        path_append(path, "/", 1);
+        push_match(matches, path->data);
+      }
+    } else {
+      path_append(path, "/", 1);
+      walk(path, rest, matches);
+    }
+    path_truncate(path, mark);
+    return;
+  }
+
+  struct listing *listing = get_listing(mark ? path->data : ".");
+  if (!listing)
+    return;
+
+  if (end - p == 2 && p[0] == '*' && p[1] == '*' && rest && *rest) {
+    /* ** is this directory and every one below it, without following links */
+    walk(path, rest, matches);
+    for (size_t i = 0; i < listing->length; i++) {
+      const char *name = listing->names + listing->offsets[i];
+      if (name[0] == '.')
+        continue;
+      path_append(path, name, strlen(name));
+      if (is_directory(path, listing->types[i], true)) {
+        path_append(path, "/", 1);
+        walk(path, p, matches);
+      }
+      path_truncate(path, mark);
+    }
+    return;
+  }
+
+  /* Hidden names only match a pattern that starts with a dot */
+  bool dots = p[0] == '.' || (p[0] == '\\' && p[1] == '.');
+  for (size_t i = 0; i < listing->length; i++) {
+    const char *name = listing->names + listing->offsets[i];
+    if ((name[0] == '.' && !dots) || !match(p, end, name))
+      continue;
+    path_append(path, name, strlen(name));
+    if (!rest) {
+      push_match(matches, path->data);
+    } else if (is_directory(path, listing->types[i], false)) {
+      path_append(path, "/", 1);
+      if (*rest)
+        walk(path, rest, matches);
+      else
+        push_match(matches, path->data);
+    }
+    path_truncate(path, mark);
+  }
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+char **pathglob_expand(const char *pattern) {
+  struct path path = {NULL, 0, 0};
+  struct matches matches = {NULL, 0, 0};
+
+  path_append(&path, "", 0);
+  if (*pattern == '/') {
+    path_append(&path, "/", 1);
+    while (*pattern == '/')
+      pattern++;
+  }
+  walk(&path, pattern, &matches);
+  free(path.data);
+
+  if (matches.length == 0) {
+    free(matches.list);
+    return NULL;
+  }
+  qsort(matches.list, matches.length, sizeof(char *), compare_paths);
+  matches.list[matches.length] = NULL;
+  return matches.list;
+}
+
+void pathglob_unescape(char *word) {
+  char *to = word;
+  for (const char *from = word; *from; from++) {
+    if (*from == '\\' && from[1])
+      from++;
+    *to++ = *from;
+  }
+  *to = '\0';
+}
+
+char *pathglob_escape(const char *word) {
+  char *escaped = (char *) malloc(2 * strlen(word) + 1), *to = escaped;
+  for (const char *from = word; *from; from++) {
+    if (*from == '*' || *from == '?' || *from == '[' || *from == '\\')
+      *to++ = '\\';
+    *to++ = *from;
+  }
+  *to = '\0';
+  return escaped;
+}
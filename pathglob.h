@@ -0,0 +1,20 @@
+#pragma once
+
+/* Pathname expansion of the words the tokenizer marked TOKEN_GLOB: * and ? within a name, [...]
+ * sets, and ** for any number of directories. A backslash makes the character after it literal.
+ * Names starting with a dot only match a pattern that starts with one too. */
+
+/* The paths that match the pattern, sorted, in a NULL terminated array the caller frees with
+ * free_words. Returns NULL if nothing matches. */
+char **pathglob_expand(const char *pattern);
+
+/* Remove the backslashes of a pattern, for a word that is used as it is */
+void pathglob_unescape(char *word);
+
+/* A pattern that only matches the word itself, with a backslash before every pattern character
+ * and backslash in it. The caller frees it. */
+char *pathglob_escape(const char *word);
+
+/* Forget the directory listings read so far. Listings are kept until the next command line, and
+ * only used again while the directory has not changed. */
+void pathglob_cache_clear(void);
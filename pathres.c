@@ -0,0 +1,354 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pathres.h"
+#include "trie.h"
+
+#define PATHRES_BUCKETS 64
+
+/* Used when PATH is not set at all */
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+/* One directory of PATH and the modification time it had when it was searched. The programs in
+ * it are only listed for completion, and listed again once the directory changes. */
+struct path_dir {
+  char *path;
+  struct timespec mtime;
+  bool stated;
+  char **programs;
+  size_t programs_length;
+  struct timespec listed_mtime;
+  bool listed;
+};
+
+/* A command name resolved to the directory it was found in */
+struct path_entry {
+  char *name;
+  char *path;
+  size_t dir;
+  unsigned int hits;
+  struct path_entry *next;
+};
+
+/* The PATH string the directory list was built from */
+static char *cached_path;
+
+static struct path_dir *dirs;
+static size_t dirs_length;
+
+static struct path_entry *buckets[PATHRES_BUCKETS];
+
+/* The programs of every listed directory, for completion */
+static struct trie *programs;
+
+/* FNV-1a */
+static unsigned int hash_name(const char *name) {
+  unsigned int h = 2166136261u;
+  for (; *name; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h % PATHRES_BUCKETS;
+}
+
+static void free_entries(void) {
+  for (int i = 0; i < PATHRES_BUCKETS; i++) {
+    struct path_entry *e = buckets[i];
+    while (e) {
+      struct path_entry *next = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+      e = next;
+    }
+    buckets[i] = NULL;
+  }
+}
+
+/* Drop every entry found in the given directory */
+static void free_dir_entries(size_t dir) {
+  for (int i = 0; i < PATHRES_BUCKETS; i++) {
+    struct path_entry **link = &buckets[i];
+    while (*link) {
+      struct path_entry *e = *link;
+      if (e->dir == dir) {
+        *link = e->next;
+        free(e->name);
+        free(e->path);
+        free(e);
+      } else {
+        link = &e->next;
+      }
+    }
+  }
+}
+
+/* Take the listing of the directory out of the program trie */
+static void free_listing(struct path_dir *dir) {
+  for (size_t i = 0; i < dir->programs_length; i++) {
+    trie_remove(programs, dir->programs[i]);
+    free(dir->programs[i]);
+  }
+  free(dir->programs);
+  dir->programs = NULL;
+  dir->programs_length = 0;
+  dir->listed = false;
+}
+
+static void free_dirs(void) {
+  for (size_t i = 0; i < dirs_length; i++) {
+    free(dirs[i].path);
+    for (size_t k = 0; k < dirs[i].programs_length; k++)
+      free(dirs[i].programs[k]);
+    free(dirs[i].programs);
+  }
+  trie_destroy(programs);
+  programs = NULL;
+  free(dirs);
+  dirs = NULL;
+  dirs_length = 0;
+  free(cached_path);
+  cached_path = NULL;
+}
+
+void pathres_set_path(const char *envpath) {
+  if (!envpath)
+    envpath = DEFAULT_PATH;
+  if (cached_path && !strcmp(cached_path, envpath))
+    return;
+
+  free_entries();
+  free_dirs();
+  cached_path = strdup(envpath);
+
+  size_t n = 1;
+  for (const char *p = envpath; *p; p++)
+    if (*p == ':')
+      n++;
+  dirs = (struct path_dir *)calloc(n, sizeof(struct path_dir));
+
+  const char *p = envpath;
+  for (;;) {
+    const char *colon = strchr(p, ':');
+    size_t len = colon ? (size_t)(colon - p) : strlen(p);
+    /* An empty entry means the current directory */
+    dirs[dirs_length++].path = len ? strndup(p, len) : strdup(".");
+    if (!colon)
+      break;
+    p = colon + 1;
+  }
+}
+
+/* Whether the directory still has the modification time it was searched with */
+static bool dir_unchanged(struct path_dir *dir) {
+  struct stat st;
+  if (stat(dir->path, &st) == -1)
+    return false;
+  return st.st_mtim.tv_sec == dir->mtime.tv_sec && st.st_mtim.tv_nsec == dir->mtime.tv_nsec;
+}
+
+static bool is_executable(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+/* Search the PATH directories in order and cache the first match */
+static struct path_entry *resolve(const char *name, unsigned int bucket) {
+  size_t name_len = strlen(name);
+
+  for (size_t i = 0; i < dirs_length; i++) {
+    struct path_dir *dir = &dirs[i];
+    if (!dir->stated) {
+      struct stat st;
+      if (stat(dir->path, &st) == -1 || !S_ISDIR(st.st_mode))
+        continue;
+      dir->mtime = st.st_mtim;
+      dir->stated = true;
+    }
+
+    size_t dir_len = strlen(dir->path);
+    char *candidate = (char *)malloc(dir_len + name_len + 2);
+    memcpy(candidate, dir->path, dir_len);
+    candidate[dir_len] = '/';
+    memcpy(candidate + dir_len + 1, name, name_len + 1);
+
+    if (is_executable(candidate)) {
+      struct path_entry *e = (struct path_entry *)malloc(sizeof(struct path_entry));
+      e->name = strdup(name);
+      e->path = candidate;
+      e->dir = i;
+      e->hits = 0;
+      e->next = buckets[bucket];
+      buckets[bucket] = e;
+      return e;
+    }
+    free(candidate);
+  }
+  return NULL;
+}
+
+const char *pathres_lookup(const char *name) {
+  if (!name || !*name)
+    return NULL;
+  if (strchr(name, '/'))
+    return name;
+
+  /* Until the shell says what PATH is, it is the one of the environment */
+  if (!cached_path)
+    pathres_set_path(getenv("PATH"));
+  unsigned int bucket = hash_name(name);
+
+  for (struct path_entry *e = buckets[bucket]; e; e = e->next) {
+    if (strcmp(e->name, name))
+      continue;
+    if (dir_unchanged(&dirs[e->dir])) {
+      e->hits++;
+      return e->path;
+    }
+    /* The directory was modified, so nothing cached from it can be trusted */
+    dirs[e->dir].stated = false;
+    free_dir_entries(e->dir);
+    break;
+  }
+
+  struct path_entry *e = resolve(name, bucket);
+  if (e) {
+    e->hits++;
+    return e->path;
+  }
+
+  /* Fall back to a program of that name in the current directory */
+  if (is_executable(name))
+    return name;
+  return NULL;
+}
+
+void pathres_reset(void) {
+  /* The directories are listed again for the PATH the cache was for, which the shell may have
+   * changed since it started */
+  char *path = cached_path;
+  cached_path = NULL;
+  free_entries();
+  free_dirs();
+  if (path) {
+    pathres_set_path(path);
+    free(path);
+  }
+}
+
+void pathres_visit_cached(pathres_cached_t *visit, void *data) {
+  for (int i = 0; i < PATHRES_BUCKETS; i++)
+    for (struct path_entry *e = buckets[i]; e; e = e->next)
+      visit(cached_path, e->name, e->dir, &dirs[e->dir].mtime, data);
+}
+
+void pathres_restore(const char *path, const char *name, size_t dir, const struct timespec *mtime) {
+  if (!cached_path)
+    pathres_set_path(getenv("PATH"));
+  if (strcmp(cached_path, path) || dir >= dirs_length || strchr(name, '/'))
+    return;
+  struct path_dir *d = &dirs[dir];
+  /* A directory looked at since has the say over what the snapshot remembers of it */
+  if (d->stated && (d->mtime.tv_sec != mtime->tv_sec || d->mtime.tv_nsec != mtime->tv_nsec))
+    return;
+  unsigned int bucket = hash_name(name);
+  for (struct path_entry *e = buckets[bucket]; e; e = e->next)
+    if (!strcmp(e->name, name))
+      return;
+
+  d->mtime = *mtime;
+  d->stated = true;
+  size_t dir_len = strlen(d->path), name_len = strlen(name);
+  struct path_entry *e = (struct path_entry *)malloc(sizeof(struct path_entry));
+  e->name = strdup(name);
+  e->path = (char *)malloc(dir_len + name_len + 2);
+  memcpy(e->path, d->path, dir_len);
+  e->path[dir_len] = '/';
+  memcpy(e->path + dir_len + 1, name, name_len + 1);
+  e->dir = dir;
+  e->hits = 0;
+  e->next = buckets[bucket];
+  buckets[bucket] = e;
+}
+
+void pathres_print(FILE *out) {
+  bool empty = true;
+  for (int i = 0; i < PATHRES_BUCKETS; i++) {
+    for (struct path_entry *e = buckets[i]; e; e = e->next) {
+      if (empty)
+        fprintf(out, "hits\tcommand\n");
+      fprintf(out, "%4u\t%s\n", e->hits, e->path);
+      empty = false;
+    }
+  }
+  if (empty)
+    fprintf(out, "hash: hash table empty\n");
+}
+
+/* List the executables of the directory into the program trie */
+static void list_dir(struct path_dir *dir, const struct stat *st) {
+  size_t capacity = 0;
+  int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  DIR *stream = fd == -1 ? NULL : fdopendir(fd);
+
+  dir->listed = true;
+  dir->listed_mtime = st->st_mtim;
+  if (!stream) {
+    if (fd != -1)
+      close(fd);
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(stream))) {
+    if (entry->d_name[0] == '.')
+      continue;
+    /* Directories and other files the type already rules out are never stated */
+    if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)
+      continue;
+    struct stat entry_st;
+    if (fstatat(fd, entry->d_name, &entry_st, 0) == -1 || !S_ISREG(entry_st.st_mode) ||
+        faccessat(fd, entry->d_name, X_OK, 0) == -1)
+      continue;
+
+    if (dir->programs_length == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      dir->programs = (char **) realloc(dir->programs, sizeof(char *) * capacity);
+    }
+    dir->programs[dir->programs_length++] = strdup(entry->d_name);
+    trie_add(programs, entry->d_name);
+  }
+  closedir(stream);
+}
+
+void pathres_complete(const char *prefix, size_t length, pathres_visit_t *visit, void *data) {
+  if (!cached_path)
+    pathres_set_path(getenv("PATH"));
+  if (!programs)
+    programs = trie_create();
+
+  /* One stat per directory tells which listings are still good; only the changed ones are read */
+  for (size_t i = 0; i < dirs_length; i++) {
+    struct path_dir *dir = &dirs[i];
+    struct stat st;
+    if (stat(dir->path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+      if (dir->listed)
+        free_listing(dir);
+      continue;
+    }
+    if (dir->listed && st.st_mtim.tv_sec == dir->listed_mtime.tv_sec &&
+        st.st_mtim.tv_nsec == dir->listed_mtime.tv_nsec)
+      continue;
+    if (dir->listed) {
+      /* What was resolved from the directory is just as stale as its listing */
+      free_listing(dir);
+      dir->stated = false;
+      free_dir_entries(i);
+    }
+    list_dir(dir, &st);
+  }
+
+  trie_walk(programs, prefix, length, visit, data);
+}
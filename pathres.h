@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Resolves a command name to the path that should be passed to execv, or NULL if there is none.
+ * Names containing a slash are returned unchanged. Results are cached until PATH changes or the
+ * directory a command was found in is modified. The returned string belongs to the cache. */
+const char *pathres_lookup(const char *name);
+
+/* Tell the cache that PATH changed to the given value, or was unset for NULL. The directory list
+ * is only rebuilt if the value differs from the one it was built for. */
+void pathres_set_path(const char *path);
+
+/* Call visit with every program in PATH whose name starts with the prefix, in byte order. The
+ * directories are listed into a trie once and only listed again after they were modified, which
+ * also drops what was resolved from them. */
+typedef void pathres_visit_t(const char *name, void *data);
+void pathres_complete(const char *prefix, size_t length, pathres_visit_t *visit, void *data);
+
+/* Forget every cached resolution and what is known about the directories, keeping the PATH */
+void pathres_reset(void);
+
+/* Call visit with every cached resolution: the PATH the cache is for, the name, the index in PATH
+ * of the directory it was found in and the modification time that directory had */
+typedef void pathres_cached_t(const char *path, const char *name, size_t dir,
+                              const struct timespec *mtime, void *data);
+void pathres_visit_cached(pathres_cached_t *visit, void *data);
+
+/* Put back a resolution given to pathres_visit_cached, unless the cache is for another PATH now.
+ * Like any other, it is dropped on its first use if the directory was modified since. */
+void pathres_restore(const char *path, const char *name, size_t dir, const struct timespec *mtime);
+
+/* Print the cached commands and how often each was used */
+void pathres_print(FILE *out);
@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "reader.h"
+
+#define READER_BUFSIZE 65536
+
+/* Bytes between start and end of buffer have been read but not returned yet. A line that is
+ * entirely inside the buffer is returned in place; only a line that spans reads is assembled in
+ * the growable line buffer. */
+struct reader {
+  int fd;
+  char *buffer;
+  size_t start;
+  size_t end;
+  char *line;
+  size_t line_capacity;
+  int eof;
+  int owns_buffer;
+  reader_source_t *source;
+  char *prompt;
+};
+
+struct reader *reader_open(int fd) {
+  struct reader *reader = (struct reader *) calloc(1, sizeof(struct reader));
+  reader->fd = fd;
+  reader->buffer = (char *) malloc(READER_BUFSIZE);
+  reader->owns_buffer = 1;
+  return reader;
+}
+
+struct reader *reader_open_buffer(const char *data, size_t length) {
+  struct reader *reader = (struct reader *) calloc(1, sizeof(struct reader));
+  reader->fd = -1;
+  /* The buffer is never written to, it only holds the whole input at once */
+  reader->buffer = (char *) data;
+  reader->end = length;
+  reader->eof = 1;
+  return reader;
+}
+
+struct reader *reader_open_source(reader_source_t *source) {
+  struct reader *reader = (struct reader *) calloc(1, sizeof(struct reader));
+  reader->fd = -1;
+  reader->source = source;
+  return reader;
+}
+
+void reader_prompt(struct reader *reader, const char *prompt) {
+  if (!reader->source)
+    return;
+  free(reader->prompt);
+  reader->prompt = strdup(prompt);
+}
+
+/* Refill the buffer. Returns the number of new bytes, 0 at end of input. */
+static ssize_t fill(struct reader *reader) {
+  reader->start = reader->end = 0;
+  if (reader->eof)
+    return 0;
+
+  ssize_t n;
+  do {
+    n = read(reader->fd, reader->buffer, READER_BUFSIZE);
+  } while (n == -1 && errno == EINTR);
+
+  if (n <= 0) {
+    reader->eof = 1;
+    return 0;
+  }
+  reader->end = (size_t) n;
+  return n;
+}
+
+/* Append bytes to the line being assembled */
+static void append(struct reader *reader, size_t *length, const char *data, size_t n) {
+  if (*length + n > reader->line_capacity) {
+    size_t capacity = reader->line_capacity ? reader->line_capacity : 256;
+    while (capacity < *length + n)
+      capacity *= 2;
+    reader->line = (char *) realloc(reader->line, capacity);
+    reader->line_capacity = capacity;
+  }
+  memcpy(reader->line + *length, data, n);
+  *length += n;
+}
+
+ssize_t reader_getline(struct reader *reader, const char **line) {
+  size_t length = 0;
+
+  if (reader->source) {
+    /* A prompt is good for one line */
+    ssize_t n = reader->source(reader->prompt ? reader->prompt : "", line);
+    free(reader->prompt);
+    reader->prompt = NULL;
+    return n;
+  }
+
+  if (reader->start == reader->end && fill(reader) == 0)
+    return -1;
+
+  /* Fast path: the whole line is already buffered */
+  char *data = reader->buffer + reader->start;
+  char *newline = memchr(data, '\n', reader->end - reader->start);
+  if (newline) {
+    size_t n = (size_t) (newline - data) + 1;
+    reader->start += n;
+    *line = data;
+    return (ssize_t) n;
+  }
+
+  /* The line continues past the buffer, so assemble it across reads */
+  for (;;) {
+    data = reader->buffer + reader->start;
+    newline = memchr(data, '\n', reader->end - reader->start);
+    size_t n = newline ? (size_t) (newline - data) + 1 : reader->end - reader->start;
+    append(reader, &length, data, n);
+    reader->start += n;
+    if (newline || fill(reader) == 0)
+      break;
+  }
+
+  *line = reader->line;
+  return (ssize_t) length;
+}
+
+void reader_close(struct reader *reader) {
+  if (reader == NULL)
+    return;
+  if (reader->owns_buffer)
+    free(reader->buffer);
+  free(reader->line);
+  free(reader->prompt);
+  free(reader);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <sys/types.h>
+
+/* A buffered reader that splits a file descriptor into lines of any length. */
+struct reader;
+
+/* Read lines from fd. The descriptor is not closed by reader_close. */
+struct reader *reader_open(int fd);
+
+/* Read lines from memory that holds the whole input, such as a mapped script. The memory is not
+ * copied, so it has to outlive the reader. */
+struct reader *reader_open_buffer(const char *data, size_t length);
+
+/* Where a reader opened with reader_open_source gets its lines from. Returns the length of the
+ * next line, including its newline, or -1 at end of input, after showing the prompt. */
+typedef ssize_t reader_source_t(const char *prompt, const char **line);
+
+/* Read lines from a source such as a line editor */
+struct reader *reader_open_source(reader_source_t *source);
+
+/* Ask for the next line with the prompt. Only a source shows it, other readers have nobody to
+ * show it to. */
+void reader_prompt(struct reader *reader, const char *prompt);
+
+/* Get the next line, including its newline if it had one. Stores the start of the line in *line
+ * and returns its length, or returns -1 at end of input. The line is not NUL-terminated and stays
+ * valid until the next call. */
+ssize_t reader_getline(struct reader *reader, const char **line);
+
+/* Free the memory */
+void reader_close(struct reader *reader);
@@ -0,0 +1,493 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "expand.h"
+#include "reader.h"
+#include "redirect.h"
+#include "tokenizer.h"
+#include "uring.h"
+
+/* Descriptors the shell keeps its own copies in while a builtin runs redirected, out of the way
+ * of the ones a command line names */
+#define SAVED_FD_MIN 100
+
+/* Marks a redirection whose descriptor was already saved by an earlier one */
+#define SAVED_EARLIER -2
+
+/* Text up to this size can go through a pipe without the shell blocking on it */
+#define PIPE_DATA_MAX 65536
+
+enum operator_kind { KIND_FILE, KIND_STRING, KIND_HEREDOC, KIND_HEREDOC_TABS };
+
+/* Longest operator first, so that a prefix never shadows it */
+static const struct {
+  const char *text;
+  enum redirect_op op;
+  int fd;
+  enum operator_kind kind;
+} operators[] = {
+  {"<<<", REDIRECT_DATA, 0, KIND_STRING},
+  {"<<-", REDIRECT_DATA, 0, KIND_HEREDOC_TABS},
+  {"<<", REDIRECT_DATA, 0, KIND_HEREDOC},
+  {"<>", REDIRECT_READWRITE, 0, KIND_FILE},
+  {"<&", REDIRECT_DUP, 0, KIND_FILE},
+  {"<", REDIRECT_INPUT, 0, KIND_FILE},
+  {">>", REDIRECT_APPEND, 1, KIND_FILE},
+  {">&", REDIRECT_DUP, 1, KIND_FILE},
+  {">|", REDIRECT_OUTPUT, 1, KIND_FILE},
+  {">", REDIRECT_OUTPUT, 1, KIND_FILE},
+};
+
+static struct redirect *push(struct redirects *redirects) {
+  if (redirects->length == redirects->capacity) {
+    redirects->capacity = redirects->capacity ? redirects->capacity * 2 : 4;
+    redirects->list = (struct redirect *) realloc(redirects->list,
+                                                  sizeof(struct redirect) * redirects->capacity);
+  }
+  struct redirect *redirect = &redirects->list[redirects->length++];
+  memset(redirect, 0, sizeof(struct redirect));
+  redirect->source = -1;
+  redirect->opened = -1;
+  return redirect;
+}
+
+static void append(char **data, size_t *length, size_t *capacity, const char *text, size_t n) {
+  if (*length + n + 1 > *capacity) {
+    *capacity = (*length + n + 1) * 2;
+    *data = (char *) realloc(*data, *capacity);
+  }
+  memcpy(*data + *length, text, n);
+  *length += n;
+  (*data)[*length] = '\0';
+}
+
+/* Read the lines of a here-document up to the one holding only the delimiter */
+static void read_heredoc(struct redirect *redirect, const char *delimiter, bool strip_tabs,
+                         struct reader *input) {
+  size_t delimiter_length = strlen(delimiter), capacity = 0;
+  const char *line;
+  ssize_t n;
+
+  redirect->target = NULL;
+  redirect->target_length = 0;
+  append(&redirect->target, &redirect->target_length, &capacity, "", 0);
+
+  while (input) {
+    reader_prompt(input, "> ");
+    if ((n = reader_getline(input, &line)) == -1)
+      break;
+    size_t text = (size_t) n;
+    if (strip_tabs) {
+      while (text > 0 && *line == '\t') {
+        line++;
+        text--;
+      }
+    }
+    size_t content = text > 0 && line[text - 1] == '\n' ? text - 1 : text;
+    if (content == delimiter_length && !memcmp(line, delimiter, content))
+      return;
+    append(&redirect->target, &redirect->target_length, &capacity, line, content);
+    append(&redirect->target, &redirect->target_length, &capacity, "\n", 1);
+  }
+  printf("warning: here-document delimited by end-of-file (wanted `%s').\n", delimiter);
+}
+
+int redirect_parse(struct redirects *redirects, char **words, size_t i, size_t length,
+                   struct reader *input) {
+  const char *word = words[i];
+  const char *p = word;
+  int fd = -1;
+
+  if (isdigit((unsigned char) *p)) {
+    fd = 0;
+    while (isdigit((unsigned char) *p) && fd < 1000000)
+      fd = fd * 10 + (*p++ - '0');
+  }
+
+  size_t k = 0, count = sizeof(operators) / sizeof(operators[0]);
+  for (; k < count; k++)
+    if (!strncmp(p, operators[k].text, strlen(operators[k].text)))
+      break;
+  if (k == count)
+    return 0;
+
+  /* The target is either glued to the operator or the next word */
+  const char *target = p + strlen(operators[k].text);
+  int used = 1;
+  if (*target == '\0') {
+    if (i + 1 >= length || !strcmp(words[i + 1], "|")) {
+      printf("syntax error near unexpected token `%s'.\n", i + 1 < length ? "|" : "newline");
+      return -1;
+    }
+    target = words[i + 1];
+    used = 2;
+  }
+
+  struct redirect *redirect = push(redirects);
+  redirect->op = operators[k].op;
+  redirect->fd = fd >= 0 ? fd : operators[k].fd;
+
+  switch (operators[k].kind) {
+  case KIND_FILE:
+    if (redirect->op == REDIRECT_DUP) {
+      /* The target of a duplication is a descriptor or -, never a file */
+      if (!strcmp(target, "-")) {
+        redirect->op = REDIRECT_CLOSE;
+      } else if (*target && strspn(target, "0123456789") == strlen(target)) {
+        redirect->source = atoi(target);
+      } else {
+        printf("%s: ambiguous redirect.\n", target);
+        redirects->length--;
+        return -1;
+      }
+    }
+    redirect->target = strdup(target);
+    redirect->target_length = strlen(target);
+    break;
+  case KIND_STRING: {
+    size_t capacity = 0;
+    redirect->target = NULL;
+    redirect->target_length = 0;
+    append(&redirect->target, &redirect->target_length, &capacity, target, strlen(target));
+    append(&redirect->target, &redirect->target_length, &capacity, "\n", 1);
+    break;
+  }
+  case KIND_HEREDOC:
+  case KIND_HEREDOC_TABS:
+    redirect->heredoc = true;
+    read_heredoc(redirect, target, operators[k].kind == KIND_HEREDOC_TABS, input);
+    break;
+  }
+  return used;
+}
+
+/* The ) that closes the ( at from[i], skipping what is quoted or nested in between, or length if
+ * there is none */
+static size_t substitution_end(const char *from, size_t length, size_t i) {
+  int depth = 0;
+  for (; i < length; i++) {
+    char c = from[i];
+    if (c == '\\') {
+      i++;
+    } else if (c == '\'' || c == '"') {
+      for (i++; i < length && from[i] != c; i++)
+        if (from[i] == '\\' && c == '"')
+          i++;
+    } else if (c == '(') {
+      depth++;
+    } else if (c == ')' && --depth == 0) {
+      return i;
+    }
+  }
+  return length;
+}
+
+void redirect_expand_heredoc(struct redirect *redirect) {
+  const char *from = redirect->target;
+  size_t length = redirect->target_length;
+  if (!memchr(from, '$', length) && !memchr(from, '`', length) && !memchr(from, '\\', length))
+    return;
+
+  /* Every change leaves the text shorter or as long */
+  char *to = (char *) malloc(length + 1);
+  size_t n = 0, i = 0;
+  while (i < length) {
+    char c = from[i++];
+    if (c == '\\' && i < length && from[i] == '\n') {
+      /* A line continuation leaves nothing */
+      i++;
+    } else if (c == '\\' && i < length && (from[i] == '`' || from[i] == '\\')) {
+      to[n++] = from[i++];
+    } else if (c == '\\' && i < length && from[i] == '$') {
+      to[n++] = TOKEN_LITERAL_DOLLAR;
+      i++;
+    } else if (c == '$' && i < length && from[i] == '(') {
+      size_t close = substitution_end(from, length, i);
+      to[n++] = TOKEN_SUBST_QUOTED;
+      memcpy(to + n, from + i + 1, close - i - 1);
+      n += close - i - 1;
+      to[n++] = TOKEN_SUBST_END;
+      i = close + (close < length);
+    } else if (c == '`') {
+      to[n++] = TOKEN_SUBST_QUOTED;
+      for (; i < length && from[i] != '`'; i++) {
+        if (from[i] == '\\' && i + 1 < length &&
+            (from[i + 1] == '`' || from[i + 1] == '\\' || from[i + 1] == '$'))
+          i++;
+        to[n++] = from[i];
+      }
+      to[n++] = TOKEN_SUBST_END;
+      i += i < length;
+    } else {
+      to[n++] = c;
+    }
+  }
+  to[n] = '\0';
+
+  free(redirect->target);
+  redirect->target = to;
+  redirect->target_length = n;
+  redirect->expand = true;
+}
+
+void redirects_prepend_file(struct redirects *redirects, enum redirect_op op, int fd,
+                            const char *path) {
+  push(redirects);
+  memmove(redirects->list + 1, redirects->list, sizeof(struct redirect) * (redirects->length - 1));
+  struct redirect *redirect = &redirects->list[0];
+  memset(redirect, 0, sizeof(struct redirect));
+  redirect->op = op;
+  redirect->fd = fd;
+  redirect->target = strdup(path);
+  redirect->target_length = strlen(path);
+  redirect->source = -1;
+  redirect->opened = -1;
+}
+
+bool redirects_touch(const struct redirects *redirects, int fd) {
+  for (size_t i = 0; i < redirects->length; i++)
+    if (redirects->list[i].fd == fd)
+      return true;
+  return false;
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(fd, data, length);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return -1;
+    data += n;
+    length -= (size_t) n;
+  }
+  return 0;
+}
+
+/* The file name or text of the redirection for this run */
+static const char *target(const struct redirect *redirect) {
+  return redirect->expanded ? redirect->expanded : redirect->target;
+}
+
+/* The descriptor, positioned at its start, that the command reads the text from */
+static int data_source(const struct redirect *redirect) {
+  size_t length = redirect->expanded ? strlen(redirect->expanded) : redirect->target_length;
+  int fd = memfd_create("heredoc", MFD_CLOEXEC);
+  if (fd != -1) {
+    if (write_all(fd, target(redirect), length) == -1 ||
+        lseek(fd, 0, SEEK_SET) == -1) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  /* Without memfd a pipe does, as long as the text fits in it before anyone reads */
+  int fds[2];
+  if (errno != ENOSYS || length > PIPE_DATA_MAX || pipe2(fds, O_CLOEXEC) == -1)
+    return -1;
+  if (write_all(fds[1], target(redirect), length) == -1) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  close(fds[1]);
+  return fds[0];
+}
+
+int redirects_prepare(struct redirects *redirects) {
+  for (size_t i = 0; i < redirects->length; i++) {
+    struct redirect *redirect = &redirects->list[i];
+    if (redirect->expand)
+      redirect->expanded = expand_word(redirect->target);
+    if (redirect->op != REDIRECT_DATA)
+      continue;
+    redirect->source = data_source(redirect);
+    if (redirect->source == -1) {
+      perror("here-document");
+      redirects_release(redirects);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void redirects_release(struct redirects *redirects) {
+  for (size_t i = 0; i < redirects->length; i++) {
+    struct redirect *redirect = &redirects->list[i];
+    if (redirect->op == REDIRECT_DATA && redirect->source != -1) {
+      close(redirect->source);
+      redirect->source = -1;
+    }
+    if (redirect->opened != -1) {
+      close(redirect->opened);
+      redirect->opened = -1;
+    }
+    free(redirect->expanded);
+    redirect->expanded = NULL;
+  }
+}
+
+void redirects_clear(struct redirects *redirects) {
+  redirects_release(redirects);
+  for (size_t i = 0; i < redirects->length; i++)
+    free(redirects->list[i].target);
+  free(redirects->list);
+  redirects->list = NULL;
+  redirects->length = redirects->capacity = 0;
+}
+
+/* Report a failed redirection with write(2) alone, like the rest of the child setup */
+static void fail(const char *what) {
+  const char *err = strerror(errno);
+  if (write(STDERR_FILENO, what, strlen(what)) < 0 || write(STDERR_FILENO, ": ", 2) < 0 ||
+      write(STDERR_FILENO, err, strlen(err)) < 0 || write(STDERR_FILENO, "\n", 1) < 0)
+    return;
+}
+
+/* Flags used to open the file of a redirection */
+static int open_flags(enum redirect_op op) {
+  switch (op) {
+  case REDIRECT_OUTPUT:
+    return O_WRONLY | O_CREAT | O_TRUNC;
+  case REDIRECT_APPEND:
+    return O_WRONLY | O_CREAT | O_APPEND;
+  case REDIRECT_READWRITE:
+    return O_RDWR | O_CREAT;
+  default:
+    return O_RDONLY;
+  }
+}
+
+static bool opens_file(enum redirect_op op) {
+  return op != REDIRECT_DUP && op != REDIRECT_CLOSE && op != REDIRECT_DATA;
+}
+
+struct batch {
+  unsigned pending;
+  bool done;
+};
+
+static void file_opened(uint64_t tag, int result, void *data) {
+  struct batch *batch = (struct batch *) data;
+  ((struct redirect *) (uintptr_t) tag)->opened = result >= 0 ? result : -1;
+  batch->done = --batch->pending == 0;
+}
+
+void redirects_open_all(struct redirects **lists, size_t length) {
+  struct batch batch = {0, false};
+  for (size_t i = 0; i < length; i++) {
+    for (size_t k = 0; lists[i] && k < lists[i]->length; k++) {
+      struct redirect *redirect = &lists[i]->list[k];
+      if (!opens_file(redirect->op))
+        continue;
+      /* Close-on-exec, since every other child of the shell inherits it too */
+      if (!uring_enabled) {
+        redirect->opened = open(target(redirect), open_flags(redirect->op) | O_CLOEXEC, 0666);
+        continue;
+      }
+      uring_openat(target(redirect), open_flags(redirect->op) | O_CLOEXEC, 0666, file_opened,
+                   &batch, (uint64_t) (uintptr_t) redirect);
+      batch.pending++;
+    }
+  }
+  if (batch.pending)
+    uring_wait(&batch.done);
+}
+
+int redirects_apply(const struct redirects *redirects, int *saved) {
+  for (size_t i = 0; i < redirects->length; i++) {
+    const struct redirect *redirect = &redirects->list[i];
+
+    if (saved) {
+      saved[i] = fcntl(redirect->fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+      for (size_t j = 0; j < i; j++) {
+        if (redirects->list[j].fd == redirect->fd) {
+          if (saved[i] != -1)
+            close(saved[i]);
+          saved[i] = SAVED_EARLIER;
+          break;
+        }
+      }
+    }
+
+    if (redirect->op == REDIRECT_CLOSE) {
+      close(redirect->fd);
+      continue;
+    }
+
+    /* Only a file opened here is closed again once it is in place */
+    bool opened = opens_file(redirect->op) && redirect->opened == -1;
+    int fd = redirect->source;
+    if (opened)
+      fd = open(target(redirect), open_flags(redirect->op), 0666);
+    else if (opens_file(redirect->op))
+      fd = redirect->opened;
+    if (fd == -1) {
+      fail(target(redirect));
+      return -1;
+    }
+
+    if (fd == redirect->fd) {
+      /* n>&n only has to make sure the descriptor survives exec */
+      if (!opened && fcntl(fd, F_SETFD, 0) == -1) {
+        fail(target(redirect));
+        return -1;
+      }
+      continue;
+    }
+    if (dup2(fd, redirect->fd) == -1) {
+      fail(target(redirect));
+      if (opened)
+        close(fd);
+      return -1;
+    }
+    if (opened)
+      close(fd);
+  }
+  return 0;
+}
+
+void redirects_restore(const struct redirects *redirects, int *saved) {
+  for (size_t i = redirects->length; i-- > 0;) {
+    int fd = redirects->list[i].fd;
+    if (saved[i] == SAVED_EARLIER)
+      continue;
+    if (saved[i] == -1) {
+      close(fd);
+    } else {
+      dup2(saved[i], fd);
+      close(saved[i]);
+    }
+  }
+}
+
+void redirects_spawn_actions(const struct redirects *redirects,
+                             posix_spawn_file_actions_t *actions) {
+  for (size_t i = 0; i < redirects->length; i++) {
+    const struct redirect *redirect = &redirects->list[i];
+    switch (redirect->op) {
+    case REDIRECT_CLOSE:
+      posix_spawn_file_actions_addclose(actions, redirect->fd);
+      break;
+    case REDIRECT_DUP:
+    case REDIRECT_DATA:
+      posix_spawn_file_actions_adddup2(actions, redirect->source, redirect->fd);
+      break;
+    default:
+      if (redirect->opened != -1) {
+        posix_spawn_file_actions_adddup2(actions, redirect->opened, redirect->fd);
+        break;
+      }
+      posix_spawn_file_actions_addopen(actions, redirect->fd, target(redirect),
+                                       open_flags(redirect->op), 0666);
+      break;
+    }
+  }
+}
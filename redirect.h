@@ -0,0 +1,97 @@
+#pragma once
+
+#include <spawn.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct reader;
+
+enum redirect_op {
+  REDIRECT_INPUT,     /* [n]<file */
+  REDIRECT_OUTPUT,    /* [n]>file and [n]>|file */
+  REDIRECT_APPEND,    /* [n]>>file */
+  REDIRECT_READWRITE, /* [n]<>file */
+  REDIRECT_DUP,       /* [n]>&m and [n]<&m */
+  REDIRECT_CLOSE,     /* [n]>&- and [n]<&- */
+  REDIRECT_DATA,      /* [n]<<word here-documents and [n]<<<word here-strings */
+};
+
+struct redirect {
+  enum redirect_op op;
+
+  /* The descriptor of the command that is redirected */
+  int fd;
+
+  /* The file name, or the text fed by a here-document or here-string */
+  char *target;
+  size_t target_length;
+
+  /* The text is a here-document, read from the input after the line */
+  bool heredoc;
+
+  /* The target has to be expanded before each run, and its expansion while the command runs */
+  bool expand;
+  char *expanded;
+
+  /* The descriptor copied by REDIRECT_DUP, or the memfd holding the text of REDIRECT_DATA once
+   * it is prepared */
+  int source;
+
+  /* The file already opened by redirects_open_all, or -1 for the command to open it itself */
+  int opened;
+};
+
+/* The redirections of one stage of a pipeline, in the order they are applied */
+struct redirects {
+  struct redirect *list;
+  size_t length;
+  size_t capacity;
+};
+
+/* If words[i] is a redirection operator, add it to the list and return the number of words it
+ * takes, counting its target. The bodies of here-documents are read from input, which may be
+ * NULL. Returns 0 if the word is not an operator, and -1 after reporting a syntax error. */
+int redirect_parse(struct redirects *redirects, char **words, size_t i, size_t length,
+                   struct reader *input);
+
+/* Make the here-document expand its text before each run, as one whose delimiter was not quoted
+ * does: $ and command substitutions are expanded, and a backslash only escapes $ ` \ and a
+ * newline */
+void redirect_expand_heredoc(struct redirect *redirect);
+
+/* Put a redirection of fd to or from the file at path in front of the others of the list */
+void redirects_prepend_file(struct redirects *redirects, enum redirect_op op, int fd,
+                            const char *path);
+
+/* Whether some redirection of the list applies to fd */
+bool redirects_touch(const struct redirects *redirects, int fd);
+
+/* Expand the targets that need it and put the text of the here-documents and here-strings into
+ * memfds, so the command can read them without anything being written to disk. Returns -1 after
+ * reporting the error. */
+int redirects_prepare(struct redirects *redirects);
+
+/* Open the files of the prepared redirections of every list, in one batch when io_uring is in
+ * use, so the children of a pipeline find them open. A file that cannot be opened is left to the
+ * child, which reports the error as usual. */
+void redirects_open_all(struct redirects **lists, size_t length);
+
+/* Close the memfds made by redirects_prepare and the files of redirects_open_all, and drop the
+ * expansions */
+void redirects_release(struct redirects *redirects);
+
+/* Free the list */
+void redirects_clear(struct redirects *redirects);
+
+/* Apply the redirections to the calling process, in order. With saved NULL nothing but open, dup2
+ * and close is called, so a vfork child may use it. Otherwise saved, one int per redirection,
+ * records what is needed to undo them with redirects_restore. Returns -1 after writing the error
+ * to stderr. */
+int redirects_apply(const struct redirects *redirects, int *saved);
+
+/* Put back every descriptor changed by redirects_apply */
+void redirects_restore(const struct redirects *redirects, int *saved);
+
+/* Turn the redirections into file actions of posix_spawn */
+void redirects_spawn_actions(const struct redirects *redirects,
+                             posix_spawn_file_actions_t *actions);
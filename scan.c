@@ -0,0 +1,229 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SCAN_NEON 1
+#endif
+
+/* Bytes that end a plain run outside of quotes. Whitespace is what isspace accepts in the C
+ * locale: space and \t, \n, \v, \f, \r. The operators are ; & | ( and ), a backquote starts
+ * a command substitution and * ? [ make a word a pattern. */
+static bool is_special(unsigned char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r') || c == '\'' || c == '"' || c == '\\' ||
+         c == ';' || c == '&' || c == '|' || c == '(' || c == ')' || c == '`' || c == '*' ||
+         c == '?' || c == '[';
+}
+
+static size_t scalar_word(const char *s, size_t n) {
+  size_t i = 0;
+  while (i < n && !is_special((unsigned char) s[i]))
+    i++;
+  return i;
+}
+
+static size_t scalar_quoted(const char *s, size_t n, char quote) {
+  size_t i = 0;
+  while (i < n && s[i] != quote && s[i] != '\\')
+    i++;
+  return i;
+}
+
+#ifdef SCAN_X86
+/* Mask of the special bytes in a 16 byte block */
+__attribute__((target("sse2")))
+static inline __m128i sse2_special(__m128i v) {
+  /* Bytes 9 to 13 are whitespace: v - 9 is in 0..4 exactly for them when compared unsigned */
+  __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i ws = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+  /* Pairs of special bytes one bit apart share a compare: space and " (0x20, 0x22), & and '
+   * (0x26, 0x27), ( and ) (0x28, 0x29), ; and ? (0x3b, 0x3f) */
+  __m128i m = _mm_or_si128(
+      ws, _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(~2)), _mm_set1_epi8(' ')));
+  __m128i low_clear = _mm_and_si128(v, _mm_set1_epi8(~1));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(low_clear, _mm_set1_epi8('&')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(low_clear, _mm_set1_epi8('(')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(4)), _mm_set1_epi8('?')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('`')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+  return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_word(const char *s, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    int mask = _mm_movemask_epi8(sse2_special(_mm_loadu_si128((const __m128i *) (s + i))));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + scalar_word(s + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_quoted(const char *s, size_t n, char quote) {
+  __m128i q = _mm_set1_epi8(quote), bs = _mm_set1_epi8('\\');
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, q), _mm_cmpeq_epi8(v, bs)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + scalar_quoted(s + i, n - i, quote);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_word(const char *s, size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')),
+                                  shifted);
+    /* The same pairs as in sse2_special */
+    __m256i low_clear = _mm256_and_si256(v, _mm256_set1_epi8(~1));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(~2)),
+                                             _mm256_set1_epi8(' ')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(low_clear, _mm256_set1_epi8('&')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(low_clear, _mm256_set1_epi8('(')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(4)),
+                                             _mm256_set1_epi8('?')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('`')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(m);
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  /* Clear the upper halves before running SSE code, or every later SSE instruction pays for
+   * the transition */
+  _mm256_zeroupper();
+  return i + sse2_word(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_quoted(const char *s, size_t n, char quote) {
+  __m256i q = _mm256_set1_epi8(quote), bs = _mm256_set1_epi8('\\');
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, q), _mm256_cmpeq_epi8(v, bs)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  _mm256_zeroupper();
+  return i + sse2_quoted(s + i, n - i, quote);
+}
+#endif
+
+#ifdef SCAN_NEON
+/* Index of the first set byte of a comparison result, or 16. Narrowing by 4 bits turns the 128
+ * bit mask into a 64 bit one with a nibble per byte. */
+static inline size_t neon_first(uint8x16_t m) {
+  uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+  return bits ? (size_t) __builtin_ctzll(bits) >> 2 : 16;
+}
+
+static size_t neon_word(const char *s, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t *) (s + i));
+    uint8x16_t m = vcleq_u8(vsubq_u8(v, vdupq_n_u8('\t')), vdupq_n_u8('\r' - '\t'));
+    uint8x16_t low_clear = vandq_u8(v, vdupq_n_u8(0xfe));
+    m = vorrq_u8(m, vceqq_u8(vandq_u8(v, vdupq_n_u8(0xfd)), vdupq_n_u8(' ')));
+    m = vorrq_u8(m, vceqq_u8(low_clear, vdupq_n_u8('&')));
+    m = vorrq_u8(m, vceqq_u8(low_clear, vdupq_n_u8('(')));
+    m = vorrq_u8(m, vceqq_u8(vorrq_u8(v, vdupq_n_u8(4)), vdupq_n_u8('?')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\\')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('|')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('`')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('*')));
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('[')));
+    size_t first = neon_first(m);
+    if (first < 16)
+      return i + first;
+  }
+  return i + scalar_word(s + i, n - i);
+}
+
+static size_t neon_quoted(const char *s, size_t n, char quote) {
+  uint8x16_t q = vdupq_n_u8((uint8_t) quote), bs = vdupq_n_u8('\\');
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t *) (s + i));
+    size_t first = neon_first(vorrq_u8(vceqq_u8(v, q), vceqq_u8(v, bs)));
+    if (first < 16)
+      return i + first;
+  }
+  return i + scalar_quoted(s + i, n - i, quote);
+}
+#endif
+
+/* Slowest first, so the last supported entry is the default */
+static const struct scanner scanners[] = {
+  {"scalar", scalar_word, scalar_quoted},
+#ifdef SCAN_X86
+  {"sse2", sse2_word, sse2_quoted},
+  {"avx2", avx2_word, avx2_quoted},
+#endif
+#ifdef SCAN_NEON
+  {"neon", neon_word, neon_quoted},
+#endif
+};
+
+#define SCANNERS_LENGTH (sizeof(scanners) / sizeof(struct scanner))
+
+const struct scanner *scanner = &scanners[0];
+
+static bool supported(const struct scanner *s) {
+#ifdef SCAN_X86
+  if (!strcmp(s->name, "sse2"))
+    return __builtin_cpu_supports("sse2");
+  if (!strcmp(s->name, "avx2"))
+    return __builtin_cpu_supports("avx2");
+#endif
+  (void) s;
+  return true;
+}
+
+int scanner_select(const char *name) {
+  for (size_t i = 0; i < SCANNERS_LENGTH; i++) {
+    if (!strcmp(scanners[i].name, name) && supported(&scanners[i])) {
+      scanner = &scanners[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char **scanner_names(void) {
+  static const char *names[SCANNERS_LENGTH + 1];
+  size_t n = 0;
+  for (size_t i = 0; i < SCANNERS_LENGTH; i++)
+    if (supported(&scanners[i]))
+      names[n++] = scanners[i].name;
+  names[n] = NULL;
+  return names;
+}
+
+/* Pick the fastest supported scanner before main runs */
+__attribute__((constructor))
+static void scanner_init(void) {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+#endif
+  for (size_t i = 0; i < SCANNERS_LENGTH; i++)
+    if (supported(&scanners[i]))
+      scanner = &scanners[i];
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Byte scanners used by the tokenizer to skip over runs of plain characters. Each one has a
+ * scalar version and, where the CPU has them, SSE2/AVX2 or NEON versions. The fastest one the
+ * CPU supports is selected at startup. */
+struct scanner {
+  const char *name;
+
+  /* Index of the first whitespace, quote, backquote, backslash, operator or pattern byte (* ? [)
+   * in s[0..n), or n if there is none */
+  size_t (*word)(const char *s, size_t n);
+
+  /* Index of the first occurrence of quote or a backslash in s[0..n), or n if there is none */
+  size_t (*quoted)(const char *s, size_t n, char quote);
+};
+
+/* The scanner in use */
+extern const struct scanner *scanner;
+
+/* Switch to the scanner with the given name. Returns 0, or -1 if the CPU does not support it. */
+int scanner_select(const char *name);
+
+/* Names of the scanners the CPU supports, terminated by NULL */
+const char **scanner_names(void);
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "capture.h"
+#include "jobs.h"
+#include "reader.h"
+#include "serve.h"
+#include "shell.h"
+#include "stats.h"
+
+/* Records larger than this are refused, so a broken controller cannot make the shell allocate
+ * without bound */
+#define SERVE_RECORD_MAX (64 << 20)
+
+/* The capture of every job, and the end of the output a failed record gets back */
+#define SERVE_CAPTURE_SIZE (64 * 1024)
+
+/* The memfd that standard output and error of every record go to */
+static int output_fd = -1;
+
+/* The buffer records are read into, reused from one to the next */
+static char *record;
+static size_t record_capacity;
+
+/* Read exactly length bytes. Returns false at end of input or on an error. */
+static bool read_full(int fd, void *buffer, size_t length) {
+  char *p = (char *) buffer;
+  while (length > 0) {
+    ssize_t got = read(fd, p, length);
+    if (got == -1 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return false;
+    p += got;
+    length -= (size_t) got;
+  }
+  return true;
+}
+
+static bool write_full(int fd, const void *buffer, size_t length) {
+  const char *p = (const char *) buffer;
+  while (length > 0) {
+    ssize_t put = write(fd, p, length);
+    if (put == -1 && errno == EINTR)
+      continue;
+    if (put <= 0)
+      return false;
+    p += put;
+    length -= (size_t) put;
+  }
+  return true;
+}
+
+/* Copy the output from offset up to length to fd, with sendfile where the kernel can */
+static bool send_output(int fd, off_t offset, size_t length) {
+  while ((size_t) offset < length) {
+    ssize_t sent = sendfile(fd, output_fd, &offset, length - (size_t) offset);
+    if (sent == -1 && errno == EINTR)
+      continue;
+    if (sent == -1 && (errno == EINVAL || errno == ENOSYS))
+      break;
+    if (sent <= 0)
+      return false;
+  }
+  while ((size_t) offset < length) {
+    char buffer[65536];
+    size_t n = length - (size_t) offset < sizeof(buffer) ? length - (size_t) offset : sizeof(buffer);
+    ssize_t got = pread(output_fd, buffer, n, offset);
+    if (got <= 0 || !write_full(fd, buffer, (size_t) got))
+      return false;
+    offset += got;
+  }
+  return true;
+}
+
+static void put_length(unsigned char *p, uint32_t length) {
+  p[0] = (unsigned char) (length >> 24);
+  p[1] = (unsigned char) (length >> 16);
+  p[2] = (unsigned char) (length >> 8);
+  p[3] = (unsigned char) length;
+}
+
+static uint64_t timeval_us(struct timeval tv) {
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* CPU time of the shell and its reaped children, in microseconds */
+static void cpu_us(uint64_t *user, uint64_t *sys) {
+  struct rusage self, children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  *user = timeval_us(self.ru_utime) + timeval_us(children.ru_utime);
+  *sys = timeval_us(self.ru_stime) + timeval_us(children.ru_stime);
+}
+
+/* Run the commands with standard output and error sent to output_fd, and reply on fd. Returns
+ * false if the reply could not be written. */
+static bool run_record(int fd, const char *commands, size_t length) {
+  uint64_t user, sys, user_after, sys_after;
+
+  /* The shell writes to the descriptors as well, through stdout */
+  fflush(stdout);
+  int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+  int saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+  ftruncate(output_fd, 0);
+  lseek(output_fd, 0, SEEK_SET);
+  dup2(output_fd, STDOUT_FILENO);
+  dup2(output_fd, STDERR_FILENO);
+
+  jobs_maxrss = 0;
+  cpu_us(&user, &sys);
+  uint64_t started = stats_clock();
+  struct reader *input = reader_open_buffer(commands, length);
+  run_input(input);
+  reader_close(input);
+  fflush(stdout);
+  uint64_t wall_us = (stats_clock() - started) / 1000;
+  cpu_us(&user_after, &sys_after);
+
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+
+  struct stat st;
+  size_t output_length = fstat(output_fd, &st) == 0 ? (size_t) st.st_size : 0;
+  /* A record that failed only gets the end of its output back, as much as a capture keeps */
+  off_t from = 0;
+  if (shell_status != 0 && capture_size && output_length > capture_size)
+    from = (off_t) (output_length - capture_size);
+  char header[192];
+  int header_length = snprintf(
+      header + 4, sizeof(header) - 4,
+      "exit=%d wall_us=%llu user_us=%llu sys_us=%llu maxrss_kb=%ld output_bytes=%zu\n",
+      shell_status, (unsigned long long) wall_us, (unsigned long long) (user_after - user),
+      (unsigned long long) (sys_after - sys), jobs_maxrss, output_length);
+  put_length((unsigned char *) header, (uint32_t) (header_length + output_length - (size_t) from));
+
+  /* A controller that went away must not kill the shell */
+  void (*pipe_handler)(int) = signal(SIGPIPE, SIG_IGN);
+  bool sent =
+      write_full(fd, header, (size_t) header_length + 4) && send_output(fd, from, output_length);
+  signal(SIGPIPE, pipe_handler);
+  return sent;
+}
+
+/* Run the records read from in until it ends, replying on out */
+static void serve_stream(int in, int out) {
+  unsigned char prefix[4];
+
+  while (read_full(in, prefix, sizeof(prefix))) {
+    uint32_t length = (uint32_t) prefix[0] << 24 | (uint32_t) prefix[1] << 16 |
+                      (uint32_t) prefix[2] << 8 | prefix[3];
+    if (length > SERVE_RECORD_MAX) {
+      fprintf(stderr, "serve: record of %u bytes is too large.\n", length);
+      return;
+    }
+    if (length > record_capacity) {
+      record_capacity = length;
+      record = (char *) realloc(record, record_capacity);
+    }
+    if (!read_full(in, record, length) || !run_record(out, record, length))
+      return;
+  }
+}
+
+int serve_run(const char *path) {
+  /* Commands never read the records, their input is empty */
+  int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  output_fd = memfd_create("serve-output", MFD_CLOEXEC);
+  if (null_fd == -1 || output_fd == -1) {
+    perror("serve");
+    return 1;
+  }
+  jobs_print_status = false;
+  shell_exit_ends_input = true;
+  /* Every job streams through a capture, for the output builtin of the records that follow */
+  if (!capture_size)
+    capture_size = SERVE_CAPTURE_SIZE;
+
+  if (!path) {
+    int in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+    int out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    dup2(null_fd, STDIN_FILENO);
+    /* What the shell prints outside of a record must not be taken for a reply */
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    serve_stream(in, out);
+    return shell_status;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "serve: %s: path too long.\n", path);
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct stat st;
+  /* A socket left behind by an earlier server is replaced, nothing else is */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+  if (listener == -1 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+      listen(listener, 16) == -1) {
+    fprintf(stderr, "serve: %s: %s.\n", path, strerror(errno));
+    return 1;
+  }
+  dup2(null_fd, STDIN_FILENO);
+
+  /* Connections are served one at a time, each by the same warm shell */
+  for (;;) {
+    int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (connection == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      fprintf(stderr, "serve: accept: %s.\n", strerror(errno));
+      break;
+    }
+    serve_stream(connection, connection);
+    close(connection);
+  }
+  close(listener);
+  unlink(path);
+  return 1;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+/* Server mode, for controllers that run many commands on one host without starting a shell or a
+ * session for each. Commands arrive as records: a 4-byte big-endian length, then that many bytes
+ * of command lines. Each record runs in the shell like a script, so variables and the working directory carry
+ * over to the next one, with standard input from /dev/null and standard output and error captured
+ * together. The reply is a record of the same framing holding one line
+ *
+ *   exit=N wall_us=N user_us=N sys_us=N maxrss_kb=N output_bytes=N
+ *
+ * followed by the output. The times count the shell and every child that finished during the
+ * record, maxrss_kb the largest of those children. Output capture is on, and a record that failed
+ * gets only the last capture_size bytes of its output_bytes back. exit in a record ends the record with
+ * its status, and the shell goes on serving. */
+
+/* Serve records read from standard input, replying on standard output, or with path set the
+ * connections accepted one after the other on a unix socket bound there. Returns the exit status
+ * of the shell. */
+int serve_run(const char *path);
@@ -1,17 +1,43 @@
+#define _GNU_SOURCE
+
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include "builtins.h"
+#include "capture.h"
+#include "cgroup.h"
+#include "dispatch.h"
+#include "editor.h"
+#include "expand.h"
+#include "history.h"
+#include "jobs.h"
+#include "optimize.h"
+#include "parse.h"
+#include "pathglob.h"
+#include "pathres.h"
+#include "reader.h"
+#include "redirect.h"
+#include "serve.h"
+#include "shell.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "tokenizer.h"
+#include "uring.h"
+#include "vars.h"
 
 #define PIPE_READ 0
 #define PIPE_WRITE 1
@@ -19,38 +45,105 @@
 /* Convenience macro to silence compiler warnings about unused function parameters. */
 #define unused __attribute__((unused))
 
-/* Whether the shell is connected to an actual terminal or not. */
+/* Declared in shell.h */
 bool shell_is_interactive;
-
-/* File descriptor for the shell input */
 int shell_terminal;
-
-/* Terminal mode settings for the shell */
 struct termios shell_tmodes;
-
-/* Process group id for the shell */
 pid_t shell_pgid;
+int shell_status;
+pid_t shell_background_pid;
+bool shell_exit_ends_input;
+
+/* Set by a builtin that reports the status of a job, such as wait and fg, instead of success */
+static int builtin_status = -1;
+
+/* Set by exit when it only ends the input, for run_input to stop reading it and take the status */
+static bool exit_pending;
+static int exit_pending_status;
+
+/* How external commands are started */
+enum launch_backend {
+  LAUNCH_FORK,
+  LAUNCH_VFORK,
+  LAUNCH_SPAWN,
+};
 
-int input_redirect = 0;
-int output_redirect = 0;
-
-int cmd_exit(struct tokens *tokens);
-int cmd_help(struct tokens *tokens);
-int cmd_pwd(struct tokens *tokens);
-int cmd_cd(struct tokens *tokens);
-
-void program_exec(char **args, int pipein, int pipeout);
-void piped_exec(struct tokens *tokens);
+const char *launch_backend_names[] = {"fork", "vfork", "spawn"};
+
+enum launch_backend launch_backend = LAUNCH_SPAWN;
+
+/* The cgroup.procs file children of the job being launched move themselves into, or -1 */
+static int launch_cgroup_fd = -1;
+
+/* The terminal a foreground job being launched takes over, or -1. Every child gives it to the
+ * group of the job itself, before it can read from it and be stopped for reading from the
+ * background. */
+static int launch_terminal = -1;
+
+/* The pipe the standard error of the job being launched goes to while it is captured, or -1 */
+static int launch_stderr_fd = -1;
+
+/* The rc file every shell starts with, $SHELLRC or else ~/.shellrc, and its snapshot next to it */
+static char *rc_path;
+static char *rc_snapshot_path;
+
+/* Signals the shell ignores, which children get back with their default action */
+const int child_default_signals[] = {SIGINT, SIGQUIT, SIGTERM, SIGTSTP, SIGCONT, SIGTTIN, SIGTTOU};
+
+/* The reader of standard input, if the shell reads its commands from there, and what its
+ * descriptor was when it was opened */
+struct reader *stdin_reader;
+static struct stat stdin_stat;
+
+/* The reader the current line came from, which the bodies of its here-documents follow */
+static struct reader *heredoc_input;
+
+/* Loops running, and how many of them a break or continue still has to leave */
+static int loop_depth;
+static int loop_breaks;
+static int loop_continues;
+
+/* A foreground job of the line was killed by ^C, which stops the loops around it too */
+static bool interrupted;
+
+int cmd_exit(int argc, char **argv);
+int cmd_help(int argc, char **argv);
+int cmd_pwd(int argc, char **argv);
+int cmd_cd(int argc, char **argv);
+int cmd_hash(int argc, char **argv);
+int cmd_launch(int argc, char **argv);
+int cmd_events(int argc, char **argv);
+int cmd_jobs(int argc, char **argv);
+int cmd_fg(int argc, char **argv);
+int cmd_bg(int argc, char **argv);
+int cmd_wait(int argc, char **argv);
+int cmd_parallel(int argc, char **argv);
+int cmd_time(int argc, char **argv);
+int cmd_limit(int argc, char **argv);
+int cmd_stats(int argc, char **argv);
+int cmd_pipesize(int argc, char **argv);
+int cmd_output(int argc, char **argv);
+int cmd_snapshot(int argc, char **argv);
+int cmd_break(int argc, char **argv);
+int cmd_continue(int argc, char **argv);
+int cmd_export(int argc, char **argv);
+int cmd_unset(int argc, char **argv);
+
+pid_t program_exec(struct command *command, int pipein, int pipeout, pid_t pgid);
+struct job *launch_pipeline(char **words, size_t length, bool foreground);
+int piped_exec(struct pipeline *pipeline);
 void command_not_found(const char *cmd);
 
-/* Built-in command functions take token array (see parse.h) and return int */
-typedef int cmd_fun_t(struct tokens *tokens);
+/* Built-in command functions take the words of the command, like main, and return 1 on success */
+typedef int cmd_fun_t(int argc, char **argv);
 
 /* Built-in command struct and lookup table */
 typedef struct fun_desc {
   cmd_fun_t *fun;
   char *cmd;
   char *doc;
+  /* Takes the whole line, pipes and redirects included, instead of being one stage of it */
+  bool whole_line;
 } fun_desc_t;
 
 fun_desc_t cmd_table[] = {
@@ -58,27 +151,67 @@ fun_desc_t cmd_table[] = {
   {cmd_exit, "exit", "exit the command shell"},
   {cmd_cd, "cd", "changes the working directory to the given directory"},
   {cmd_pwd, "pwd", "prints the current working directory to standard output"},
+  {cmd_hash, "hash", "shows the cached command paths, -r forgets them"},
+  {cmd_launch, "launch", "shows or selects how commands are started: fork, vfork or spawn"},
+  {cmd_events, "events", "shows or selects how children and their output are waited for: epoll or uring"},
+  {cmd_jobs, "jobs", "lists the jobs of this shell"},
+  {cmd_fg, "fg", "continues a job in the foreground"},
+  {cmd_bg, "bg", "continues a stopped job in the background"},
+  {cmd_wait, "wait", "waits for the given job, or every background job, to finish"},
+  {cmd_parallel, "parallel",
+   "runs [-j N] { cmd ; cmd ... } or the lines of standard input, at most N at a time", true},
+  {cmd_time, "time", "runs a pipeline and reports the time and memory of each stage", true},
+  {cmd_limit, "limit", "--mem SIZE --cpu N -- runs a pipeline in a cgroup with its memory and CPUs limited", true},
+  {cmd_stats, "stats", "on [FD] writes timing records of every command to FD, off stops"},
+  {cmd_pipesize, "pipesize", "shows or sets the capacity in bytes of the pipes between stages, 0 for the default"},
+  {cmd_output, "output", "on [SIZE] keeps the last output of every job, off stops, dump or tail [N] prints it"},
+  {cmd_snapshot, "snapshot", "saves the variables, settings and command paths for shells started with the same rc file"},
+  {cmd_echo, "echo", "writes its arguments to standard output, -n without a newline, -e with escapes"},
+  {cmd_printf, "printf", "writes its arguments to standard output under the control of a format"},
+  {cmd_test, "test", "evaluates a conditional expression"},
+  {cmd_test, "[", "evaluates a conditional expression up to a closing ]"},
+  {cmd_true, "true", "does nothing, successfully"},
+  {cmd_false, "false", "does nothing, unsuccessfully"},
+  {cmd_cat, "cat", "copies the given files, or standard input, to standard output"},
+  {cmd_tee, "tee", "[-a] copies standard input to standard output and the given files"},
+  {cmd_read, "read", "[-r] reads a line of standard input into the given variables, or REPLY"},
+  {cmd_break, "break", "leaves the innermost loop, or the N innermost ones"},
+  {cmd_continue, "continue", "starts the next pass of the innermost loop, or of the Nth one"},
+  {cmd_export, "export", "puts name[=value] in the environment of commands, or lists it"},
+  {cmd_unset, "unset", "removes the given variables"},
 };
 
-/* input and output filename buffer */
-char inbuf[128];
-char outbuf[128];
-
 /* Prints a helpful description for the given command */
-int cmd_help(unused struct tokens *tokens) {
+int cmd_help(unused int argc, unused char **argv) {
   for (unsigned int i = 0; i < sizeof(cmd_table) / sizeof(fun_desc_t); i++)
     printf("%s - %s\n", cmd_table[i].cmd, cmd_table[i].doc);
   return 1;
 }
 
-/* Exits this shell */
-int cmd_exit(unused struct tokens *tokens) {
-  exit(0);
+/* Exits this shell, with the given status or else the one of the last command */
+int cmd_exit(int argc, char **argv) {
+  int status = shell_status;
+  if (argc > 1) {
+    char *end;
+    long value = strtol(argv[1], &end, 10);
+    if (end == argv[1] || *end) {
+      printf("exit: %s: numeric argument required.\n", argv[1]);
+      return 0;
+    }
+    status = (int) (value & 0xff);
+  }
+  if (shell_exit_ends_input) {
+    /* The rest of the line is skipped as after ^C */
+    exit_pending_status = status;
+    exit_pending = interrupted = true;
+    return !status;
+  }
+  exit(status);
 }
 
 /* Changes the working directory to the given directory */
-int cmd_cd(struct tokens *tokens) {
-  char *path = tokens_get_token(tokens, 1);
+int cmd_cd(int argc, char **argv) {
+  char *path = argv[1];
   if (chdir(path) != -1) {
     return 1;
   }
@@ -87,7 +220,7 @@ int cmd_cd(struct tokens *tokens) {
 }
 
 /* Prints the current working directory to standard output */
-int cmd_pwd(struct tokens *tokens) {
+int cmd_pwd(int argc, char **argv) {
   char *path = getcwd(NULL, 0);
   if (!path) {
     printf("error: %s.\n", strerror(errno));
@@ -98,21 +231,599 @@ int cmd_pwd(struct tokens *tokens) {
   return 1;
 }
 
+/* Shows or resets the table of resolved command paths */
+int cmd_hash(int argc, char **argv) {
+  size_t len = argc;
+  if (len == 1) {
+    pathres_print(stdout);
+    return 1;
+  }
+
+  int ret = 1;
+  for (size_t i = 1; i < len; i++) {
+    char *name = argv[i];
+    if (!strcmp(name, "-r")) {
+      pathres_reset();
+    } else if (!pathres_lookup(name)) {
+      printf("hash: %s: not found.\n", name);
+      ret = 0;
+    }
+  }
+  return ret;
+}
+
+/* Shows or selects the backend used to start external commands */
+int cmd_launch(int argc, char **argv) {
+  char *name = argv[1];
+  size_t count = sizeof(launch_backend_names) / sizeof(char *);
+
+  if (!name) {
+    printf("%s\n", launch_backend_names[launch_backend]);
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (!strcmp(name, launch_backend_names[i])) {
+      launch_backend = (enum launch_backend)i;
+      return 1;
+    }
+  }
+  printf("launch: %s: unknown backend.\n", name);
+  return 0;
+}
+
+/* Shows or selects how the shell waits for its children, their output and the files of their
+ * redirections: through an epoll set of pidfds and one system call at a time, or in batches
+ * through io_uring */
+int cmd_events(int argc, char **argv) {
+  char *name = argv[1];
+
+  if (!name) {
+    printf("%s\n", uring_enabled ? "uring" : "epoll");
+    return 1;
+  }
+  if (!strcmp(name, "epoll")) {
+    uring_enabled = false;
+    return 1;
+  }
+  if (!strcmp(name, "uring")) {
+    if (uring_open() == -1) {
+      printf("events: uring: %s.\n", strerror(errno));
+      return 0;
+    }
+    uring_enabled = true;
+    return 1;
+  }
+  printf("events: %s: unknown backend.\n", name);
+  return 0;
+}
+
+/* The exit status of a waited for job, 128 plus the signal for one that was killed or stopped */
+static int exit_status(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status)) {
+    if (WTERMSIG(status) == SIGINT)
+      interrupted = true;
+    return 128 + WTERMSIG(status);
+  }
+  return WIFSTOPPED(status) ? 128 + WSTOPSIG(status) : 1;
+}
+
+/* The status of the builtin that just ran: the one it set, else 0 for success */
+static int builtin_exit(int ret) {
+  int status = builtin_status >= 0 ? builtin_status : !ret;
+  builtin_status = -1;
+  return status;
+}
+
+/* Find the job named by a job argument such as %2 or 2, or the most recent job if there is none.
+ * A job that has completed can only be waited for, unless running is false. */
+static struct job *job_argument(const char *cmd, char **argv, bool running) {
+  char *arg = argv[1];
+  int id = 0;
+
+  if (arg) {
+    char *end;
+    id = strtol(arg[0] == '%' ? arg + 1 : arg, &end, 10);
+    if (*end || id <= 0) {
+      printf("%s: %s: no such job.\n", cmd, arg);
+      return NULL;
+    }
+  }
+
+  struct job *job = job_find(id);
+  if (!job) {
+    printf("%s: %s: no such job.\n", cmd, arg ? arg : "current");
+  } else if (running && job_is_completed(job)) {
+    printf("%s: %s: job has terminated.\n", cmd, arg);
+    return NULL;
+  }
+  return job;
+}
+
+/* Lists the jobs of this shell */
+int cmd_jobs(unused int argc, unused char **argv) {
+  jobs_print();
+  return 1;
+}
+
+/* Continues a job in the foreground */
+int cmd_fg(int argc, char **argv) {
+  struct job *job = job_argument("fg", argv, true);
+  if (!job)
+    return 0;
+  printf("%s\n", job->command);
+  builtin_status = exit_status(job_foreground(job, true));
+  return 1;
+}
+
+/* Continues a stopped job in the background */
+int cmd_bg(int argc, char **argv) {
+  struct job *job = job_argument("bg", argv, true);
+  if (!job)
+    return 0;
+  printf("[%d] %s &\n", job->id, job->command);
+  job_background(job, true);
+  return 1;
+}
+
+/* Waits for the given job or process, or every background job, to finish. With one, the status
+ * is that of the job. */
+int cmd_wait(int argc, char **argv) {
+  if (argc > 1) {
+    char *end;
+    long pid = strtol(argv[1], &end, 10);
+    struct job *job = argv[1][0] != '%' && !*end && pid > 0 ? job_find_pid(pid) : NULL;
+    if (!job)
+      job = job_argument("wait", argv, false);
+    if (!job)
+      return 0;
+    builtin_status = exit_status(job_wait(job));
+    if (job_is_completed(job))
+      job_remove(job);
+    return 1;
+  }
+  jobs_wait_all();
+  return 1;
+}
+
+struct reader *shell_stdin_reader(void) {
+  struct stat st;
+  if (!stdin_reader || fstat(STDIN_FILENO, &st) == -1)
+    return NULL;
+  return st.st_dev == stdin_stat.st_dev && st.st_ino == stdin_stat.st_ino ? stdin_reader : NULL;
+}
+
+/* Where parallel takes its commands from: a range of words split by ;, or lines of input */
+struct parallel_source {
+  char **argv;
+  size_t next;
+  size_t end;
+  struct reader *input;
+  struct tokens *line;
+  char **words;
+  size_t words_capacity;
+};
+
+static void parallel_push(struct parallel_source *src, size_t *length, char *word) {
+  if (*length + 1 >= src->words_capacity) {
+    src->words_capacity = src->words_capacity ? src->words_capacity * 2 : 16;
+    src->words = (char **)realloc(src->words, sizeof(char *) * src->words_capacity);
+  }
+  src->words[(*length)++] = word;
+}
+
+/* Get the words of the next non-empty command, or return 0 when there are none left */
+static size_t parallel_next(struct parallel_source *src) {
+  size_t length = 0;
+  if (src->input) {
+    const char *line;
+    ssize_t line_length;
+    while (length == 0 && (line_length = reader_getline(src->input, &line)) != -1) {
+      tokenize_buffer(src->line, line, line_length);
+      for (size_t i = 0; i < tokens_get_length(src->line); i++)
+        parallel_push(src, &length, tokens_get_token(src->line, i));
+    }
+  } else {
+    while (length == 0 && src->next < src->end) {
+      for (; src->next < src->end; src->next++) {
+        char *word = src->argv[src->next];
+        if (!strcmp(word, ";")) {
+          src->next++;
+          break;
+        }
+        parallel_push(src, &length, word);
+      }
+    }
+  }
+  return length;
+}
+
+/* Runs independent commands as background jobs, keeping at most N of them running at a time and
+ * starting the next one as soon as one finishes */
+int cmd_parallel(int argc, char **argv) {
+  size_t len = argc;
+  long max = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t i = 1;
+
+  for (; i < len; i++) {
+    char *arg = argv[i];
+    char *value = NULL;
+    if (!strcmp(arg, "-j") && i + 1 < len)
+      value = argv[++i];
+    else if (!strncmp(arg, "-j", 2) && arg[2])
+      value = arg + 2;
+    else
+      break;
+
+    char *end;
+    max = strtol(value, &end, 10);
+    if (*end || max < 1) {
+      printf("parallel: %s: invalid number of jobs.\n", value);
+      return 0;
+    }
+  }
+  if (max < 1)
+    max = 1;
+
+  struct parallel_source src = {argv, i, len, NULL, NULL, NULL, 0};
+  if (i < len) {
+    if (strcmp(argv[i], "{") || strcmp(argv[len - 1], "}")) {
+      printf("parallel: usage: parallel [-j N] { cmd ; cmd ... }\n");
+      return 0;
+    }
+    src.next = i + 1;
+    src.end = len - 1;
+  } else {
+    /* Share the reader of the shell if the commands of the shell come from standard input too */
+    src.input = shell_stdin_reader() ? stdin_reader : reader_open(STDIN_FILENO);
+    src.line = tokens_create();
+  }
+
+  struct job **running = (struct job **)malloc(sizeof(struct job *) * max);
+  size_t length, nrunning = 0, launched = 0, failed = 0;
+
+  for (;;) {
+    /* Fill every free slot */
+    while (nrunning < (size_t)max && (length = parallel_next(&src)) > 0) {
+      launched++;
+      struct job *job = launch_pipeline(src.words, length, false);
+      if (!job) {
+        failed++;
+        continue;
+      }
+      job_background(job, false);
+      running[nrunning++] = job;
+    }
+    if (nrunning == 0)
+      break;
+
+    struct job *job = jobs_wait_any(running, nrunning);
+    for (size_t k = 0; k < nrunning; k++) {
+      if (running[k] == job) {
+        running[k] = running[--nrunning];
+        break;
+      }
+    }
+
+    if (!job_is_completed(job)) {
+      /* A stopped command is left in the job table for fg and bg */
+      failed++;
+    } else {
+      int status = job->procs[job->procs_length - 1].status;
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        failed++;
+      job_remove(job);
+    }
+  }
+
+  if (failed)
+    printf("parallel: %zu of %zu commands failed.\n", failed, launched);
+
+  free(src.words);
+  free(running);
+  if (src.input) {
+    tokens_destroy(src.line);
+    if (src.input != stdin_reader)
+      reader_close(src.input);
+  }
+  return failed == 0;
+}
+
+/* Run the words as a timed pipeline in the foreground, in the cgroup if it is not NULL */
+static int run_timed(char **argv, size_t length, struct cgroup *cgroup) {
+  char **words = (char **)malloc(sizeof(char *) * (length + 1));
+  for (size_t i = 0; i < length; i++)
+    words[i] = argv[i];
+
+  jobs_cgroup = cgroup;
+  struct job *job = launch_pipeline(words, length, true);
+  free(words);
+  /* A line that did not parse never made the job that would have taken the cgroup */
+  cgroup_destroy(jobs_cgroup);
+  jobs_cgroup = NULL;
+  if (!job)
+    return 0;
+  job->timed = true;
+  int status = job_foreground(job, false);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Runs a pipeline in the foreground and reports the time and memory of each of its stages, and
+ * of the whole job from a cgroup of its own where there is a cgroup v2 hierarchy to make one in */
+int cmd_time(int argc, char **argv) {
+  if (argc < 2) {
+    printf("time: usage: time command [| command ...]\n");
+    return 0;
+  }
+  return run_timed(argv + 1, argc - 1, cgroup_create(false, false, NULL));
+}
+
+/* A size in bytes with an optional K, M, G or T suffix, or -1 */
+static int64_t parse_size(const char *text) {
+  char *end;
+  double size = strtod(text, &end);
+  const char *suffixes = "KMGT";
+  if (end == text || size < 0)
+    return -1;
+  if (*end) {
+    const char *suffix = strchr(suffixes, toupper((unsigned char)*end));
+    if (!suffix || end[1])
+      return -1;
+    for (const char *p = suffixes; p <= suffix; p++)
+      size *= 1024;
+  }
+  return (int64_t)size;
+}
+
+/* Runs a pipeline in a cgroup leaf of its own, with its memory and CPU limited, and reports
+ * what the job used like time does */
+int cmd_limit(int argc, char **argv) {
+  int64_t memory = -1;
+  double cpus = -1;
+  int i = 1;
+
+  for (; i + 1 < argc && argv[i][0] == '-' && strcmp(argv[i], "--"); i += 2) {
+    char *end;
+    if (!strcmp(argv[i], "--mem") && (memory = parse_size(argv[i + 1])) > 0)
+      continue;
+    if (!strcmp(argv[i], "--cpu") && (cpus = strtod(argv[i + 1], &end)) > 0 && !*end)
+      continue;
+    printf("limit: %s %s: invalid limit.\n", argv[i], argv[i + 1]);
+    return 0;
+  }
+  if (i < argc && !strcmp(argv[i], "--"))
+    i++;
+  if (i >= argc) {
+    printf("limit: usage: limit [--mem SIZE] [--cpu N] [--] command [| command ...]\n");
+    return 0;
+  }
+
+  struct cgroup *cgroup = cgroup_create(memory > 0, cpus > 0, "limit");
+  if (!cgroup || (memory > 0 && cgroup_limit_memory(cgroup, memory, "limit") == -1) ||
+      (cpus > 0 && cgroup_limit_cpus(cgroup, cpus, "limit") == -1)) {
+    cgroup_destroy(cgroup);
+    return 0;
+  }
+  return run_timed(argv + i, argc - i, cgroup);
+}
+
+/* Turns stats mode on, writing to the given descriptor or stderr, or off */
+int cmd_stats(int argc, char **argv) {
+  char *mode = argv[1];
+  char *fd = argc > 2 ? argv[2] : NULL;
+
+  if (!mode) {
+    if (stats_fd == -1)
+      printf("stats: off\n");
+    else
+      printf("stats: on %d\n", stats_fd);
+    return 1;
+  } else if (!strcmp(mode, "off")) {
+    stats_fd = -1;
+    return 1;
+  } else if (!strcmp(mode, "on")) {
+    int n = STDERR_FILENO;
+    if (fd) {
+      char *end;
+      n = strtol(fd, &end, 10);
+      if (*end || n < 0 || fcntl(n, F_GETFD) == -1) {
+        printf("stats: %s: bad file descriptor.\n", fd);
+        return 0;
+      }
+    }
+    stats_fd = n;
+    return 1;
+  }
+  printf("stats: usage: stats [on [FD] | off]\n");
+  return 0;
+}
+
+/* Shows or sets the capacity of the pipes of pipelines, capped at /proc/sys/fs/pipe-max-size */
+int cmd_pipesize(int argc, char **argv) {
+  if (argc < 2) {
+    printf("%d\n", optimize_pipe_size);
+    return 1;
+  }
+  char *end;
+  long size = strtol(argv[1], &end, 10);
+  if (*end || end == argv[1] || size < 0) {
+    printf("pipesize: %s: invalid size.\n", argv[1]);
+    return 0;
+  }
+  if (optimize_set_pipe_size(size) < size)
+    printf("pipesize: capped at %d bytes.\n", optimize_pipe_size);
+  return 1;
+}
+
+/* The capture kept by default, enough for the end of what a failing command printed */
+#define OUTPUT_DEFAULT_SIZE (64 * 1024)
+
+/* Turns output capture on or off and prints the output kept from the last foreground job */
+int cmd_output(int argc, char **argv) {
+  const struct capture *last = capture_last();
+
+  if (argc < 2) {
+    if (!capture_size)
+      printf("off\n");
+    else if (last)
+      printf("%zu (job %d wrote %llu bytes)\n", capture_size, last->job,
+             (unsigned long long)last->written);
+    else
+      printf("%zu\n", capture_size);
+    return 1;
+  }
+
+  if (!strcmp(argv[1], "on")) {
+    int64_t size = argc > 2 ? parse_size(argv[2]) : OUTPUT_DEFAULT_SIZE;
+    if (size <= 0) {
+      printf("output: %s: invalid size.\n", argv[2]);
+      return 0;
+    }
+    if (shell_is_interactive) {
+      printf("output: jobs on a terminal are not captured.\n");
+      return 0;
+    }
+    capture_size = (size_t)size;
+    return 1;
+  }
+  if (!strcmp(argv[1], "off")) {
+    capture_size = 0;
+    return 1;
+  }
+
+  bool tail = !strcmp(argv[1], "tail");
+  long lines = 0;
+  if (!tail && strcmp(argv[1], "dump")) {
+    printf("output: usage: output [on [SIZE] | off | dump | tail [LINES]]\n");
+    return 0;
+  }
+  if (tail) {
+    char *end;
+    lines = argc > 2 ? strtol(argv[2], &end, 10) : 10;
+    if (argc > 2 && (*end || end == argv[2] || lines < 1)) {
+      printf("output: %s: invalid line count.\n", argv[2]);
+      return 0;
+    }
+  }
+  if (!last) {
+    printf("output: nothing was captured.\n");
+    return 0;
+  }
+  fflush(stdout);
+  capture_print(last, STDOUT_FILENO, (size_t)lines);
+  return 1;
+}
+
+/* Saves the state of the shell for the next ones started with the same rc file and PATH, which
+ * take it from the snapshot instead of running the rc file. Meant to end the rc file. */
+int cmd_snapshot(unused int argc, unused char **argv) {
+  char pipe_size[24], output_size[24];
+  snprintf(pipe_size, sizeof(pipe_size), "%d", optimize_pipe_size);
+  snprintf(output_size, sizeof(output_size), "%zu", capture_size);
+  char *launch[] = {"launch", (char *)launch_backend_names[launch_backend], NULL};
+  char *events[] = {"events", uring_enabled ? "uring" : "epoll", NULL};
+  char *pipesize[] = {"pipesize", pipe_size, NULL};
+  char *output[] = {"output", "on", output_size, NULL};
+  char **settings[] = {launch, events, pipesize, output};
+
+  if (!rc_path) {
+    printf("snapshot: no rc file, SHELLRC and HOME are not set.\n");
+    return 0;
+  }
+  if (access(rc_path, F_OK) == -1) {
+    printf("snapshot: %s: %s.\n", rc_path, strerror(errno));
+    return 0;
+  }
+  /* Capture is off unless something turned it on */
+  if (snapshot_write(rc_snapshot_path, rc_path, settings, capture_size ? 4 : 3) == -1) {
+    printf("snapshot: %s: %s.\n", rc_snapshot_path, strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+/* How many loops break or continue apply to, or 0 after reporting an error */
+static int loop_count(const char *cmd, int argc, char **argv) {
+  long n = 1;
+  if (argc > 1) {
+    char *end;
+    n = strtol(argv[1], &end, 10);
+    if (*end || n < 1) {
+      printf("%s: %s: loop count out of range.\n", cmd, argv[1]);
+      return 0;
+    }
+  }
+  if (loop_depth == 0) {
+    printf("%s: only meaningful in a loop.\n", cmd);
+    return 0;
+  }
+  return n < loop_depth ? (int)n : loop_depth;
+}
+
+/* Leaves the innermost loop, or the N innermost ones */
+int cmd_break(int argc, char **argv) {
+  loop_breaks = loop_count("break", argc, argv);
+  return loop_breaks > 0;
+}
+
+/* Skips to the next pass of the innermost loop, or of the Nth one */
+int cmd_continue(int argc, char **argv) {
+  loop_continues = loop_count("continue", argc, argv);
+  return loop_continues > 0;
+}
+
+/* Puts the given variables, which may be set at the same time, in the environment of the commands
+ * the shell starts */
+int cmd_export(int argc, char **argv) {
+  if (argc == 1) {
+    vars_print_exported(stdout);
+    return 1;
+  }
+
+  int ret = 1;
+  for (int i = 1; i < argc; i++) {
+    char *equals = strchr(argv[i], '=');
+    if (equals) {
+      *equals = '\0';
+      ret &= vars_export(argv[i], equals + 1) == 0;
+      *equals = '=';
+    } else {
+      ret &= vars_export(argv[i], NULL) == 0;
+    }
+  }
+  return ret;
+}
+
+/* Removes the given variables */
+int cmd_unset(int argc, char **argv) {
+  for (int i = 1; i < argc; i++)
+    vars_unset(argv[i]);
+  return 1;
+}
+
+/* Index over the names of cmd_table, filled in by init_shell */
+static struct dispatch cmd_index;
+
 /* Looks up the built-in command, if it exists. */
 int lookup(char cmd[]) {
-  for (unsigned int i = 0; i < sizeof(cmd_table) / sizeof(fun_desc_t); i++)
-    if (cmd && (strcmp(cmd_table[i].cmd, cmd) == 0))
-      return i;
-  return -1;
+  return dispatch_find(&cmd_index, cmd);
 }
 
-/* Intialization procedures for this shell */
-void init_shell() {
+/* Intialization procedures for this shell. Commands come from standard input when read_stdin is
+ * set, otherwise from a script or the -c argument. */
+void init_shell(bool read_stdin) {
   /* Our shell is connected to standard input. */
   shell_terminal = STDIN_FILENO;
 
   /* Check if we are running interactively */
-  shell_is_interactive = isatty(shell_terminal);
+  shell_is_interactive = read_stdin && isatty(shell_terminal);
+
+  if (!shell_is_interactive) {
+    /* Nobody watches the output as it is produced, so only flush it before a fork or on exit */
+    static char stdout_buffer[65536];
+    setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+  }
 
   if (shell_is_interactive) {
     /* If the shell is not currently in the foreground, we must pause the shell until it becomes a
@@ -121,8 +832,10 @@ void init_shell() {
     while (tcgetpgrp(shell_terminal) != (shell_pgid = getpgrp()))
       kill(-shell_pgid, SIGTTIN);
 
-    /* Saves the shell's process id */
+    /* Saves the shell's process id and puts the shell in its own process group */
     shell_pgid = getpid();
+    if (setpgid(shell_pgid, shell_pgid) < 0 && errno != EPERM)
+      perror("setpgid failed");
 
     /* Take control of the terminal */
     tcsetpgrp(shell_terminal, shell_pgid);
@@ -135,248 +848,1086 @@ void init_shell() {
     signal(SIGQUIT, SIG_IGN);
     signal(SIGTERM, SIG_IGN);
     signal(SIGTSTP, SIG_IGN);
-    signal(SIGCONT, SIG_IGN);    
+    signal(SIGCONT, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
   }
+
+  /* Children are reaped as they change state */
+  jobs_init();
+
+  /* Variables start out as the environment, and the path cache follows PATH from then on */
+  vars_init(environ);
+  vars_watch("PATH", pathres_set_path);
+
+  /* Builtins are found through an index instead of a scan of the table */
+  for (unsigned int i = 0; i < sizeof(cmd_table) / sizeof(fun_desc_t); i++)
+    if (dispatch_add(&cmd_index, cmd_table[i].cmd, i) == -1)
+      fprintf(stderr, "%s: builtin name too long for the dispatch index\n", cmd_table[i].cmd);
 }
 
-void exec_with_pathres(char **args) {
-  /* Split the PATH string by colon */
-  char *envpath = getenv("PATH");
-  size_t envlen = strlen(envpath);
-  char *pathbuf = (char *)malloc(envlen + 1);
-  char *envbuf = (char *)malloc(envlen + 1);
-  char *path = args[0];
+/* Replaces the child with the program at path, which was resolved by pathres_lookup in the
+ * shell before forking. A NULL path means the command was not found. */
+void exec_with_pathres(const char *path, char **args, char **envp) {
+  if (path) {
+    execve(path, args, envp);
+    if (errno != ENOENT) {
+      printf("%s: %s.\n", args[0], strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  command_not_found(args[0]);
+  exit(EXIT_FAILURE);
+}
+
+/* Report a failed system call from a child that has not exec'ed yet. Only write(2) is used, since
+ * a vfork child shares the shell's memory and must not touch stdio. */
+static void child_fail(const char *what) {
+  const char *err = strerror(errno);
+  if (write(STDERR_FILENO, what, strlen(what)) < 0 || write(STDERR_FILENO, ": ", 2) < 0 ||
+      write(STDERR_FILENO, err, strlen(err)) < 0 || write(STDERR_FILENO, "\n", 1) < 0)
+    return;
+}
 
-  /* Copy the envpath since strtok changes the actual PATH */
-  strcpy(envbuf, envpath);
+/* Set up the process group, signals and file descriptors of a forked or vforked child, applying
+ * the redirections after the pipes so that they win. Returns -1 after reporting the error if the
+ * child cannot run the program. */
+static int child_setup(const struct redirects *redirects, int pipein, int pipeout, pid_t pgid) {
+  sigset_t empty;
+
+  setpgid(0, pgid);
+  /* SIGTTOU is still ignored, as in the shell */
+  if (launch_terminal != -1)
+    tcsetpgrp(launch_terminal, pgid ? pgid : getpid());
+
+  /* Before the exec, so that nothing the program starts escapes the leaf */
+  if (launch_cgroup_fd != -1 && write(launch_cgroup_fd, "0", 1) == -1) {
+    child_fail("cgroup");
+    return -1;
+  }
 
-  if (execv(path, args) == -1 && errno == ENOENT) {
-    char *p = strtok(envbuf, ":");
+  for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(int); i++)
+    signal(child_default_signals[i], SIG_DFL);
 
-    while (p) {
-      strcpy(pathbuf, p);
-      strcat(pathbuf, "/");
-      strcat(pathbuf, path);
-      args[0] = pathbuf;
+  /* The shell blocks SIGCHLD while it launches a job */
+  sigemptyset(&empty);
+  sigprocmask(SIG_SETMASK, &empty, NULL);
 
-      if (execv(args[0], args) == -1 && errno != ENOENT) 
-        break;
-      
-      p = strtok(NULL, ":");
+  if (pipein != STDIN_FILENO) {
+    /* Read from the previous stage */
+    if (dup2(pipein, STDIN_FILENO) == -1) {
+      child_fail("dup2 error");
+      return -1;
     }
   }
 
-  free(pathbuf);
-  free(envbuf);
-  command_not_found(path);
-  exit(EXIT_FAILURE);
+  if (pipeout != STDOUT_FILENO) {
+    /* Write to the next stage */
+    if (dup2(pipeout, STDOUT_FILENO) == -1) {
+      child_fail("dup2 error");
+      return -1;
+    }
+  }
+
+  if (launch_stderr_fd != -1 && dup2(launch_stderr_fd, STDERR_FILENO) == -1) {
+    child_fail("dup2 error");
+    return -1;
+  }
+
+  return redirects_apply(redirects, NULL);
 }
 
-/* Try to execute the program provided by the user */
-void program_exec(char **args, int pipein, int pipeout) {
-  /* Forks a new process */
+/* Launch with a full fork, which copies the page tables of the shell */
+static pid_t fork_exec(const char *path, struct command *command, char **envp, int pipein,
+                       int pipeout, pid_t pgid) {
   pid_t pid = fork();
-  int status;
+  if (pid == 0) {
+    /* Child process */
+    if (child_setup(&command->redirects, pipein, pipeout, pgid) == -1)
+      exit(EXIT_FAILURE);
+    exec_with_pathres(path, command->args, envp);
+  } else if (pid == -1) {
+    printf("Failed to create new process: %s.\n", strerror(errno));
+  }
+  return pid;
+}
 
-  /* Parent process */
-  if (pid > 0) {
-    /* Ignore the SIGTTOU */
-    signal(SIGTTOU, SIG_IGN);
+/* Launch with vfork: the child borrows the memory of the shell, which stays suspended until the
+ * child has exec'ed or exited. */
+static pid_t vfork_exec(const char *path, struct command *command, char **envp, int pipein,
+                        int pipeout, pid_t pgid) {
+  pid_t pid = vfork();
+  if (pid == 0) {
+    /* Child process */
+    if (child_setup(&command->redirects, pipein, pipeout, pgid) == 0) {
+      execve(path, command->args, envp);
+      child_fail(command->args[0]);
+    }
+    _exit(EXIT_FAILURE);
+  } else if (pid == -1) {
+    printf("Failed to create new process: %s.\n", strerror(errno));
+  }
+  return pid;
+}
+
+/* Launch with posix_spawn, turning the child setup into spawn attributes and file actions */
+static pid_t spawn_exec(const char *path, struct command *command, char **envp, int pipein,
+                        int pipeout, pid_t pgid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t defaults, empty;
+  pid_t pid = -1;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+
+#if __GLIBC_PREREQ(2, 35)
+  /* First, while the terminal is still on standard input */
+  if (launch_terminal != -1)
+    posix_spawn_file_actions_addtcsetpgrp_np(&actions, launch_terminal);
+#endif
+  if (pipein != STDIN_FILENO)
+    posix_spawn_file_actions_adddup2(&actions, pipein, STDIN_FILENO);
+  if (pipeout != STDOUT_FILENO)
+    posix_spawn_file_actions_adddup2(&actions, pipeout, STDOUT_FILENO);
+  if (launch_stderr_fd != -1)
+    posix_spawn_file_actions_adddup2(&actions, launch_stderr_fd, STDERR_FILENO);
+  redirects_spawn_actions(&command->redirects, &actions);
+
+  sigemptyset(&defaults);
+  for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(int); i++)
+    sigaddset(&defaults, child_default_signals[i]);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  sigemptyset(&empty);
+  posix_spawnattr_setsigmask(&attr, &empty);
+  posix_spawnattr_setpgroup(&attr, pgid);
+  posix_spawnattr_setflags(&attr,
+                           POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+  int err = posix_spawn(&pid, path, &actions, &attr, command->args, envp);
+  if (err) {
+    printf("%s: %s.\n", command->args[0], strerror(err));
+    pid = -1;
+  }
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  return pid;
+}
 
-    /* Set child to its own process group */
-    if (setpgid(pid, pid) < 0) {
+/* Starts the program of the stage in process group pgid (0 starts a new group named after the
+ * child), reading from pipein and writing to pipeout, using the selected launch backend. Returns
+ * the pid of the child, or -1. */
+pid_t program_exec(struct command *command, int pipein, int pipeout, pid_t pgid) {
+  /* Resolve in the shell, so the result is cached for the next command */
+  uint64_t started = stats_clock();
+  const char *path = pathres_lookup(command->args[0]);
+  stats_add(STATS_PATHRES, started);
+  pid_t pid;
+
+  /* The environment is only put together again when an exported variable changed, or for a
+   * command that sets some of its own */
+  char **assignments = NULL, **envp = vars_environ();
+  if (command->assignments_length > 0) {
+    assignments = expand_words(command->assignments, command->assignment_flags, false);
+    envp = vars_environ_with(assignments, command->assignments_length);
+  }
+
+  /* Flush before forking, or the child would write out its copy of anything still buffered */
+  fflush(stdout);
+
+  /* Only a forked child can report a missing command like a regular program would */
+  started = stats_clock();
+  if (!path || launch_backend == LAUNCH_FORK)
+    pid = fork_exec(path, command, envp, pipein, pipeout, pgid);
+  else if (launch_backend == LAUNCH_VFORK || launch_cgroup_fd != -1)
+    /* posix_spawn has no way to put the child into a cgroup */
+    pid = vfork_exec(path, command, envp, pipein, pipeout, pgid);
+  else
+    pid = spawn_exec(path, command, envp, pipein, pipeout, pgid);
+  stats_add(STATS_LAUNCH, started);
+
+  if (assignments) {
+    free(envp);
+    free_words(assignments);
+  }
+
+  if (pid > 0) {
+    /* Set child to the process group of the pipeline. The child does the same, so the group
+     * exists no matter which of the two runs first. */
+    if (setpgid(pid, pgid ? pgid : pid) < 0 && errno != EACCES) {
       perror("setpgid failed");
     }
+  }
+  return pid;
+}
 
-    /* Put child process to foreground */
-    if (tcsetpgrp(STDIN_FILENO, pid) < 0) {
-      perror("tcsetpgrp failed");
-    }
+/* Whether the builtin implements every option of the words. Where it does not, like cat -n, the
+ * program of that name runs instead. */
+static bool builtin_handles(int fundex, char **args) {
+  if (cmd_table[fundex].fun == cmd_cat)
+    return cmd_cat_handles(args);
+  if (cmd_table[fundex].fun == cmd_tee)
+    return cmd_tee_handles(args);
+  return true;
+}
 
-    /* Wait the child process to finish */
-    if (wait(&status) == -1) {
-      perror("wait failed");
-    }
-    printf("status: %d\n", status);
+/* Fill in which commands of the pipeline are builtins, so running it again needs no lookup. The
+ * options of words that are expanded are only known once they are, when the stage is launched. */
+static void resolve_builtins(struct pipeline *pipeline) {
+  uint64_t started = stats_clock();
+  for (size_t i = 0; i < pipeline->length; i++) {
+    struct command *command = &pipeline->commands[i];
+    command->builtin = command->args[0] ? lookup(command->args[0]) : -1;
+    if (command->builtin >= 0 && !command->expand &&
+        !builtin_handles(command->builtin, command->args))
+      command->builtin = -1;
+  }
+  stats_add(STATS_LOOKUP, started);
+}
 
-    /* Put parent process to foreground */
-    if (tcsetpgrp(STDIN_FILENO, shell_pgid) < 0) {
-      perror("tcsetpgrp failed");
+/* Whether a cat or tee may run in the shell itself, which ignores the ^C and ^Z that would stop
+ * them on a terminal. Their words must need no expansion, so that their options are known. */
+static bool copies_in_shell(const struct command *command) {
+  cmd_fun_t *fun = cmd_table[command->builtin].fun;
+  if (fun != cmd_cat && fun != cmd_tee)
+    return true;
+  return !shell_is_interactive && !command->expand;
+}
+
+/* Whether the shell may feed the rest of the pipeline from a cat at its head itself. It does so
+ * even on a terminal, where the job has ^C, but never reads from a terminal that belongs to the
+ * job: every operand must be a file, or standard input must not be a terminal. */
+static bool feeds_in_shell(const struct command *command) {
+  if (command->builtin < 0 || cmd_table[command->builtin].fun != cmd_cat || command->expand)
+    return false;
+  bool options = true, operands = false, reads_input = false;
+  for (char **arg = command->args + 1; *arg; arg++) {
+    if (options && !strcmp(*arg, "--")) {
+      options = false;
+    } else if (!options || **arg != '-' || !(*arg)[1]) {
+      options = false;
+      operands = true;
+      reads_input |= !strcmp(*arg, "-");
     }
-    /* Reset SIGTTOU */
-    signal(SIGTTOU, SIG_DFL);
+  }
+  return (operands && !reads_input) || !isatty(STDIN_FILENO);
+}
+
+static int count_args(char **args) {
+  int argc = 0;
+  while (args[argc])
+    argc++;
+  return argc;
+}
 
-  } else if (pid == 0) {
+/* Give the command the expansions of its words for one run, which command_release takes back */
+static void command_expand(struct command *command) {
+  if (command->expand)
+    command->args = expand_words(command->parsed, command->flags, true);
+}
+
+static void command_release(struct command *command) {
+  if (command->args != command->parsed) {
+    free_words(command->args);
+    command->args = command->parsed;
+  }
+}
+
+/* Run the assignments of the command in the shell, each one expanded after those before it are
+ * set, so that x=1 y=$x gives y 1 */
+static void command_assign(struct command *command) {
+  for (size_t i = 0; i < command->assignments_length; i++) {
+    char *word[] = {command->assignments[i], NULL};
+    char **assignment = expand_words(word, command->assignment_flags + i, false);
+    if (assignment[0])
+      vars_assign(assignment[0]);
+    free_words(assignment);
+  }
+}
+
+/* Run a builtin as one stage of a pipeline, in a forked child with no exec */
+static pid_t builtin_exec(int fundex, struct command *command, int pipein, int pipeout, pid_t pgid) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
     /* Child process */
-    signal(SIGINT, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-    signal(SIGTERM, SIG_DFL);
-    signal(SIGTSTP, SIG_DFL);
-    signal(SIGCONT, SIG_DFL);
-    if (pipein != -1) {
-      /* There is pipe */
-      if (dup2(pipein, STDIN_FILENO) == -1) {
-        perror("dup2 error");
-        exit(EXIT_FAILURE);
-      }
+    if (child_setup(&command->redirects, pipein, pipeout, pgid) == -1)
+      _exit(EXIT_FAILURE);
+    jobs_forked();
+    /* There is no exec to close the other pipe ends, and one left open would keep the builtin
+     * from ever seeing the end of its input */
+    close_range(3, ~0U, 0);
+    /* The ring is the shell's, shared with it through the mapping */
+    uring_enabled = false;
+    shell_exit_ends_input = false;
+    command_assign(command);
+    int ret = cmd_table[fundex].fun(count_args(command->args), command->args);
+    fflush(stdout);
+    _exit(builtin_exit(ret));
+  } else if (pid == -1) {
+    printf("Failed to create new process: %s.\n", strerror(errno));
+  } else if (setpgid(pid, pgid ? pgid : pid) < 0 && errno != EACCES) {
+    perror("setpgid failed");
+  }
+  return pid;
+}
 
-      if (dup2(pipeout, STDOUT_FILENO) == -1) {
-        perror("dup2 error");
-        exit(EXIT_FAILURE);
-      }
+/* Run a builtin in the shell itself, with the redirections of the stage applied to the shell's own
+ * descriptors for the duration of the command. A stage without a command only opens its files. */
+static int builtin_run(int fundex, struct command *command) {
+  struct redirects *redirects = &command->redirects;
+  int *saved = (int *)malloc(sizeof(int) * (redirects->length + 1));
+  char **values = NULL;
+  int ret = 0;
+
+  /* Assignments without a command stay, the ones in front of a builtin only last while it runs */
+  if (fundex >= 0 && command->assignments_length > 0) {
+    values = (char **)malloc(sizeof(char *) * command->assignments_length);
+    for (size_t i = 0; i < command->assignments_length; i++) {
+      char *name = strndup(command->assignments[i], vars_name_length(command->assignments[i]));
+      const char *value = vars_get(name);
+      values[i] = value ? strdup(value) : NULL;
+      free(name);
+    }
+  }
+  /* The words are expanded with the values from before the assignments, as for other commands */
+  unsigned long substitutions = expand_substitutions;
+  command_expand(command);
+  command_assign(command);
+
+  fflush(stdout);
+  if (redirects_prepare(redirects) == 0) {
+    if (redirects_apply(redirects, saved) == 0) {
+      /* Without a command the status is the one of the last command substitution, if any ran */
+      if (fundex < 0)
+        ret = substitutions == expand_substitutions || shell_status == 0;
+      else
+        ret = cmd_table[fundex].fun(count_args(command->args), command->args);
     }
 
-    if (input_redirect) {
-        int fd0 = open(inbuf, O_RDONLY);
-        if (fd0 == -1) {
-          perror("Cannot open file");
-          exit(EXIT_FAILURE);
-        }
+    /* Put the shell's own descriptors back */
+    fflush(stdout);
+    redirects_restore(redirects, saved);
+    redirects_release(redirects);
+  }
+  command_release(command);
+
+  for (size_t i = command->assignments_length; values && i-- > 0;) {
+    char *name = strndup(command->assignments[i], vars_name_length(command->assignments[i]));
+    if (values[i])
+      vars_set(name, values[i]);
+    else
+      vars_unset(name);
+    free(name);
+    free(values[i]);
+  }
+  free(values);
+  free(saved);
+  return ret;
+}
 
-        /* Input redirect for child process */
-        if (dup2(fd0, STDIN_FILENO) == -1) {
-          perror("dup2 error");
-          exit(EXIT_FAILURE);
-        }
-          
-        close(fd0);
+/* Fork every stage of the pipeline into the process group of the job, the first one reading from
+ * pipein, which is closed afterwards unless it is standard input. Builtin stages run in a forked
+ * copy of the shell. A foreground job takes the terminal, and with captured set its output goes
+ * through the capture ring when capture is on. */
+static void launch_stages(struct job *job, struct command *commands, size_t length, int pipein,
+                          bool foreground, bool captured) {
+  int curpipe[2] = {-1, -1};
+  size_t i;
+
+  /* Every stage is expanded and prepared first, so that the shell opens the files of all their
+   * redirections before the first fork, in one batch with io_uring, and no child opens them */
+  bool *ready = (bool *)calloc(length, sizeof(bool));
+  struct redirects **lists = (struct redirects **)calloc(length, sizeof(struct redirects *));
+  for (i = 0; i < length; i++) {
+    command_expand(&commands[i]);
+    ready[i] = commands[i].args[0] && redirects_prepare(&commands[i].redirects) == 0;
+    if (ready[i])
+      lists[i] = &commands[i].redirects;
+  }
+  redirects_open_all(lists, length);
+  free(lists);
+
+  /* Opened after the expansions, so that no command substitution inherits the pipes */
+  if (captured && capture_size && !shell_is_interactive)
+    job->capture = capture_open(job->id);
+  int last_out = job->capture ? job->capture->streams[0].write_fd : STDOUT_FILENO;
+  launch_stderr_fd = job->capture ? job->capture->streams[1].write_fd : -1;
+
+  /* No child may be reaped before it is recorded in the job */
+  jobs_block();
+  launch_cgroup_fd = job->cgroup ? cgroup_procs_fd(job->cgroup) : -1;
+  launch_terminal = foreground && shell_is_interactive ? shell_terminal : -1;
+
+  for (i = 0; i < length; i++) {
+    struct command *command = &commands[i];
+
+    /* The stage ends with either a pipe symbol or the end of the line */
+    int pipeout = last_out;
+    curpipe[PIPE_READ] = -1;
+
+    if (i + 1 < length) {
+      /* Close-on-exec keeps the other stages from holding this pipe open */
+      if (pipe2(curpipe, O_CLOEXEC) == -1) {
+        perror("pipe cannot be created");
+        if (pipein != STDIN_FILENO)
+          close(pipein);
+        break;
+      }
+      pipeout = curpipe[PIPE_WRITE];
+      optimize_pipe(pipeout, job->id, i + (pipein != STDIN_FILENO));
     }
 
-    if (output_redirect) {
-        int fd1 = creat(outbuf, (O_RDWR | O_CREAT | O_TRUNC));
-        if (fd1 == -1) {
-          perror("Cannot create file");
-          exit(EXIT_FAILURE);
-        }
+    if (ready[i]) {
+      uint64_t started = stats_clock();
+      pid_t pid;
+      if (command->builtin >= 0 && builtin_handles(command->builtin, command->args))
+        pid = builtin_exec(command->builtin, command, pipein, pipeout, job->pgid);
+      else
+        pid = program_exec(command, pipein, pipeout, job->pgid);
+      if (pid > 0)
+        job_add_process(job, pid, command->args[0], started);
+      redirects_release(&command->redirects);
+    }
+    command_release(command);
 
-        /* Output redirect for child process */
-        if (dup2(fd1, STDOUT_FILENO) == -1) {
-          perror("dup2 error");
-          exit(EXIT_FAILURE);
-        }
+    /* The children hold their own copies of the pipe ends */
+    if (pipein != STDIN_FILENO)
+      close(pipein);
+    if (pipeout != last_out)
+      close(pipeout);
+
+    pipein = curpipe[PIPE_READ];
+  }
+
+  /* Stages prepared ahead that were never reached */
+  for (; i < length; i++) {
+    if (ready[i])
+      redirects_release(&commands[i].redirects);
+    command_release(&commands[i]);
+  }
+  free(ready);
+  launch_cgroup_fd = -1;
+  launch_stderr_fd = -1;
+  launch_terminal = -1;
+  if (job->capture)
+    capture_launched(job->capture);
+  jobs_unblock();
+}
+
+/* Start a job running the parsed pipeline, or return NULL if nothing could be launched. The
+ * output of a foreground job is captured when capture is on. */
+static struct job *start_pipeline(struct pipeline *pipeline, bool foreground) {
+  struct job *job = job_create(pipeline->text);
+
+  launch_stages(job, pipeline->commands, pipeline->length, STDIN_FILENO, foreground, foreground);
+  if (job->procs_length == 0) {
+    job_remove(job);
+    return NULL;
+  }
+  return job;
+}
+
+/* Launch the pipeline made of the given words as a new job, forking every stage before any of
+ * them is waited for, so the stages run concurrently. A foreground job is given the terminal. Returns
+ * NULL after reporting the error if nothing could be launched. */
+struct job *launch_pipeline(char **words, size_t length, bool foreground) {
+  struct pipeline *pipeline = parse_words(words, NULL, length, heredoc_input, false);
+  struct job *job = NULL;
+
+  if (pipeline) {
+    optimize_pipeline(pipeline);
+    resolve_builtins(pipeline);
+    job = start_pipeline(pipeline, foreground);
+  }
+  pipeline_free(pipeline);
+  return job;
+}
+
+/* Run a foreground pipeline whose first stage is a cat. The shell launches the other stages and
+ * copies the files into the first pipe itself, so the data moves from the file to the pipe inside
+ * the kernel with no process in between. */
+static int feed_pipeline(struct pipeline *pipeline) {
+  int feed[2];
+
+  if (pipe2(feed, O_CLOEXEC) == -1) {
+    perror("pipe cannot be created");
+    return 1;
+  }
+
+  struct job *job = job_create(pipeline->text);
+  optimize_pipe(feed[PIPE_WRITE], job->id, 0);
+  /* Not captured: the shell, busy feeding the job, would not drain what it writes */
+  launch_stages(job, pipeline->commands + 1, pipeline->length - 1, feed[PIPE_READ], true, false);
+  if (job->procs_length == 0) {
+    close(feed[PIPE_WRITE]);
+    job_remove(job);
+    return 1;
+  }
 
-        close(fd1);
+  /* The job gets the terminal while the shell is still writing into it, so ^C reaches it */
+  if (shell_is_interactive && tcsetpgrp(shell_terminal, job->pgid) < 0)
+    perror("tcsetpgrp failed");
+
+  fflush(stdout);
+  int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+  dup2(feed[PIPE_WRITE], STDOUT_FILENO);
+  close(feed[PIPE_WRITE]);
+
+  /* A reader that goes away ends the copy with EPIPE instead of killing the shell */
+  void (*pipe_handler)(int) = signal(SIGPIPE, SIG_IGN);
+  builtin_run(pipeline->commands[0].builtin, &pipeline->commands[0]);
+  signal(SIGPIPE, pipe_handler);
+
+  /* Closing the last write end lets the job see the end of its input */
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  return job_foreground(job, false);
+}
+
+/* Execute the programs with pipe. A trailing & leaves the job running in the background,
+ * otherwise the shell waits for it. A lone builtin in the foreground runs in the shell itself,
+ * as does a cat at the head of a foreground pipeline. Returns the exit status, 0 for success. */
+int piped_exec(struct pipeline *pipeline) {
+  struct command *first = &pipeline->commands[0];
+
+  if (!pipeline->background) {
+    if (pipeline->length == 1 && (first->builtin < 0 ? !first->args[0] : copies_in_shell(first)))
+      return builtin_exit(builtin_run(first->builtin, first));
+    if (pipeline->length > 1 && feeds_in_shell(first))
+      return exit_status(feed_pipeline(pipeline));
+  }
+
+  struct job *job = start_pipeline(pipeline, !pipeline->background);
+  if (!job)
+    return 1;
+  if (pipeline->background) {
+    job_background(job, false);
+    shell_background_pid = job->procs[job->procs_length - 1].pid;
+    if (shell_is_interactive)
+      printf("[%d] %d\n", job->id, job->pgid);
+    return 0;
+  }
+  return exit_status(job_foreground(job, false));
+}
+
+/* Whether the builtin of that name takes its whole line, for the parser */
+static bool takes_whole_line(const char *name) {
+  int fundex = dispatch_find(&cmd_index, name);
+  return fundex >= 0 && cmd_table[fundex].whole_line;
+}
+
+/* Fill in the builtins of every pipeline of the list, nested ones included */
+static void resolve_list(struct node *list) {
+  for (; list; list = list->next) {
+    if (list->pipeline) {
+      optimize_pipeline(list->pipeline);
+      resolve_builtins(list->pipeline);
     }
+    resolve_list(list->condition);
+    resolve_list(list->body);
+    resolve_list(list->otherwise);
+    for (size_t i = 0; i < list->arms_length; i++)
+      resolve_list(list->arms[i].body);
+  }
+}
 
-    exec_with_pathres(args);
-  } else {
-    printf("Failed to create new process: %s.\n", strerror(errno));
+/* Parse the line that was just tokenized, with the lines after it if it opens a compound
+ * command */
+static struct node *parse_tokens(struct tokens *tokens, bool *cacheable) {
+  uint64_t started = stats_clock();
+  struct node *list = parse_line(tokens, heredoc_input, takes_whole_line, cacheable);
+  stats_add(STATS_PARSE, started);
+
+  resolve_list(list);
+  return list;
+}
+
+/* Run a parsed pipeline. Builtins that take the whole line get it as it is, before it is split
+ * into stages. */
+static int run_pipeline(struct pipeline *pipeline) {
+  struct command *first = &pipeline->commands[0];
+  if (first->builtin >= 0 && cmd_table[first->builtin].whole_line) {
+    command_expand(first);
+    int ret = cmd_table[first->builtin].fun(count_args(first->args), first->args);
+    command_release(first);
+    return builtin_exit(ret);
   }
+  return piped_exec(pipeline);
 }
 
-/* Execute the programs with pipe */
-void piped_exec(struct tokens *tokens) {
-  int token_len = tokens_get_length(tokens);
-  char **args = (char **)malloc(sizeof(char *) * (token_len + 1));
-  int j = 1;
-  int prevpipe[2] = {-1, -1};
-  int curpipe[2] = {-1, -1};
+static int run_list(struct node *list);
 
-  args[0] = tokens_get_token(tokens, 0);
-  char *prevtok = args[0];
+/* Whether a loop has to stop before its next pass. A continue meant for an outer loop leaves this
+ * one like a break does. */
+static bool loop_done(void) {
+  if (loop_breaks > 0) {
+    loop_breaks--;
+    return true;
+  }
+  if (loop_continues > 0 && --loop_continues > 0)
+    return true;
+  return interrupted;
+}
 
-  for (int i = 1; i < token_len; i++) {
-    char *curtok = tokens_get_token(tokens, i);
-    args[j++] = curtok;
+/* Run while and until loops. The condition and the body are trees parsed once, so a pass costs no
+ * more than running them. */
+static int run_loop(struct node *node) {
+  int status = 0;
 
-    /* j is guaranteed to be greater than 1 */
-    if (!strcmp(prevtok, "|")) {
-      /* Change prevtok in args to NULL */
-      args[j - 2] = NULL;
-      // printf("exec: %s, %s\n", args[0], args[1]);
+  loop_depth++;
+  for (;;) {
+    int condition = run_list(node->condition);
+    if (loop_breaks > 0 || loop_continues > 0 || interrupted) {
+      if (loop_done())
+        break;
+      continue;
+    }
+    if ((condition == 0) != (node->type == NODE_WHILE))
+      break;
+    status = run_list(node->body);
+    if (loop_done())
+      break;
+  }
+  loop_depth--;
+  return status;
+}
 
-      /* Check pipe state */
-      if (pipe(curpipe) == -1) {
-        perror("pipe cannot be created");
-        return;
-      }
+/* The words are expanded once, before the first pass */
+static int run_for(struct node *node) {
+  int status = 0;
+  char **items = (char **)malloc(sizeof(char *) * (node->items_length + 1));
+  memcpy(items, node->items, sizeof(char *) * node->items_length);
+  items[node->items_length] = NULL;
+  char **words = expand_words(items, node->item_flags, true);
+  free(items);
+
+  loop_depth++;
+  for (char **word = words; *word; word++) {
+    vars_set(node->name, *word);
+    status = run_list(node->body);
+    if (loop_done())
+      break;
+  }
+  loop_depth--;
+  free_words(words);
+  return status;
+}
 
-      /* If the program is the first one, it reads from STDIN */
-      if (prevpipe[PIPE_READ] == -1)
-        program_exec(args, STDIN_FILENO, curpipe[PIPE_WRITE]);
-      else 
-        program_exec(args, prevpipe[PIPE_READ], curpipe[PIPE_WRITE]);
+/* Whether the subject matches a pattern of case. What an expansion gives is a pattern itself,
+ * unless the word was quoted and had no pattern character of its own outside of the quotes. */
+static bool match_pattern(const char *pattern, int flags, const char *subject) {
+  if (!(flags & TOKEN_EXPAND))
+    return fnmatch(pattern, subject, 0) == 0;
+  char *expanded = expand_word(pattern);
+  if ((flags & TOKEN_QUOTED) && !(flags & TOKEN_GLOB)) {
+    char *escaped = pathglob_escape(expanded);
+    free(expanded);
+    expanded = escaped;
+  }
+  bool matched = fnmatch(expanded, subject, 0) == 0;
+  free(expanded);
+  return matched;
+}
 
-      /* Close the used pipes */
-      if (prevpipe[PIPE_READ] != -1) {
-        close(prevpipe[PIPE_READ]);
-        close(prevpipe[PIPE_WRITE]);
+static int run_case(struct node *node) {
+  char *subject = node->name_flags & TOKEN_EXPAND ? expand_word(node->name) : strdup(node->name);
+  int status = 0;
+
+  for (size_t i = 0; i < node->arms_length; i++) {
+    struct case_arm *arm = &node->arms[i];
+    for (size_t j = 0; j < arm->patterns_length; j++) {
+      if (match_pattern(arm->patterns[j], arm->pattern_flags[j], subject)) {
+        status = run_list(arm->body);
+        free(subject);
+        return status;
       }
+    }
+  }
+  free(subject);
+  return status;
+}
+
+static int run_node(struct node *node);
+static int run_compound(struct node *node);
+
+/* Make a forked child of the shell a script of its own, run without job control */
+static void subshell_setup(void) {
+  jobs_unblock();
+  shell_is_interactive = false;
+  jobs_print_status = false;
+  /* Its output is read by the shell already */
+  capture_size = 0;
+  shell_exit_ends_input = false;
+  jobs_group = getpgrp();
+  stdin_reader = NULL;
+  loop_depth = loop_breaks = loop_continues = 0;
+  jobs_forked();
+  /* The ring mapped by the shell is shared with it, so the child sets up one of its own */
+  if (uring_enabled) {
+    uring_close();
+    uring_enabled = uring_open() == 0;
+  }
+  signal(SIGINT, SIG_DFL);
+  signal(SIGQUIT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+}
 
-      memcpy(prevpipe, curpipe, sizeof(prevpipe));
-      /* Reset the index for program arguments */
-      args[0] = curtok;
-      j = 1;
+/* Fork a copy of the shell that runs one stage of a pipe and exits with its status. The read end
+ * of the pipe the stage writes to is closed in the child, or a writer whose reader went away
+ * would never see SIGPIPE. */
+static pid_t stage_exec(struct node *stage, int pipein, int pipeout, int next_read, pid_t pgid) {
+  static const struct redirects none;
 
-      /* Reset the redirection flags */
-      input_redirect = 0;
-      output_redirect = 0;
-    } else if (!strcmp(prevtok, "<")) {
-      args[j - 2] = NULL;
-      strcpy(inbuf, curtok);
-      input_redirect = 1;
-    } else if (!strcmp(prevtok, ">")) {
-      args[j - 2] = NULL;
-      strcpy(outbuf, curtok);
-      output_redirect = 1;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (child_setup(&none, pipein, pipeout, pgid) == -1)
+      _exit(EXIT_FAILURE);
+    launch_terminal = -1;
+    if (pipein != STDIN_FILENO)
+      close(pipein);
+    if (pipeout != STDOUT_FILENO)
+      close(pipeout);
+    if (next_read != -1)
+      close(next_read);
+    subshell_setup();
+    int status = run_node(stage);
+    fflush(stdout);
+    exit(status);
+  } else if (pid == -1) {
+    printf("Failed to create new process: %s.\n", strerror(errno));
+  } else if (setpgid(pid, pgid ? pgid : pid) < 0 && errno != EACCES) {
+    perror("setpgid failed");
+  }
+  return pid;
+}
+
+/* Run a pipe with a compound command in it as one foreground job, every stage in a copy of the
+ * shell of its own. The status is the one of the last stage. */
+static int run_pipe(struct node *node) {
+  struct job *job = job_create(node->name);
+  int pipein = STDIN_FILENO, curpipe[2];
+  size_t index = 0;
+
+  jobs_block();
+  launch_terminal = shell_is_interactive ? shell_terminal : -1;
+  for (struct node *stage = node->body; stage; stage = stage->next, index++) {
+    int pipeout = STDOUT_FILENO;
+    curpipe[PIPE_READ] = -1;
+    if (stage->next) {
+      if (pipe2(curpipe, O_CLOEXEC) == -1) {
+        perror("pipe cannot be created");
+        break;
+      }
+      pipeout = curpipe[PIPE_WRITE];
+      optimize_pipe(pipeout, job->id, index);
     }
 
-    prevtok = curtok;
+    uint64_t started = stats_clock();
+    pid_t pid = stage_exec(stage, pipein, pipeout, curpipe[PIPE_READ], job->pgid);
+    if (pid > 0)
+      job_add_process(job, pid, node_text(stage), started);
+
+    if (pipein != STDIN_FILENO)
+      close(pipein);
+    if (pipeout != STDOUT_FILENO)
+      close(pipeout);
+    pipein = curpipe[PIPE_READ];
+  }
+  if (pipein != STDIN_FILENO && pipein != -1)
+    close(pipein);
+  launch_terminal = -1;
+  jobs_unblock();
+
+  if (job->procs_length == 0) {
+    job_remove(job);
+    return 1;
+  }
+  return exit_status(job_foreground(job, false));
+}
+
+/* Run a compound command with its redirections applied to the shell's own descriptors while it
+ * runs, like a builtin */
+static int run_redirected(struct node *node) {
+  struct redirects *redirects = &node->redirects;
+  int *saved = (int *)malloc(sizeof(int) * (redirects->length + 1));
+  int status = 1;
+
+  fflush(stdout);
+  if (redirects_prepare(redirects) == 0) {
+    if (redirects_apply(redirects, saved) == 0)
+      status = run_compound(node);
+    fflush(stdout);
+    redirects_restore(redirects, saved);
+    redirects_release(redirects);
   }
+  free(saved);
+  return status;
+}
 
-  args[j] = NULL;
-  // printf("exec: %s, %s, %d, %d\n", args[0], args[1], curpipe[PIPE_READ], STDOUT_FILENO);
-  /* The last one output to STDOUT if no redirection */
-  program_exec(args, curpipe[PIPE_READ], STDOUT_FILENO);
+static int run_node(struct node *node) {
+  int status = node->redirects.length > 0 ? run_redirected(node) : run_compound(node);
+  return node->negate ? !status : status;
+}
 
-  /* Close the used pipes */
-  if (prevpipe[PIPE_READ] != -1) {
-    close(prevpipe[PIPE_READ]);
-    close(prevpipe[PIPE_WRITE]);
+/* Run the node itself, leaving its redirections and ! to run_node */
+static int run_compound(struct node *node) {
+  int status = 0;
+
+  switch (node->type) {
+  case NODE_PIPELINE:
+    status = run_pipeline(node->pipeline);
+    break;
+  case NODE_IF:
+    if (run_list(node->condition) == 0)
+      status = run_list(node->body);
+    else if (node->otherwise)
+      status = run_list(node->otherwise);
+    break;
+  case NODE_WHILE:
+  case NODE_UNTIL:
+    status = run_loop(node);
+    break;
+  case NODE_FOR:
+    status = run_for(node);
+    break;
+  case NODE_CASE:
+    status = run_case(node);
+    break;
+  case NODE_PIPE:
+    status = run_pipe(node);
+    break;
   }
+  return status;
+}
 
-  free(args);
+/* Run the commands of a list that their connectors allow, and return the status of the last one
+ * that ran. A pending break or continue skips the rest. */
+static int run_list(struct node *list) {
+  int status = 0;
+
+  for (; list; list = list->next) {
+    if (loop_breaks > 0 || loop_continues > 0 || interrupted)
+      break;
+    if ((list->connector == CONNECT_AND && status != 0) ||
+        (list->connector == CONNECT_OR && status == 0))
+      continue;
+    status = shell_status = run_node(list);
+  }
+  return status;
 }
 
 void command_not_found(const char *cmd) {
   printf("%s: command not found.\n", cmd);
 }
 
-int main(unused int argc, unused char *argv[]) {
-  init_shell();
-  
-  static char line[4096];
+/* Open a script for reading. Regular files are mapped whole, anything else is read through a
+ * buffer. The mapping, or the descriptor that is read from, is returned through map, map_length
+ * and script_fd so they can be released later. */
+struct reader *open_script(const char *path, void **map, size_t *map_length, int *script_fd) {
+  struct stat st;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    printf("%s: %s.\n", path, strerror(errno));
+    return NULL;
+  }
+
+  *map = NULL;
+  *map_length = 0;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    if (st.st_size > 0) {
+      void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        printf("%s: %s.\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+      }
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      *map = data;
+      *map_length = st.st_size;
+    }
+    close(fd);
+    return reader_open_buffer(*map, *map_length);
+  }
+  *script_fd = fd;
+  return reader_open(fd);
+}
+
+/* Runs every line the reader gives until the input ends */
+void run_input(struct reader *input) {
+  const char *line;
+  ssize_t line_length;
   int line_num = 0;
+  char prompt[32];
 
-  /* Please only print shell prompts when standard input is not a tty */
-  if (shell_is_interactive)
-    fprintf(stdout, "%d: ", line_num);
+  /* One list of words is reused for every line of the session */
+  struct tokens *tokens = tokens_create();
+  heredoc_input = input;
+  exit_pending = false;
 
-  while (fgets(line, 4096, stdin)) {
-    /* Split our line into words. */
-    struct tokens *tokens = tokenize(line);
+  /* Please only print shell prompts when standard input is not a tty */
+  if (shell_is_interactive) {
+    snprintf(prompt, sizeof(prompt), "%d: ", line_num);
+    reader_prompt(input, prompt);
+  }
 
-    /* Find which built-in function to run. */
-    int fundex = lookup(tokens_get_token(tokens, 0));
+  while ((line_length = reader_getline(input, &line)) != -1) {
+    /* A line that ran before goes straight to execution */
+    uint64_t started = stats_clock();
+    struct node *list = parse_cache_find(line, line_length);
+    stats_add(STATS_PARSE, started);
+    bool empty = false, cacheable = true;
 
-    /* Clear the input and output redirection flag */
-    input_redirect = 0;
-    output_redirect = 0;
+    if (!list) {
+      /* Split our line into words. */
+      started = stats_clock();
+      tokenize_buffer(tokens, line, line_length);
+      stats_add(STATS_TOKENIZE, started);
 
-    if (fundex >= 0) {
-      cmd_table[fundex].fun(tokens);
-    } else if (tokens_get_token(tokens, 0)) {
       /* Skip empty input */
-      piped_exec(tokens);
+      empty = tokens_get_length(tokens) == 0;
+      if (!empty) {
+        list = parse_tokens(tokens, &cacheable);
+
+        /* Cached before it runs, since running may read on, past the line. The line is only a
+         * key for lists that did not go on over the lines after it. */
+        if (list && cacheable)
+          parse_cache_add(line, line_length, list);
+      }
     }
 
-    if (shell_is_interactive)
+    if (list) {
+      interrupted = false;
+      run_list(list);
+      if (!cacheable)
+        list_free(list);
+      /* Directories read for patterns are only trusted within a line */
+      pathglob_cache_clear();
+    }
+
+    /* Report and forget background jobs that have finished */
+    jobs_notify();
+    if (!empty)
+      stats_line_done();
+    if (exit_pending) {
+      shell_status = exit_pending_status;
+      break;
+    }
+
+    if (shell_is_interactive) {
       /* Please only print shell prompts when standard input is not a tty */
-      fprintf(stdout, "%d: ", ++line_num);
+      snprintf(prompt, sizeof(prompt), "%d: ", ++line_num);
+      reader_prompt(input, prompt);
+    }
+  }
+
+  /* Clean up memory */
+  tokens_destroy(tokens);
+}
+
+void shell_subshell(const char *commands, size_t length) {
+  /* The child of a substitution is a script of its own, run without job control */
+  subshell_setup();
+
+  struct reader *input = reader_open_buffer(commands, length);
+  run_input(input);
+  reader_close(input);
+  fflush(stdout);
+  exit(shell_status);
+}
+
+/* Run a setting restored from a snapshot, as the builtin that made it */
+static void apply_setting(int argc, char **argv) {
+  int fundex = dispatch_find(&cmd_index, argv[0]);
+  if (fundex >= 0)
+    cmd_table[fundex].fun(argc, argv);
+}
+
+/* Run the rc file, unless its snapshot is still good and gives the state it would leave */
+static void load_rc(void) {
+  const char *path = vars_get("SHELLRC"), *home = vars_get("HOME");
+  if (path)
+    rc_path = strdup(path);
+  else if (!home || asprintf(&rc_path, "%s/.shellrc", home) == -1)
+    rc_path = NULL;
+  if (!rc_path || asprintf(&rc_snapshot_path, "%s.snap", rc_path) == -1 ||
+      access(rc_path, F_OK) == -1)
+    return;
+  if (snapshot_load(rc_snapshot_path, rc_path, apply_setting))
+    return;
+
+  void *map = NULL;
+  size_t map_length = 0;
+  int fd = -1;
+  struct reader *input = open_script(rc_path, &map, &map_length, &fd);
+  if (!input)
+    return;
+  run_input(input);
+  reader_close(input);
+  if (fd != -1)
+    close(fd);
+  if (map)
+    munmap(map, map_length);
+}
+
+int main(int argc, char *argv[]) {
+  struct reader *input;
+  void *map = NULL;
+  size_t map_length = 0;
+  int script_fd = -1;
 
-    /* Clean up memory */
-    tokens_destroy(tokens);
+  if (argc > 1 && !strcmp(argv[1], "-c")) {
+    if (argc < 3) {
+      printf("-c: option requires an argument.\n");
+      return 2;
+    }
+    /* shell -c 'commands' */
+    init_shell(false);
+    load_rc();
+    input = reader_open_buffer(argv[2], strlen(argv[2]));
+  } else if (argc > 1 && !strcmp(argv[1], "--serve")) {
+    /* shell --serve [socket]: command records in, framed replies out */
+    init_shell(false);
+    return serve_run(argv[2]);
+  } else if (argc > 1) {
+    /* shell script.sh */
+    init_shell(false);
+    load_rc();
+    input = open_script(argv[1], &map, &map_length, &script_fd);
+    if (!input) {
+      fflush(stdout);
+      return 127;
+    }
+  } else {
+    init_shell(true);
+    load_rc();
+    if (shell_is_interactive) {
+      /* Lines are edited on the terminal and kept in $HISTFILE, by default ~/.shell_history */
+      const char *path = vars_get("HISTFILE"), *home = vars_get("HOME");
+      char *fallback = NULL;
+      if (!path && home && asprintf(&fallback, "%s/.shell_history", home) != -1)
+        path = fallback;
+      if (path)
+        history_open(path);
+      free(fallback);
+      input = stdin_reader = reader_open_source(editor_getline);
+    } else {
+      input = stdin_reader = reader_open(STDIN_FILENO);
+    }
+    fstat(STDIN_FILENO, &stdin_stat);
   }
 
-  return 0;
+  run_input(input);
+
+  history_close();
+  reader_close(input);
+  if (script_fd != -1)
+    close(script_fd);
+  if (map)
+    munmap(map, map_length);
+  return shell_status;
 }
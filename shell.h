@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <termios.h>
+
+struct reader;
+
+/* Whether the shell is connected to an actual terminal or not. */
+extern bool shell_is_interactive;
+
+/* File descriptor for the shell input */
+extern int shell_terminal;
+
+/* Terminal mode settings for the shell */
+extern struct termios shell_tmodes;
+
+/* Process group id for the shell */
+extern pid_t shell_pgid;
+
+/* Exit status of the last command, 0 for success */
+extern int shell_status;
+
+/* Process id of the last command started in the background, 0 before there is one */
+extern pid_t shell_background_pid;
+
+/* Whether exit ends the input being run instead of the shell, as it does in server mode */
+extern bool shell_exit_ends_input;
+
+/* The reader the shell takes its commands from when they come from standard input, for a builtin
+ * reading standard input to share what it has read ahead. NULL if the commands come from
+ * elsewhere or standard input was redirected since. */
+struct reader *shell_stdin_reader(void);
+
+/* Run every command line of the input, as a script is run */
+void run_input(struct reader *input);
+
+/* Run the commands in this process, a child forked for a command substitution, and exit with
+ * their status. SIGCHLD is expected to be blocked once by jobs_block, as it is around the fork. */
+void shell_subshell(const char *commands, size_t length) __attribute__((noreturn));
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pathres.h"
+#include "snapshot.h"
+#include "vars.h"
+
+/* The first bytes of a snapshot. The version changes with the layout of the records, which are
+ * written in the byte order of the machine and only read back on it. */
+#define SNAPSHOT_MAGIC "shsnap\0"
+#define SNAPSHOT_VERSION 1
+
+/* Settings have at most this many words */
+#define SNAPSHOT_WORDS_MAX 16
+
+struct snapshot_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t records;
+  /* Of the whole file, and FNV-1a of everything after the header */
+  uint64_t size;
+  uint64_t checksum;
+  /* The rc file the state came from, as it was when the snapshot was taken */
+  uint64_t rc_dev;
+  uint64_t rc_ino;
+  uint64_t rc_size;
+  int64_t rc_mtime_sec;
+  int64_t rc_mtime_nsec;
+};
+
+enum record_kind {
+  /* The PATH the shell was started with, no word if it was not set */
+  RECORD_START_PATH = 1,
+  /* A variable, its name and value, exported if numbers[0] is set */
+  RECORD_VARIABLE,
+  /* The words of a builtin command that restores a setting */
+  RECORD_SETTING,
+  /* A resolved command: the PATH of the cache and the name, with the index of the directory and
+   * the seconds and nanoseconds of its modification time as numbers */
+  RECORD_COMMAND,
+};
+
+/* Every record is this header, then its words one after the other, each ending with a NUL, padded
+ * so that the next record is aligned */
+struct snapshot_record {
+  uint16_t kind;
+  uint16_t words;
+  uint32_t length;
+  int64_t numbers[3];
+};
+
+struct buffer {
+  char *data;
+  size_t length;
+  size_t capacity;
+  uint32_t records;
+};
+
+/* FNV-1a, 64 bits */
+static uint64_t checksum(const char *data, size_t length) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < length; i++)
+    h = (h ^ (unsigned char) data[i]) * 1099511628211ull;
+  return h;
+}
+
+static void *reserve(struct buffer *buffer, size_t n) {
+  if (buffer->length + n > buffer->capacity) {
+    buffer->capacity = (buffer->length + n) * 2;
+    buffer->data = (char *) realloc(buffer->data, buffer->capacity);
+  }
+  void *at = buffer->data + buffer->length;
+  memset(at, 0, n);
+  buffer->length += n;
+  return at;
+}
+
+static void add_record(struct buffer *buffer, enum record_kind kind, const int64_t numbers[3],
+                       const char *const *words, size_t length) {
+  size_t bytes = 0;
+  for (size_t i = 0; i < length; i++)
+    bytes += strlen(words[i]) + 1;
+  bytes = (bytes + 7) & ~(size_t) 7;
+
+  size_t at = buffer->length;
+  reserve(buffer, sizeof(struct snapshot_record) + bytes);
+  struct snapshot_record *record = (struct snapshot_record *) (buffer->data + at);
+  record->kind = (uint16_t) kind;
+  record->words = (uint16_t) length;
+  record->length = (uint32_t) bytes;
+  if (numbers)
+    memcpy(record->numbers, numbers, sizeof(record->numbers));
+  char *p = (char *) (record + 1);
+  for (size_t i = 0; i < length; i++) {
+    size_t n = strlen(words[i]) + 1;
+    memcpy(p, words[i], n);
+    p += n;
+  }
+  buffer->records++;
+}
+
+/* Variables the shell started with are kept out, they come from the environment anyway */
+static void add_variable(const char *name, const char *value, bool exported, void *data) {
+  const char *initial = getenv(name);
+  if (initial && exported && !strcmp(initial, value))
+    return;
+  const char *words[] = {name, value};
+  int64_t numbers[3] = {exported, 0, 0};
+  add_record((struct buffer *) data, RECORD_VARIABLE, numbers, words, 2);
+}
+
+static void add_command(const char *path, const char *name, size_t dir,
+                        const struct timespec *mtime, void *data) {
+  const char *words[] = {path, name};
+  int64_t numbers[3] = {(int64_t) dir, (int64_t) mtime->tv_sec, (int64_t) mtime->tv_nsec};
+  add_record((struct buffer *) data, RECORD_COMMAND, numbers, words, 2);
+}
+
+int snapshot_write(const char *path, const char *rc, char ***settings, size_t length) {
+  struct stat st;
+  if (stat(rc, &st) == -1)
+    return -1;
+
+  struct buffer buffer = {NULL, 0, 0, 0};
+  reserve(&buffer, sizeof(struct snapshot_header));
+  /* The environment of the shell is the one it was started with, the variables are copies */
+  const char *start_path = getenv("PATH");
+  add_record(&buffer, RECORD_START_PATH, NULL, &start_path, start_path ? 1 : 0);
+  vars_visit(add_variable, &buffer);
+  for (size_t i = 0; i < length; i++) {
+    size_t words = 0;
+    while (settings[i][words] && words < SNAPSHOT_WORDS_MAX)
+      words++;
+    add_record(&buffer, RECORD_SETTING, NULL, (const char *const *) settings[i], words);
+  }
+  /* Last, so that the variables set PATH before the commands are put back */
+  pathres_visit_cached(add_command, &buffer);
+
+  struct snapshot_header *header = (struct snapshot_header *) buffer.data;
+  memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+  header->version = SNAPSHOT_VERSION;
+  header->records = buffer.records;
+  header->size = buffer.length;
+  header->checksum = checksum(buffer.data + sizeof(*header), buffer.length - sizeof(*header));
+  header->rc_dev = st.st_dev;
+  header->rc_ino = st.st_ino;
+  header->rc_size = (uint64_t) st.st_size;
+  header->rc_mtime_sec = st.st_mtim.tv_sec;
+  header->rc_mtime_nsec = st.st_mtim.tv_nsec;
+
+  /* Written next to it and renamed over it, so a shell starting meanwhile never sees half of it */
+  char *temp = NULL;
+  int fd = -1;
+  if (asprintf(&temp, "%s.XXXXXX", path) != -1)
+    fd = mkostemp(temp, O_CLOEXEC);
+  bool written = fd != -1;
+  for (size_t done = 0; written && done < buffer.length;) {
+    ssize_t n = write(fd, buffer.data + done, buffer.length - done);
+    if (n == -1 && errno == EINTR)
+      continue;
+    written = n > 0;
+    done += written ? (size_t) n : 0;
+  }
+  int saved_errno = errno;
+  if (fd != -1 && close(fd) == -1 && written) {
+    written = false;
+    saved_errno = errno;
+  }
+  if (written && rename(temp, path) == -1) {
+    written = false;
+    saved_errno = errno;
+  }
+  if (!written && fd != -1)
+    unlink(temp);
+  free(temp);
+  free(buffer.data);
+  errno = saved_errno;
+  return written ? 0 : -1;
+}
+
+/* The words of the record, checked to end inside it. Returns false if the record is damaged. */
+static bool record_words(const struct snapshot_record *record, char **words) {
+  char *p = (char *) (record + 1), *end = p + record->length;
+  if (record->words > SNAPSHOT_WORDS_MAX)
+    return false;
+  for (size_t i = 0; i < record->words; i++) {
+    char *nul = (char *) memchr(p, '\0', (size_t) (end - p));
+    if (!nul)
+      return false;
+    words[i] = p;
+    p = nul + 1;
+  }
+  words[record->words] = NULL;
+  return true;
+}
+
+/* Whether every record is whole, the first one being the PATH the shell was started with */
+static bool records_valid(char *data, size_t size, uint32_t records) {
+  char *p = data + sizeof(struct snapshot_header), *end = data + size;
+  char *words[SNAPSHOT_WORDS_MAX + 1];
+
+  for (uint32_t i = 0; i < records; i++) {
+    struct snapshot_record *record = (struct snapshot_record *) p;
+    if ((size_t) (end - p) < sizeof(*record) ||
+        record->length > (size_t) (end - p) - sizeof(*record) || record->length % 8 ||
+        !record_words(record, words))
+      return false;
+    if (i == 0) {
+      const char *start_path = getenv("PATH");
+      if (record->kind != RECORD_START_PATH || record->words != (start_path ? 1 : 0) ||
+          (start_path && strcmp(words[0], start_path)))
+        return false;
+    } else if ((record->kind == RECORD_VARIABLE || record->kind == RECORD_COMMAND) &&
+               record->words != 2) {
+      return false;
+    }
+    p += sizeof(*record) + record->length;
+  }
+  return p == end;
+}
+
+bool snapshot_load(const char *path, const char *rc, snapshot_apply_t *apply) {
+  struct stat st, rc_st;
+
+  if (stat(rc, &rc_st) == -1)
+    return false;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(struct snapshot_header)) {
+    close(fd);
+    return false;
+  }
+  /* Private and writable, for the settings to be handed over as argv. The words point into it
+   * only while a record is applied: variables and commands are copied by vars_set and
+   * pathres_restore, and the builtins keep copies of what they need, so it is unmapped after. */
+  char *data = (char *) mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  const struct snapshot_header *header = (const struct snapshot_header *) data;
+  size_t size = (size_t) st.st_size;
+  bool valid =
+      !memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) &&
+      header->version == SNAPSHOT_VERSION && header->size == size &&
+      header->rc_dev == rc_st.st_dev && header->rc_ino == rc_st.st_ino &&
+      header->rc_size == (uint64_t) rc_st.st_size && header->rc_mtime_sec == rc_st.st_mtim.tv_sec &&
+      header->rc_mtime_nsec == rc_st.st_mtim.tv_nsec &&
+      header->checksum == checksum(data + sizeof(*header), size - sizeof(*header)) &&
+      records_valid(data, size, header->records);
+
+  char *p = data + sizeof(*header);
+  char *words[SNAPSHOT_WORDS_MAX + 1];
+  for (uint32_t i = 0; valid && i < header->records; i++) {
+    struct snapshot_record *record = (struct snapshot_record *) p;
+    record_words(record, words);
+    p += sizeof(*record) + record->length;
+    if (record->kind == RECORD_VARIABLE && record->numbers[0])
+      vars_export(words[0], words[1]);
+    else if (record->kind == RECORD_VARIABLE)
+      vars_set(words[0], words[1]);
+    else if (record->kind == RECORD_SETTING && record->words > 0)
+      apply(record->words, words);
+    else if (record->kind == RECORD_COMMAND) {
+      struct timespec mtime = {(time_t) record->numbers[1], (long) record->numbers[2]};
+      pathres_restore(words[0], words[1], (size_t) record->numbers[0], &mtime);
+    }
+  }
+  munmap(data, size);
+  return valid;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Snapshots of the state an rc file leaves behind, so that a shell started with the same rc file
+ * and PATH can take that state from one mmap instead of tokenizing and running the file. A
+ * snapshot holds the variables that differ from the environment the shell started with, the
+ * builtin settings as the commands that make them and the PATH cache, each record in place in the
+ * file. It is tied to the identity and modification time of the rc file and to the PATH the shell
+ * was started with, and is ignored once either changed. */
+
+/* A setting to restore, as the words of the builtin command that makes it */
+typedef void snapshot_apply_t(int argc, char **argv);
+
+/* Write the snapshot for the rc file to path, replacing the old one at once. settings holds
+ * length commands, each a NULL terminated list of words. Returns -1 with errno set. */
+int snapshot_write(const char *path, const char *rc, char ***settings, size_t length);
+
+/* Restore the state from the snapshot at path, passing every setting to apply. Returns false,
+ * having changed nothing, if there is no snapshot or it is damaged or stale. */
+bool snapshot_load(const char *path, const char *rc, snapshot_apply_t *apply);
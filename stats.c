@@ -0,0 +1,156 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "cgroup.h"
+#include "jobs.h"
+#include "stats.h"
+
+int stats_fd = -1;
+
+static const char *phase_names[STATS_PHASES] = {"tokenize", "parse", "lookup", "pathres", "launch"};
+
+/* Nanoseconds spent in each phase on the current line */
+static uint64_t phase_ns[STATS_PHASES];
+
+uint64_t stats_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_add(enum stats_phase phase, uint64_t start) {
+  phase_ns[phase] += stats_clock() - start;
+}
+
+static uint64_t timeval_us(struct timeval tv) {
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* The exit code, or 128 plus the signal for a killed process */
+static int exit_code(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return 0;
+}
+
+/* What the whole job used: read from its cgroup, which counts every process that ran in it, or
+ * else summed over the usage of its stages, with the largest of their peaks */
+static const char *job_usage(const struct job *job, struct cgroup_usage *usage) {
+  if (job->cgroup) {
+    cgroup_usage(job->cgroup, usage);
+    if (usage->user_us != -1)
+      return "cgroup";
+  }
+  memset(usage, 0, sizeof(*usage));
+  for (size_t i = 0; i < job->procs_length; i++) {
+    const struct rusage *rusage = &job->procs[i].rusage;
+    usage->user_us += (int64_t) timeval_us(rusage->ru_utime);
+    usage->sys_us += (int64_t) timeval_us(rusage->ru_stime);
+    if (rusage->ru_maxrss * 1024 > usage->memory_peak)
+      usage->memory_peak = (int64_t) rusage->ru_maxrss * 1024;
+    /* Blocks of 512 bytes */
+    usage->io_read += (int64_t) rusage->ru_inblock * 512;
+    usage->io_write += (int64_t) rusage->ru_oublock * 512;
+  }
+  return "rusage";
+}
+
+/* The totals of the job, after the records of its stages */
+static void report_job(const struct job *job) {
+  struct cgroup_usage usage;
+  const char *source = job_usage(job, &usage);
+  uint64_t started = job->procs[0].started, ended = job->procs[0].ended;
+  for (size_t i = 1; i < job->procs_length; i++) {
+    if (job->procs[i].started < started)
+      started = job->procs[i].started;
+    if (job->procs[i].ended > ended)
+      ended = job->procs[i].ended;
+  }
+  uint64_t wall_us = (ended - started) / 1000;
+
+  if (job->timed) {
+    fprintf(stderr, "job: real %llu.%06llus user %lld.%06llds sys %lld.%06llds",
+            (unsigned long long) wall_us / 1000000, (unsigned long long) wall_us % 1000000,
+            (long long) usage.user_us / 1000000, (long long) usage.user_us % 1000000,
+            (long long) usage.sys_us / 1000000, (long long) usage.sys_us % 1000000);
+    if (usage.memory_peak != -1)
+      fprintf(stderr, " peak %lldKB", (long long) usage.memory_peak / 1024);
+    if (usage.io_read != -1)
+      fprintf(stderr, " read %lldB written %lldB", (long long) usage.io_read,
+              (long long) usage.io_write);
+    fprintf(stderr, " (%s)\n", source);
+  }
+  if (stats_fd != -1) {
+    dprintf(stats_fd, "job id=%d source=%s wall_us=%llu user_us=%lld sys_us=%lld", job->id, source,
+            (unsigned long long) wall_us, (long long) usage.user_us, (long long) usage.sys_us);
+    if (usage.memory_peak != -1)
+      dprintf(stats_fd, " mem_peak_kb=%lld", (long long) usage.memory_peak / 1024);
+    if (usage.io_read != -1)
+      dprintf(stats_fd, " io_read_bytes=%lld io_write_bytes=%lld", (long long) usage.io_read,
+              (long long) usage.io_write);
+    dprintf(stats_fd, "\n");
+  }
+}
+
+void stats_job(struct job *job) {
+  for (size_t i = 0; i < job->procs_length; i++) {
+    struct process *p = &job->procs[i];
+    uint64_t wall_us = (p->ended - p->started) / 1000;
+    uint64_t user_us = timeval_us(p->rusage.ru_utime);
+    uint64_t sys_us = timeval_us(p->rusage.ru_stime);
+
+    if (job->timed) {
+      fprintf(stderr, "%s: real %llu.%06llus user %llu.%06llus sys %llu.%06llus maxrss %ldKB\n",
+              p->name, (unsigned long long) wall_us / 1000000,
+              (unsigned long long) wall_us % 1000000, (unsigned long long) user_us / 1000000,
+              (unsigned long long) user_us % 1000000, (unsigned long long) sys_us / 1000000,
+              (unsigned long long) sys_us % 1000000, p->rusage.ru_maxrss);
+    }
+    if (stats_fd != -1) {
+      dprintf(stats_fd,
+              "stage job=%d index=%zu pid=%d cmd=%s exit=%d wall_us=%llu user_us=%llu "
+              "sys_us=%llu maxrss_kb=%ld\n",
+              job->id, i, (int) p->pid, p->name, exit_code(p->status),
+              (unsigned long long) wall_us, (unsigned long long) user_us,
+              (unsigned long long) sys_us, p->rusage.ru_maxrss);
+    }
+  }
+
+  report_job(job);
+
+  if (job->timed) {
+    fprintf(stderr, "shell:");
+    for (int i = 0; i < STATS_PHASES; i++)
+      fprintf(stderr, " %s %lluus", phase_names[i], (unsigned long long) phase_ns[i] / 1000);
+    fprintf(stderr, "\n");
+  }
+}
+
+void stats_rewrite(const char *kind, const char *format, ...) {
+  va_list ap;
+  if (stats_fd == -1)
+    return;
+  dprintf(stats_fd, "rewrite kind=%s ", kind);
+  va_start(ap, format);
+  vdprintf(stats_fd, format, ap);
+  va_end(ap);
+  dprintf(stats_fd, "\n");
+}
+
+void stats_line_done(void) {
+  if (stats_fd != -1) {
+    dprintf(stats_fd,
+            "shell tokenize_us=%llu parse_us=%llu lookup_us=%llu pathres_us=%llu launch_us=%llu\n",
+            (unsigned long long) phase_ns[STATS_TOKENIZE] / 1000,
+            (unsigned long long) phase_ns[STATS_PARSE] / 1000,
+            (unsigned long long) phase_ns[STATS_LOOKUP] / 1000,
+            (unsigned long long) phase_ns[STATS_PATHRES] / 1000,
+            (unsigned long long) phase_ns[STATS_LAUNCH] / 1000);
+  }
+  for (int i = 0; i < STATS_PHASES; i++)
+    phase_ns[i] = 0;
+}
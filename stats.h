@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+struct job;
+
+/* Where the shell itself spends time while running a command line */
+enum stats_phase {
+  STATS_TOKENIZE,
+  STATS_PARSE,
+  STATS_LOOKUP,
+  STATS_PATHRES,
+  STATS_LAUNCH,
+  STATS_PHASES,
+};
+
+/* Descriptor that stats mode writes its records to, or -1 when stats mode is off */
+extern int stats_fd;
+
+/* Monotonic time in nanoseconds. Safe to call from a signal handler. */
+uint64_t stats_clock(void);
+
+/* Add the time since start, as returned by stats_clock, to a phase of the current line */
+void stats_add(enum stats_phase phase, uint64_t start);
+
+/* Report a job that is about to be removed from the table: to stderr if it was run by the time
+ * builtin, and as stage records in stats mode. Both end with the totals of the job, read from its
+ * cgroup when it ran in one. */
+void stats_job(struct job *job);
+
+/* Write a record in stats mode of something the optimizer changed, its kind followed by the
+ * fields of the format */
+void stats_rewrite(const char *kind, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Finish the current command line, writing the time the shell spent on it in stats mode */
+void stats_line_done(void);
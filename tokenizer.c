@@ -1,27 +1,218 @@
-#include <ctype.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include "scan.h"
 #include "tokenizer.h"
 
+/* All words of a line live in one arena: buffer holds the unescaped bytes of every word, each
+ * terminated by NUL, offsets says where each word starts and flags how it was written. */
 struct tokens {
   size_t tokens_length;
-  char **tokens;
-  size_t buffers_length;
-  char **buffers;
+  size_t *offsets;
+  unsigned char *flags;
+  size_t offsets_capacity;
+  char *buffer;
+  size_t buffer_capacity;
 };
 
-static void *vector_push(char ***pointer, size_t *size, void *elem) {
-  *pointer = (char**) realloc(*pointer, sizeof(char *) * (*size + 1));
-  (*pointer)[*size] = elem;
-  *size += 1;
-  return elem;
+/* Record a word starting at offset, growing the offset array geometrically */
+static void push_offset(struct tokens *tokens, size_t offset, unsigned char flags) {
+  if (tokens->tokens_length == tokens->offsets_capacity) {
+    tokens->offsets_capacity = tokens->offsets_capacity ? tokens->offsets_capacity * 2 : 16;
+    tokens->offsets =
+        (size_t *) realloc(tokens->offsets, sizeof(size_t) * tokens->offsets_capacity);
+    tokens->flags = (unsigned char *) realloc(tokens->flags, tokens->offsets_capacity);
+  }
+  tokens->flags[tokens->tokens_length] = flags;
+  tokens->offsets[tokens->tokens_length++] = offset;
+}
+
+/* What is known about the word being built */
+struct word {
+  size_t start;
+  unsigned char flags;
+  /* Quoted dollars were stored as TOKEN_LITERAL_DOLLAR */
+  bool literal_dollars;
+  /* Quotes and escapes after a character of a name were stored as TOKEN_NAME_END */
+  bool name_ends;
+  /* Quoted pattern characters and backslashes were stored with a backslash before them */
+  bool escapes;
+  /* Offset in the word of the first unquoted [ plus one, 0 if there is none */
+  size_t bracket;
+  /* Offset in the word of the first quote or escape plus one, 0 if there is none */
+  size_t quoted;
+};
+
+static bool is_pattern(char c) {
+  return c == '*' || c == '?' || c == '[';
+}
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+/* Whether c may be part of a variable name */
+static bool is_name(char c) {
+  return c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || is_digit(c);
+}
+
+/* Note where the quoting of the word starts, at byte n */
+static void start_quoted(struct word *word, size_t n) {
+  word->flags |= TOKEN_QUOTED;
+  if (!word->quoted)
+    word->quoted = n - word->start + 1;
+}
+
+/* Drop the backslashes put in by the tokenizer from token[start..*n), leaving the text of any
+ * command substitution as it was written */
+static void drop_escapes(char *token, size_t start, size_t *n) {
+  size_t k = start;
+  bool substitution = false;
+  for (size_t i = start; i < *n; i++) {
+    if (token[i] == TOKEN_SUBST || token[i] == TOKEN_SUBST_QUOTED)
+      substitution = true;
+    else if (token[i] == TOKEN_SUBST_END)
+      substitution = false;
+    else if (token[i] == '\\' && !substitution && i + 1 < *n)
+      i++;
+    token[k++] = token[i];
+  }
+  *n = k;
+}
+
+/* Terminate the word that ends at *n and get ready for the next one. Quoted dollars only need to
+ * stand out in words that have expansions, quoted pattern characters in patterns. */
+static void end_word(struct tokens *tokens, char *token, struct word *word, size_t *n) {
+  /* A [ is only a pattern with a ] after it, so the [ command stays a plain word */
+  size_t bracket = word->start + word->bracket;
+  if (word->bracket && memchr(token + bracket, ']', *n - bracket))
+    word->flags |= TOKEN_GLOB;
+
+  /* Only a name and an = before any quoting make an assignment */
+  size_t end = word->quoted ? word->start + word->quoted - 1 : *n;
+  size_t k = word->start;
+  if (k < end && !is_digit(token[k]))
+    while (k < end && is_name(token[k]))
+      k++;
+  if (k > word->start && k < end && token[k] == '=')
+    word->flags |= TOKEN_ASSIGNMENT;
+
+  if (word->literal_dollars && !(word->flags & TOKEN_EXPAND)) {
+    for (size_t i = word->start; i < *n; i++)
+      if (token[i] == TOKEN_LITERAL_DOLLAR)
+        token[i] = '$';
+  }
+  if (word->name_ends && !(word->flags & TOKEN_EXPAND)) {
+    size_t k = word->start;
+    for (size_t i = word->start; i < *n; i++)
+      if (token[i] != TOKEN_NAME_END)
+        token[k++] = token[i];
+    *n = k;
+  }
+  if (word->escapes && !(word->flags & TOKEN_GLOB))
+    drop_escapes(token, word->start, n);
+  token[(*n)++] = '\0';
+  push_offset(tokens, word->start, word->flags);
+  memset(word, 0, sizeof(*word));
+  word->start = *n;
+}
+
+/* Stop a variable name that the word may end with at the quote or escape that follows, which
+ * leaves no other byte and so pays for the marker */
+static void end_name(char *token, struct word *word, size_t *n) {
+  if (*n > word->start && is_name(token[*n - 1])) {
+    token[(*n)++] = TOKEN_NAME_END;
+    word->name_ends = true;
+  }
+}
+
+/* Copy a quoted run, with a backslash before every pattern character in it */
+static size_t copy_quoted(char *to, const char *from, size_t length, bool *escapes) {
+  size_t k = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (is_pattern(from[i])) {
+      to[k++] = '\\';
+      *escapes = true;
+    }
+    to[k++] = from[i];
+  }
+  return k;
+}
+
+/* Whether c is an operator when it is not quoted */
+static bool is_operator(char c) {
+  return c == ';' || c == '&' || c == '|' || c == '(' || c == ')';
+}
+
+/* Length of the part of the run s[0..run) before its first command substitution, setting
+ * *expand if that part has a $ in it. Outside of quotes the scanner already stops at a backquote,
+ * inside double quotes it has to be looked for. The ( of a $( may be just past the run, where
+ * the scanner stopped. */
+static size_t before_substitution(const char *s, size_t run, size_t available, bool quoted,
+                                  bool *expand) {
+  const char *tick = quoted ? memchr(s, '`', run) : NULL;
+  size_t end = tick ? (size_t) (tick - s) : run;
+  for (const char *d = s; (d = memchr(d, '$', end - (size_t) (d - s))); d++) {
+    *expand = true;
+    if ((size_t) (d - s) + 1 < available && d[1] == '(')
+      return (size_t) (d - s);
+  }
+  return end;
+}
+
+/* Where the quoted text that starts at line[i] ends, after its closing quote */
+static size_t skip_quoted(const char *line, size_t length, size_t i) {
+  char quote = line[i++];
+  while (i < length && line[i] != quote)
+    i += quote == '"' && line[i] == '\\' ? 2 : 1;
+  return i < length ? i + 1 : length;
+}
+
+/* Copy the command substitution at line[i] into the word between its markers and return where the
+ * line goes on. The commands of $(...) are kept as they were written, up to the parenthesis that
+ * closes the first one. In `...` a backslash only escapes `, \\ and $. */
+static size_t copy_substitution(const char *line, size_t length, size_t i, char *token, size_t *n,
+                                bool quoted) {
+  token[(*n)++] = quoted ? TOKEN_SUBST_QUOTED : TOKEN_SUBST;
+
+  if (line[i] == '`') {
+    for (i++; i < length && line[i] != '`'; i++) {
+      if (line[i] == '\\' && i + 1 < length &&
+          (line[i + 1] == '`' || line[i + 1] == '\\' || line[i + 1] == '$'))
+        i++;
+      token[(*n)++] = line[i];
+    }
+    token[(*n)++] = TOKEN_SUBST_END;
+    return i < length ? i + 1 : length;
+  }
+
+  size_t start = i + 2, j = start;
+  int depth = 1;
+  while (j < length) {
+    char c = line[j];
+    if (c == '\\') {
+      j += 2;
+    } else if (c == '\'' || c == '"' || c == '`') {
+      j = skip_quoted(line, length, j);
+    } else if (c == '(') {
+      depth++;
+      j++;
+    } else if (c == ')' && --depth == 0) {
+      break;
+    } else {
+      j++;
+    }
+  }
+  if (j > length)
+    j = length;
+  memcpy(token + *n, line + start, j - start);
+  *n += j - start;
+  token[(*n)++] = TOKEN_SUBST_END;
+  return j < length ? j + 1 : length;
 }
 
-static void *copy_word(char *source, size_t n) {
-  source[n] = '\0';
-  char *word = (char *) malloc(n + 1);
-  strncpy(word, source, n + 1);
-  return word;
+struct tokens *tokens_create(void) {
+  return (struct tokens *) calloc(1, sizeof(struct tokens));
 }
 
 struct tokens *tokenize(const char *line) {
@@ -29,72 +220,149 @@ struct tokens *tokenize(const char *line) {
     return NULL;
   }
 
-  static char token[4096];
-  size_t n = 0, n_max = 4096;
-  struct tokens *tokens;
-  size_t line_length = strlen(line);
+  struct tokens *tokens = tokens_create();
+  tokenize_into(tokens, line);
+  return tokens;
+}
+
+void tokenize_into(struct tokens *tokens, const char *line) {
+  tokenize_buffer(tokens, line, strlen(line));
+}
 
-  tokens = (struct tokens *) malloc(sizeof(struct tokens));
+void tokenize_buffer(struct tokens *tokens, const char *line, size_t line_length) {
   tokens->tokens_length = 0;
-  tokens->tokens = NULL;
-  tokens->buffers_length = 0;
-  tokens->buffers = NULL;
+
+  /* Unescaping never makes a word longer, and the backslash kept before a quoted pattern
+   * character at most doubles it, paid for by the quotes around it. Every byte but an operator is
+   * followed by at least one other byte before its terminator is needed, and an operator needs
+   * at most two terminators, the one of the word before it and its own, so everything fits in
+   * twice the line. */
+  if (tokens->buffer_capacity < 2 * line_length + 1) {
+    free(tokens->buffer);
+    tokens->buffer_capacity = 2 * line_length + 1;
+    tokens->buffer = (char *) malloc(tokens->buffer_capacity);
+  }
+
+  char *token = tokens->buffer;
+  size_t n = 0;
+  struct word word = {0, 0, false, false, false, 0, 0};
 
   const int MODE_NORMAL = 0,
         MODE_SQUOTE = 1,
         MODE_DQUOTE = 2;
   int mode = MODE_NORMAL;
 
-  for (unsigned int i = 0; i < line_length; i++) {
-    char c = line[i];
+  size_t i = 0;
+  while (i < line_length) {
+    /* Copy the run of plain characters up to the next byte that needs a decision */
+    size_t run, copied;
+    if (mode == MODE_NORMAL)
+      run = scanner->word(line + i, line_length - i);
+    else
+      run = scanner->quoted(line + i, line_length - i, mode == MODE_SQUOTE ? '\'' : '"');
+    bool substitution = false, expand = false;
+    if (mode != MODE_SQUOTE) {
+      size_t before = before_substitution(line + i, run, line_length - i, mode == MODE_DQUOTE,
+                                          &expand);
+      substitution = before < run || (i + run < line_length && line[i + run] == '`');
+      run = before;
+      if (expand)
+        word.flags |= TOKEN_EXPAND;
+    }
     if (mode == MODE_NORMAL) {
+      memcpy(token + n, line + i, run);
+      copied = run;
+      if (run > 0 && (memchr(line + i, '<', run) || memchr(line + i, '>', run)))
+        word.flags |= TOKEN_REDIRECT;
+    } else {
+      copied = copy_quoted(token + n, line + i, run, &word.escapes);
+    }
+    if (mode == MODE_SQUOTE && run > 0 && memchr(line + i, '$', run)) {
+      for (char *d = token + n; (d = memchr(d, '$', token + n + copied - d)); d++)
+        *d = TOKEN_LITERAL_DOLLAR;
+      word.literal_dollars = true;
+    }
+    n += copied;
+    i += run;
+    if (substitution) {
+      i = copy_substitution(line, line_length, i, token, &n, mode == MODE_DQUOTE);
+      word.flags |= TOKEN_EXPAND;
+      continue;
+    }
+    if (i == line_length)
+      break;
+
+    char c = line[i++];
+    if (c == '\\' && (mode == MODE_SQUOTE ||
+                      (mode == MODE_DQUOTE && i < line_length && !strchr("$`\"\\\n", line[i])))) {
+      /* Text in single quotes is kept as it is, and in double quotes a backslash only escapes
+       * $ ` " \ and newline. Doubled, for drop_escapes to give back one. */
+      token[n++] = '\\';
+      token[n++] = '\\';
+      word.escapes = true;
+    } else if (c == '\\' && i < line_length && line[i] == '\n') {
+      /* A line continuation leaves nothing */
+      i++;
+    } else if (c == '\\') {
+      start_quoted(&word, n);
+      if (i < line_length) {
+        if (line[i] == '$') {
+          word.literal_dollars = true;
+          token[n++] = TOKEN_LITERAL_DOLLAR;
+          i++;
+        } else {
+          /* A pattern character or backslash keeps one before it, which ends a name already */
+          if (is_pattern(line[i]) || line[i] == '\\') {
+            token[n++] = '\\';
+            word.escapes = true;
+          } else {
+            end_name(token, &word, &n);
+          }
+          token[n++] = line[i++];
+        }
+      }
+    } else if (mode == MODE_NORMAL) {
       if (c == '\'') {
+        end_name(token, &word, &n);
         mode = MODE_SQUOTE;
+        start_quoted(&word, n);
       } else if (c == '"') {
+        end_name(token, &word, &n);
         mode = MODE_DQUOTE;
-      } else if (c == '\\') {
-        if (i + 1 < line_length) {
-          token[n++] = line[++i];
-        }
-      } else if (isspace(c)) {
-        if (n > 0) {
-          void *word = copy_word(token, n);
-          vector_push(&tokens->tokens, &tokens->tokens_length, word);
-          n = 0;
-        }
-      } else {
+        start_quoted(&word, n);
+      } else if (is_pattern(c)) {
+        if (c != '[')
+          word.flags |= TOKEN_GLOB;
+        else if (!word.bracket)
+          word.bracket = n - word.start + 1;
         token[n++] = c;
-      }
-    } else if (mode == MODE_SQUOTE) {
-      if (c == '\'') {
-        mode = MODE_NORMAL;
-      } else if (c == '\\') {
-        if (i + 1 < line_length) {
-          token[n++] = line[++i];
-        }
-      } else {
+      } else if ((c == '&' || c == '|') && n > word.start &&
+                 (token[n - 1] == '<' || token[n - 1] == '>')) {
+        /* Part of a redirection such as 2>&1 or >| */
         token[n++] = c;
-      }
-    } else if (mode == MODE_DQUOTE) {
-      if (c == '"') {
-        mode = MODE_NORMAL;
-      } else if (c == '\\') {
-        if (i + 1 < line_length) {
-          token[n++] = line[++i];
-        }
       } else {
-        token[n++] = c;
+        /* Whitespace or an operator ends the word */
+        if (n > word.start || word.flags)
+          end_word(tokens, token, &word, &n);
+        if (is_operator(c)) {
+          /* ;; && and || are operators of their own */
+          token[n++] = c;
+          if ((c == ';' || c == '&' || c == '|') && i < line_length && line[i] == c)
+            token[n++] = line[i++];
+          token[n++] = '\0';
+          push_offset(tokens, word.start, TOKEN_OPERATOR);
+          word.start = n;
+        }
       }
+    } else {
+      /* The closing quote */
+      end_name(token, &word, &n);
+      mode = MODE_NORMAL;
     }
-    if (n + 1 >= n_max) abort();
   }
 
-  if (n > 0) {
-    void *word = copy_word(token, n);
-    vector_push(&tokens->tokens, &tokens->tokens_length, word);
-    n = 0;
-  }
-  return tokens;
+  if (n > word.start || word.flags)
+    end_word(tokens, token, &word, &n);
 }
 
 size_t tokens_get_length(struct tokens *tokens) {
@@ -109,7 +377,15 @@ char *tokens_get_token(struct tokens *tokens, size_t n) {
   if (tokens == NULL || n >= tokens->tokens_length) {
     return NULL;
   } else {
-    return tokens->tokens[n];
+    return tokens->buffer + tokens->offsets[n];
+  }
+}
+
+int tokens_get_flags(struct tokens *tokens, size_t n) {
+  if (tokens == NULL || n >= tokens->tokens_length) {
+    return 0;
+  } else {
+    return tokens->flags[n];
   }
 }
 
@@ -117,14 +393,8 @@ void tokens_destroy(struct tokens *tokens) {
   if (tokens == NULL) {
     return;
   }
-  for (int i = 0; i < tokens->tokens_length; i++) {
-    free(tokens->tokens[i]);
-  }
-  for (int i = 0; i < tokens->buffers_length; i++) {
-    free(tokens->buffers[i]);
-  }
-  if (tokens->tokens) {
-    free(tokens->tokens);
-  }
+  free(tokens->offsets);
+  free(tokens->flags);
+  free(tokens->buffer);
   free(tokens);
 }
@@ -1,16 +1,70 @@
 #pragma once
 
+#include <stddef.h>
+
 /* A struct that represents a list of words. */
 struct tokens;
 
+/* How a word was written. An operator is one of ; ;; & && | || ( and ) outside of quotes, which
+ * is a word of its own even without blanks around it. A quoted word had some part of it in quotes
+ * or escaped, so it may be empty and is never a reserved word or an operator. */
+#define TOKEN_OPERATOR 1
+#define TOKEN_QUOTED 2
+
+/* The word has a $ outside of single quotes, to be expanded when the command runs. In such words
+ * a $ that was quoted is stored as TOKEN_LITERAL_DOLLAR, which the expansion turns back into a $.
+ * Other words keep their $ as they are. */
+#define TOKEN_EXPAND 4
+#define TOKEN_LITERAL_DOLLAR '\001'
+#define TOKEN_LITERAL_DOLLAR_STRING "\001"
+
+/* In words marked TOKEN_EXPAND, a quote or an escape that comes right after a character of a name
+ * is stored as TOKEN_NAME_END, which ends a variable name there and expands to nothing: "$x"y is
+ * the value of x followed by y. Other words have none. */
+#define TOKEN_NAME_END '\005'
+#define TOKEN_NAME_END_STRING "\005"
+
+/* The word has a *, ? or [...] outside of quotes, so it is a pattern for pathname expansion. In
+ * such words the pattern characters and backslashes that were quoted keep a backslash in front
+ * of them, other words have none. */
+#define TOKEN_GLOB 8
+
+/* The word has a < or > outside of quotes, so it may be a redirection even if it is quoted, as
+ * in >"a file" */
+#define TOKEN_REDIRECT 16
+
+/* The word starts with a name and an = outside of quotes, so it sets a variable where a command
+ * may take assignments. "x=1" and x\=1 are plain words, x="a b" is an assignment. */
+#define TOKEN_ASSIGNMENT 32
+
+/* A command substitution, $(...) or `...`, is kept in its word as the text of the commands
+ * between TOKEN_SUBST, or TOKEN_SUBST_QUOTED inside double quotes, and TOKEN_SUBST_END. The word
+ * is marked TOKEN_EXPAND. */
+#define TOKEN_SUBST '\002'
+#define TOKEN_SUBST_QUOTED '\003'
+#define TOKEN_SUBST_END '\004'
+
+/* Make an empty list of words that can be filled by tokenize_into. */
+struct tokens *tokens_create(void);
+
 /* Turn a string into a list of words. */
 struct tokens *tokenize(const char *line);
 
+/* Turn a string into a list of words, reusing the memory of an existing list. The words
+ * previously returned by tokens_get_token are no longer valid afterwards. */
+void tokenize_into(struct tokens *tokens, const char *line);
+
+/* Like tokenize_into, for a line of the given length that need not be NUL-terminated. */
+void tokenize_buffer(struct tokens *tokens, const char *line, size_t length);
+
 /* How many words are there? */
 size_t tokens_get_length(struct tokens *tokens);
 
 /* Get me the Nth word (zero-indexed) */
 char *tokens_get_token(struct tokens *tokens, size_t n);
 
+/* Get the TOKEN_ flags of the Nth word */
+int tokens_get_flags(struct tokens *tokens, size_t n);
+
 /* Free the memory */
 void tokens_destroy(struct tokens *tokens);
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include "trie.h"
+
+/* The children of a node are kept sorted by their byte, so that a walk comes out in order */
+struct trie_node {
+  unsigned char *bytes;
+  struct trie_node **children;
+  unsigned short length;
+  unsigned short capacity;
+  /* Times the word ending here was added, and words ending in the whole subtree */
+  unsigned int count;
+  size_t words;
+};
+
+struct trie {
+  struct trie_node root;
+  /* The word being built during a walk */
+  char *buffer;
+  size_t buffer_capacity;
+};
+
+struct trie *trie_create(void) {
+  return (struct trie *) calloc(1, sizeof(struct trie));
+}
+
+/* Position of the child for byte c, or where it would be inserted */
+static size_t child_index(const struct trie_node *node, unsigned char c) {
+  size_t low = 0, high = node->length;
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    if (node->bytes[middle] < c)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+static struct trie_node *child(const struct trie_node *node, unsigned char c) {
+  size_t i = child_index(node, c);
+  return i < node->length && node->bytes[i] == c ? node->children[i] : NULL;
+}
+
+static struct trie_node *add_child(struct trie_node *node, unsigned char c) {
+  size_t i = child_index(node, c);
+  if (i < node->length && node->bytes[i] == c)
+    return node->children[i];
+
+  if (node->length == node->capacity) {
+    node->capacity = node->capacity ? node->capacity * 2 : 2;
+    node->bytes = (unsigned char *) realloc(node->bytes, node->capacity);
+    node->children =
+        (struct trie_node **) realloc(node->children, sizeof(struct trie_node *) * node->capacity);
+  }
+  memmove(node->bytes + i + 1, node->bytes + i, node->length - i);
+  memmove(node->children + i + 1, node->children + i,
+          sizeof(struct trie_node *) * (node->length - i));
+  node->bytes[i] = c;
+  node->children[i] = (struct trie_node *) calloc(1, sizeof(struct trie_node));
+  node->length++;
+  return node->children[i];
+}
+
+void trie_add(struct trie *trie, const char *word) {
+  struct trie_node *node = &trie->root;
+  node->words++;
+  for (const unsigned char *p = (const unsigned char *) word; *p; p++) {
+    node = add_child(node, *p);
+    node->words++;
+  }
+  node->count++;
+}
+
+/* Nodes left without words are kept, since the same names tend to come back when a directory is
+ * listed again, and walks skip them through their word counts. */
+void trie_remove(struct trie *trie, const char *word) {
+  struct trie_node *node = &trie->root;
+  for (const unsigned char *p = (const unsigned char *) word; node && *p; p++)
+    node = child(node, *p);
+  if (!node || node->count == 0)
+    return;
+
+  node->count--;
+  node = &trie->root;
+  node->words--;
+  for (const unsigned char *p = (const unsigned char *) word; *p; p++) {
+    node = child(node, *p);
+    node->words--;
+  }
+}
+
+static void walk(struct trie *trie, const struct trie_node *node, size_t depth,
+                 trie_visit_t *visit, void *data) {
+  if (depth + 1 >= trie->buffer_capacity) {
+    trie->buffer_capacity = (depth + 1) * 2;
+    trie->buffer = (char *) realloc(trie->buffer, trie->buffer_capacity);
+  }
+  if (node->count) {
+    trie->buffer[depth] = '\0';
+    visit(trie->buffer, data);
+  }
+  for (size_t i = 0; i < node->length; i++) {
+    if (node->children[i]->words == 0)
+      continue;
+    trie->buffer[depth] = (char) node->bytes[i];
+    walk(trie, node->children[i], depth + 1, visit, data);
+  }
+}
+
+void trie_walk(struct trie *trie, const char *prefix, size_t prefix_length, trie_visit_t *visit,
+               void *data) {
+  const struct trie_node *node = &trie->root;
+  for (size_t i = 0; node && i < prefix_length; i++)
+    node = child(node, (unsigned char) prefix[i]);
+  if (!node || node->words == 0)
+    return;
+
+  if (prefix_length + 1 >= trie->buffer_capacity) {
+    trie->buffer_capacity = (prefix_length + 1) * 2;
+    trie->buffer = (char *) realloc(trie->buffer, trie->buffer_capacity);
+  }
+  memcpy(trie->buffer, prefix, prefix_length);
+  walk(trie, node, prefix_length, visit, data);
+}
+
+static void free_children(struct trie_node *node) {
+  for (size_t i = 0; i < node->length; i++) {
+    free_children(node->children[i]);
+    free(node->children[i]);
+  }
+  free(node->bytes);
+  free(node->children);
+}
+
+void trie_destroy(struct trie *trie) {
+  if (!trie)
+    return;
+  free_children(&trie->root);
+  free(trie->buffer);
+  free(trie);
+}
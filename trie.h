@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+/* A set of words kept in a byte trie, for listing every word that starts with a prefix. Each word
+ * can be added more than once and stays in the set until it was removed as often. */
+struct trie;
+
+struct trie *trie_create(void);
+
+void trie_add(struct trie *trie, const char *word);
+
+/* Take back one addition of the word, if there was one */
+void trie_remove(struct trie *trie, const char *word);
+
+/* Call visit with every word starting with the prefix, in byte order. The word is terminated and
+ * only valid during the call. */
+typedef void trie_visit_t(const char *word, void *data);
+void trie_walk(struct trie *trie, const char *prefix, size_t prefix_length, trie_visit_t *visit,
+               void *data);
+
+void trie_destroy(struct trie *trie);
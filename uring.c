@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "uring.h"
+
+/* Entries of the submission queue. The completion queue has twice as many, and a kernel with
+ * IORING_FEAT_NODROP keeps what does not fit instead of dropping it. */
+#define URING_ENTRIES 256
+
+bool uring_enabled;
+
+/* What to do with the completion of a request in flight. The user data of the request is its
+ * index, and free entries are chained through next. */
+struct request {
+  uring_complete_t *complete;
+  void *data;
+  uint64_t tag;
+  size_t next;
+};
+
+static struct request *requests;
+static size_t requests_capacity;
+static size_t free_request = SIZE_MAX;
+
+static struct {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned sq_entries;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map, *cq_map;
+  size_t sq_size, cq_size, sqes_size;
+  /* Queued but not submitted yet */
+  unsigned queued;
+} ring = {.fd = -1};
+
+static int enter(unsigned submit, unsigned wait_for) {
+  return (int) syscall(SYS_io_uring_enter, ring.fd, submit, wait_for,
+                       wait_for ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+int uring_open(void) {
+  struct io_uring_params params;
+
+  if (ring.fd != -1)
+    return 0;
+  memset(&params, 0, sizeof(params));
+  int fd = (int) syscall(SYS_io_uring_setup, URING_ENTRIES, &params);
+  if (fd == -1)
+    return -1;
+
+  ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  /* Newer kernels map both rings at once */
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring.cq_size > ring.sq_size)
+      ring.sq_size = ring.cq_size;
+    ring.cq_size = 0;
+  }
+  ring.sq_map = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                     IORING_OFF_SQ_RING);
+  ring.cq_map = ring.cq_size ? mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)
+                             : ring.sq_map;
+  ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring.sqes = (struct io_uring_sqe *) mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring.sq_map == MAP_FAILED || ring.cq_map == MAP_FAILED || ring.sqes == MAP_FAILED) {
+    int saved_errno = errno;
+    if (ring.sq_map != MAP_FAILED)
+      munmap(ring.sq_map, ring.sq_size);
+    if (ring.cq_size && ring.cq_map != MAP_FAILED)
+      munmap(ring.cq_map, ring.cq_size);
+    if (ring.sqes != MAP_FAILED)
+      munmap(ring.sqes, ring.sqes_size);
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+
+  char *sq = (char *) ring.sq_map, *cq = (char *) ring.cq_map;
+  ring.sq_head = (unsigned *) (sq + params.sq_off.head);
+  ring.sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  ring.sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  ring.sq_array = (unsigned *) (sq + params.sq_off.array);
+  ring.sq_entries = params.sq_entries;
+  ring.cq_head = (unsigned *) (cq + params.cq_off.head);
+  ring.cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  ring.cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+  ring.fd = fd;
+  return 0;
+}
+
+void uring_close(void) {
+  if (ring.fd == -1)
+    return;
+  munmap(ring.sqes, ring.sqes_size);
+  if (ring.cq_size)
+    munmap(ring.cq_map, ring.cq_size);
+  munmap(ring.sq_map, ring.sq_size);
+  close(ring.fd);
+  ring.fd = -1;
+  ring.queued = 0;
+  free(requests);
+  requests = NULL;
+  requests_capacity = 0;
+  free_request = SIZE_MAX;
+  uring_enabled = false;
+}
+
+/* Record what to do with the completion, returning the index that stands for it */
+static size_t add_request(uring_complete_t *complete, void *data, uint64_t tag) {
+  if (free_request == SIZE_MAX) {
+    size_t capacity = requests_capacity ? requests_capacity * 2 : 64;
+    requests = (struct request *) realloc(requests, sizeof(struct request) * capacity);
+    for (size_t i = capacity; i-- > requests_capacity;) {
+      requests[i].next = free_request;
+      free_request = i;
+    }
+    requests_capacity = capacity;
+  }
+  size_t index = free_request;
+  free_request = requests[index].next;
+  requests[index].complete = complete;
+  requests[index].data = data;
+  requests[index].tag = tag;
+  return index;
+}
+
+/* The next free submission entry, cleared. A full queue is submitted first. */
+static struct io_uring_sqe *next_sqe(uring_complete_t *complete, void *data, uint64_t tag) {
+  unsigned tail = *ring.sq_tail;
+  while (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) == ring.sq_entries) {
+    int submitted = enter(ring.queued, 0);
+    if (submitted > 0)
+      ring.queued -= (unsigned) submitted;
+  }
+  unsigned index = tail & *ring.sq_mask;
+  struct io_uring_sqe *sqe = &ring.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = add_request(complete, data, tag);
+  ring.sq_array[index] = index;
+  return sqe;
+}
+
+/* Hand the entry filled in since next_sqe to the kernel side of the queue */
+static void push_sqe(void) {
+  __atomic_store_n(ring.sq_tail, *ring.sq_tail + 1, __ATOMIC_RELEASE);
+  ring.queued++;
+}
+
+void uring_poll(int fd, unsigned events, uring_complete_t *complete, void *data, uint64_t tag) {
+  struct io_uring_sqe *sqe = next_sqe(complete, data, tag);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  push_sqe();
+}
+
+void uring_read(int fd, void *buffer, size_t length, uring_complete_t *complete, void *data,
+                uint64_t tag) {
+  struct io_uring_sqe *sqe = next_sqe(complete, data, tag);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t) buffer;
+  sqe->len = (unsigned) length;
+  /* Pipes have no position, -1 reads from the current one of seekable files */
+  sqe->off = (uint64_t) -1;
+  push_sqe();
+}
+
+void uring_openat(const char *path, int flags, mode_t mode, uring_complete_t *complete,
+                  void *data, uint64_t tag) {
+  struct io_uring_sqe *sqe = next_sqe(complete, data, tag);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t) path;
+  sqe->len = mode;
+  sqe->open_flags = (unsigned) flags;
+  push_sqe();
+}
+
+int uring_wait(const bool *done) {
+  for (;;) {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+      struct request *request = &requests[cqe->user_data];
+      uring_complete_t *complete = request->complete;
+      void *data = request->data;
+      uint64_t tag = request->tag;
+      int result = cqe->res;
+      /* Free first, the handler may queue the next request */
+      request->next = free_request;
+      free_request = (size_t) cqe->user_data;
+      __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+      complete(tag, result, data);
+    }
+
+    if (*done && ring.queued == 0)
+      return 0;
+
+    int submitted = enter(ring.queued, *done ? 0 : 1);
+    if (submitted == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      return -1;
+    if (submitted > 0)
+      ring.queued -= (unsigned) submitted;
+  }
+}
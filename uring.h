@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* A single io_uring of the shell, set up with the raw system calls. Requests are queued with the
+ * function that handles their completion, submitted together and completed in batches, so waiting
+ * on many children or descriptors costs one system call instead of one each. */
+
+/* Whether the shell waits for children and their I/O through the ring. It is selected with the
+ * events builtin and only ever true once uring_open succeeded. */
+extern bool uring_enabled;
+
+/* Set up the ring. Returns 0, or -1 with errno set if the kernel does not allow io_uring. */
+int uring_open(void);
+
+/* Tear the ring down. In a forked child this only drops its copy, requests in flight stay with
+ * the shell. */
+void uring_close(void);
+
+/* Called for a completed request with the tag it was queued with and its result: what the system
+ * call returns, or minus the error */
+typedef void uring_complete_t(uint64_t tag, int result, void *data);
+
+/* Queue a request, submitted by the next uring_wait, which hands its completion to complete */
+void uring_poll(int fd, unsigned events, uring_complete_t *complete, void *data, uint64_t tag);
+void uring_read(int fd, void *buffer, size_t length, uring_complete_t *complete, void *data,
+                uint64_t tag);
+void uring_openat(const char *path, int flags, mode_t mode, uring_complete_t *complete,
+                  void *data, uint64_t tag);
+
+/* Submit what is queued and handle completions, of any request in flight, until one of them sets
+ * *done. Returns 0, or -1 if the ring failed. */
+int uring_wait(const bool *done);
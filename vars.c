@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vars.h"
+
+#define VARS_BUCKETS_MIN 64
+
+#define VARS_WATCHES_MAX 8
+
+struct var {
+  char *name;
+  char *value;
+  bool exported;
+  struct var *next;
+};
+
+static struct var **buckets;
+static size_t buckets_length;
+static size_t vars_length;
+
+/* The packed environment: the pointers, then every NAME=value string, in one block */
+static char **envp;
+static bool envp_stale = true;
+
+static struct {
+  const char *name;
+  vars_watch_t *callback;
+} watches[VARS_WATCHES_MAX];
+static size_t watches_length;
+
+/* FNV-1a */
+static size_t hash_name(const char *name) {
+  unsigned int h = 2166136261u;
+  for (; *name; name++)
+    h = (h ^ (unsigned char) *name) * 16777619u;
+  return h;
+}
+
+/* Double the buckets once there are more variables than buckets */
+static void grow(void) {
+  size_t length = buckets_length ? buckets_length * 2 : VARS_BUCKETS_MIN;
+  struct var **grown = (struct var **) calloc(length, sizeof(struct var *));
+
+  for (size_t i = 0; i < buckets_length; i++) {
+    struct var *var = buckets[i];
+    while (var) {
+      struct var *next = var->next;
+      size_t bucket = hash_name(var->name) & (length - 1);
+      var->next = grown[bucket];
+      grown[bucket] = var;
+      var = next;
+    }
+  }
+  free(buckets);
+  buckets = grown;
+  buckets_length = length;
+}
+
+static struct var **find(const char *name) {
+  if (buckets_length == 0)
+    grow();
+  struct var **link = &buckets[hash_name(name) & (buckets_length - 1)];
+  while (*link && strcmp((*link)->name, name))
+    link = &(*link)->next;
+  return link;
+}
+
+static void notify(const char *name, const char *value) {
+  for (size_t i = 0; i < watches_length; i++)
+    if (!strcmp(watches[i].name, name))
+      watches[i].callback(value);
+}
+
+static bool is_name_start(char c) {
+  return c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+size_t vars_name_length(const char *word) {
+  if (!is_name_start(word[0]))
+    return 0;
+  size_t n = 1;
+  while (is_name_start(word[n]) || (word[n] >= '0' && word[n] <= '9'))
+    n++;
+  return n;
+}
+
+static bool valid(const char *name) {
+  size_t n = vars_name_length(name);
+  if (n > 0 && name[n] == '\0')
+    return true;
+  printf("%s: not a valid identifier.\n", name);
+  return false;
+}
+
+/* Set the variable without checking its name */
+static void set(const char *name, const char *value, bool exported) {
+  struct var **link = find(name);
+  struct var *var = *link;
+
+  if (var) {
+    if (value == NULL || !strcmp(var->value, value)) {
+      /* Only exporting can change anything */
+      if (exported && !var->exported) {
+        var->exported = true;
+        envp_stale = true;
+      }
+      return;
+    }
+    free(var->value);
+  } else if (value == NULL) {
+    /* Exporting a variable that is not set waits for it to be */
+    return;
+  } else {
+    if (vars_length >= buckets_length) {
+      grow();
+      link = find(name);
+    }
+    var = (struct var *) calloc(1, sizeof(struct var));
+    var->name = strdup(name);
+    *link = var;
+    vars_length++;
+  }
+
+  var->value = strdup(value ? value : "");
+  var->exported = var->exported || exported;
+  if (var->exported)
+    envp_stale = true;
+  notify(name, var->value);
+}
+
+void vars_init(char **env) {
+  for (; env && *env; env++) {
+    const char *equals = strchr(*env, '=');
+    if (!equals)
+      continue;
+    char *name = strndup(*env, equals - *env);
+    set(name, equals + 1, true);
+    free(name);
+  }
+}
+
+const char *vars_get(const char *name) {
+  struct var *var = *find(name);
+  return var ? var->value : NULL;
+}
+
+int vars_set(const char *name, const char *value) {
+  if (!valid(name))
+    return -1;
+  set(name, value, false);
+  return 0;
+}
+
+int vars_export(const char *name, const char *value) {
+  if (!valid(name))
+    return -1;
+  set(name, value, true);
+  return 0;
+}
+
+void vars_unset(const char *name) {
+  struct var **link = find(name);
+  struct var *var = *link;
+  if (!var)
+    return;
+
+  *link = var->next;
+  vars_length--;
+  if (var->exported)
+    envp_stale = true;
+  free(var->name);
+  free(var->value);
+  free(var);
+  notify(name, NULL);
+}
+
+bool vars_is_assignment(const char *word) {
+  size_t n = vars_name_length(word);
+  return n > 0 && word[n] == '=';
+}
+
+void vars_assign(const char *word) {
+  size_t n = vars_name_length(word);
+  char *name = strndup(word, n);
+  set(name, word + n + 1, false);
+  free(name);
+}
+
+char **vars_environ(void) {
+  if (!envp_stale)
+    return envp;
+
+  size_t count = 0, size = 0;
+  for (size_t i = 0; i < buckets_length; i++) {
+    for (struct var *var = buckets[i]; var; var = var->next) {
+      if (var->exported) {
+        count++;
+        size += strlen(var->name) + strlen(var->value) + 2;
+      }
+    }
+  }
+
+  free(envp);
+  envp = (char **) malloc(sizeof(char *) * (count + 1) + size);
+  char *p = (char *) (envp + count + 1);
+  size_t k = 0;
+  for (size_t i = 0; i < buckets_length; i++) {
+    for (struct var *var = buckets[i]; var; var = var->next) {
+      if (!var->exported)
+        continue;
+      size_t name_length = strlen(var->name), value_length = strlen(var->value);
+      envp[k++] = p;
+      memcpy(p, var->name, name_length);
+      p[name_length] = '=';
+      memcpy(p + name_length + 1, var->value, value_length + 1);
+      p += name_length + value_length + 2;
+    }
+  }
+  envp[k] = NULL;
+  envp_stale = false;
+  return envp;
+}
+
+char **vars_environ_with(char **assignments, size_t length) {
+  char **base = vars_environ();
+  size_t count = 0;
+  while (base[count])
+    count++;
+
+  char **env = (char **) malloc(sizeof(char *) * (count + length + 1));
+  size_t k = 0;
+  for (size_t i = 0; i < count; i++) {
+    /* Leave out what an assignment replaces */
+    size_t name_length = strchr(base[i], '=') - base[i] + 1;
+    bool replaced = false;
+    for (size_t j = 0; j < length && !replaced; j++)
+      replaced = !strncmp(base[i], assignments[j], name_length);
+    if (!replaced)
+      env[k++] = base[i];
+  }
+  for (size_t j = 0; j < length; j++)
+    env[k++] = assignments[j];
+  env[k] = NULL;
+  return env;
+}
+
+void vars_print_exported(FILE *out) {
+  char **env = vars_environ();
+  for (; *env; env++)
+    fprintf(out, "export %s\n", *env);
+}
+
+void vars_visit(vars_visit_t *visit, void *data) {
+  for (size_t i = 0; i < buckets_length; i++)
+    for (struct var *var = buckets[i]; var; var = var->next)
+      visit(var->name, var->value, var->exported, data);
+}
+
+void vars_watch(const char *name, vars_watch_t *callback) {
+  if (watches_length == VARS_WATCHES_MAX)
+    return;
+  watches[watches_length].name = name;
+  watches[watches_length++].callback = callback;
+  callback(vars_get(name));
+}
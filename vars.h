@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* The variables of the shell, kept in a hash table. Exported ones make up the environment of the
+ * commands it starts, which is packed into one envp array that is only rebuilt after an exported
+ * variable changed. */
+
+/* Fill the table with the environment the shell was started with, every entry exported */
+void vars_init(char **env);
+
+/* The value of the variable, or NULL if it is not set. It stays valid until the variable
+ * changes. */
+const char *vars_get(const char *name);
+
+/* Set the variable, which stays exported if it was. Returns -1 after reporting a name that is not
+ * valid. */
+int vars_set(const char *name, const char *value);
+
+/* Export the variable, setting it first unless value is NULL. Returns -1 after reporting a name
+ * that is not valid. */
+int vars_export(const char *name, const char *value);
+
+void vars_unset(const char *name);
+
+/* Length of the variable name that word starts with, 0 if it does not start with one */
+size_t vars_name_length(const char *word);
+
+/* Whether the word has the shape of an assignment, NAME=value */
+bool vars_is_assignment(const char *word);
+
+/* Run an assignment word */
+void vars_assign(const char *word);
+
+/* The environment of commands, NULL terminated. It belongs to the store and stays valid until the
+ * next change of an exported variable. */
+char **vars_environ(void);
+
+/* The environment with the assignments, NAME=value, put over it, for a single command. The array
+ * is the caller's to free, the strings are not. */
+char **vars_environ_with(char **assignments, size_t length);
+
+/* Print the exported variables as export commands */
+void vars_print_exported(FILE *out);
+
+/* Call visit with every variable, in no particular order */
+typedef void vars_visit_t(const char *name, const char *value, bool exported, void *data);
+void vars_visit(vars_visit_t *visit, void *data);
+
+/* Have callback called with the new value, or NULL, every time the variable changes */
+typedef void vars_watch_t(const char *value);
+void vars_watch(const char *name, vars_watch_t *callback);